@@ -0,0 +1,210 @@
+#include "vera_banks.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static int popcount64(uint64_t x)
+{
+	int n = 0;
+
+	for(; x; n++)
+		x &= x - 1;
+
+	return n;
+}
+
+static int set_size(const VeraColorSet *set)
+{
+	return popcount64(set->bits[0]) + popcount64(set->bits[1])
+		+ popcount64(set->bits[2]) + popcount64(set->bits[3]);
+}
+
+static int set_union_size(const VeraColorSet *a, const VeraColorSet *b)
+{
+	int n = 0;
+
+	for(int i = 0; i < 4; i++)
+		n += popcount64(a->bits[i] | b->bits[i]);
+
+	return n;
+}
+
+static int set_contains(const VeraColorSet *outer, const VeraColorSet *inner)
+{
+	for(int i = 0; i < 4; i++)
+	{
+		if (inner->bits[i] & ~outer->bits[i])
+			return 0;
+	}
+
+	return 1;
+}
+
+static int compare_sets(const void *a, const void *b)
+{
+	const VeraColorSet *x = *(const VeraColorSet * const *) a;
+	const VeraColorSet *y = *(const VeraColorSet * const *) b;
+	int d = set_size(y) - set_size(x);
+
+	// largest sets first, then a fixed order so the result is repeatable
+	if (d)
+		return d;
+
+	return memcmp(x->bits, y->bits, sizeof(x->bits));
+}
+
+void vera_color_set_from_pixels(VeraColorSet *set, const uint8_t *pixels, size_t count)
+{
+	memset(set, 0, sizeof(VeraColorSet));
+
+	for(size_t i = 0; i < count; i++)
+		set->bits[pixels[i] >> 6] |= 1ull << (pixels[i] & 63);
+
+	set->bits[0] &= ~1ull;
+}
+
+VeraBanksStatus vera_banks_solve(VeraBanks *banks,
+		const VeraColorSet *sets,
+		size_t              count,
+		int                 bank_size,
+		size_t             *bad_tile)
+{
+	VeraColorSet *bank_sets = banks->sets;
+	const VeraColorSet **order;
+	int capacity = bank_size - 1;
+	VeraBanksStatus status = VERA_BANKS_OK;
+
+	memset(banks, 0, sizeof(VeraBanks));
+	banks->bank_size = bank_size;
+
+	for(size_t i = 0; i < count; i++)
+	{
+		if (set_size(&sets[i]) > capacity)
+		{
+			if (bad_tile)
+				*bad_tile = i;
+			return VERA_BANKS_TILE_COLORS;
+		}
+	}
+
+	order = malloc(count * sizeof(VeraColorSet *));
+	if (count && !order)
+		return VERA_BANKS_NO_MEMORY;
+
+	for(size_t i = 0; i < count; i++)
+		order[i] = &sets[i];
+
+	qsort(order, count, sizeof(VeraColorSet *), compare_sets);
+
+	/*
+	 * Best fit: every set goes to the bank it grows the least, ties going to
+	 * the fuller bank.  Taking the largest sets first leaves the small ones
+	 * to fill in the gaps, and sets already covered by a bank cost nothing.
+	 */
+	for(size_t i = 0; i < count && status == VERA_BANKS_OK; i++)
+	{
+		const VeraColorSet *set = order[i];
+		int best = -1;
+		int best_growth = capacity + 1;
+		int best_size = 0;
+
+		if (i > 0 && memcmp(set, order[i - 1], sizeof(VeraColorSet)) == 0)
+			continue;
+
+		for(int b = 0; b < banks->bank_count; b++)
+		{
+			int size = set_size(&bank_sets[b]);
+			int grown = set_union_size(&bank_sets[b], set);
+
+			if (grown > capacity)
+				continue;
+
+			if (grown - size < best_growth || (grown - size == best_growth && size > best_size))
+			{
+				best = b;
+				best_growth = grown - size;
+				best_size = size;
+			}
+		}
+
+		if (best < 0)
+		{
+			if (banks->bank_count == VERA_MAX_BANKS)
+			{
+				status = VERA_BANKS_TOO_MANY;
+				break;
+			}
+
+			best = banks->bank_count++;
+			memset(&bank_sets[best], 0, sizeof(VeraColorSet));
+		}
+
+		for(int w = 0; w < 4; w++)
+			bank_sets[best].bits[w] |= set->bits[w];
+	}
+
+	free(order);
+
+	if (status != VERA_BANKS_OK)
+		return status;
+
+	// slots in source index order, slot 0 is the transparent index 0
+	for(int b = 0; b < banks->bank_count; b++)
+	{
+		int slot = 1;
+
+		banks->colors[b][0] = 0;
+
+		for(int c = 1; c < 256; c++)
+		{
+			if (bank_sets[b].bits[c >> 6] & (1ull << (c & 63)))
+			{
+				banks->colors[b][slot] = c;
+				banks->remap[b][c] = slot;
+				slot++;
+			}
+		}
+
+		banks->color_count[b] = slot;
+	}
+
+	return VERA_BANKS_OK;
+}
+
+int vera_banks_find(const VeraBanks *banks, const VeraColorSet *set)
+{
+	for(int b = 0; b < banks->bank_count; b++)
+	{
+		if (set_contains(&banks->sets[b], set))
+			return b;
+	}
+
+	return -1;
+}
+
+void vera_banks_remap(const VeraBanks *banks, int bank, uint8_t *pixels, size_t count)
+{
+	const uint8_t *remap = banks->remap[bank];
+
+	for(size_t i = 0; i < count; i++)
+		pixels[i] = remap[pixels[i]];
+}
+
+void vera_banks_colormap(const VeraBanks *banks,
+		const uint8_t *cmap,
+		int            palsize,
+		uint8_t       *out)
+{
+	memset(out, 0, (size_t) banks->bank_count * 16 * 3);
+
+	for(int b = 0; b < banks->bank_count; b++)
+	{
+		for(int slot = 0; slot < banks->color_count[b]; slot++)
+		{
+			int c = banks->colors[b][slot];
+
+			if (c < palsize)
+				memcpy(out + (b * 16 + slot) * 3, cmap + c * 3, 3);
+		}
+	}
+}
@@ -0,0 +1,74 @@
+#ifndef VERA_BANKS_H
+#define VERA_BANKS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Palette bank assignment for 2bpp and 4bpp tiles.
+ *
+ * In these modes a tile can only use the colors of one 16 entry palette
+ * block, chosen per tile by the palette offset in the tile map.  Pixel value
+ * 0 is always transparent, so index 0 of the source image stays 0 in every
+ * bank and each bank holds at most 15 (4bpp) or 3 (2bpp) other colors.
+ *
+ * The solver takes the set of colors used by every tile and packs them into
+ * as few banks as it can, then gives each tile the lowest bank holding all
+ * of its colors, so tiles that only differ by bank end up identical.
+ */
+
+#define VERA_MAX_BANKS  16
+
+typedef enum
+{
+	VERA_BANKS_OK = 0,
+	VERA_BANKS_TILE_COLORS,   /* a single tile uses more colors than a bank holds */
+	VERA_BANKS_TOO_MANY,      /* the tiles need more than VERA_MAX_BANKS banks */
+	VERA_BANKS_NO_MEMORY
+} VeraBanksStatus;
+
+typedef struct
+{
+	uint64_t bits[4];
+} VeraColorSet;
+
+typedef struct
+{
+	int       bank_size;                                /* 4 or 16 slots, slot 0 transparent */
+	int       bank_count;
+	int       color_count[VERA_MAX_BANKS];              /* slots in use, including slot 0 */
+	VeraColorSet sets[VERA_MAX_BANKS];                  /* colors of each bank, without 0 */
+	uint8_t   colors[VERA_MAX_BANKS][16];               /* source index held by each slot */
+	uint8_t   remap[VERA_MAX_BANKS][256];               /* source index -> slot */
+} VeraBanks;
+
+/* collects the colors used by pixels, leaving out the transparent index 0 */
+void vera_color_set_from_pixels(VeraColorSet *set, const uint8_t *pixels, size_t count);
+
+/*
+ * Assigns the color sets of count tiles to banks of bank_size slots.  On
+ * VERA_BANKS_TILE_COLORS, *bad_tile is set to the offending tile.
+ */
+VeraBanksStatus vera_banks_solve(VeraBanks *banks,
+		const VeraColorSet *sets,
+		size_t              count,
+		int                 bank_size,
+		size_t             *bad_tile);
+
+/* lowest bank holding every color of set, or -1 */
+int vera_banks_find(const VeraBanks *banks, const VeraColorSet *set);
+
+/* rewrites pixels in place into slot numbers of the given bank */
+void vera_banks_remap(const VeraBanks *banks, int bank, uint8_t *pixels, size_t count);
+
+/*
+ * Builds the colormap to load into the VERA: bank_count blocks of 16 colors,
+ * bank b at entry b * 16.  cmap is the source colormap of palsize colors and
+ * out must hold bank_count * 16 * 3 bytes.
+ */
+void vera_banks_colormap(const VeraBanks *banks,
+		const uint8_t *cmap,
+		int            palsize,
+		uint8_t       *out);
+
+#endif
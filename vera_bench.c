@@ -0,0 +1,282 @@
+/*
+ * vera-bench: times the packers of libvera.a on synthetic images.
+ *
+ * Packs random tile sets at every bpp and tile size, and bitmaps at every
+ * bpp, on square images from 64x64 up to 4096x4096.  For each it prints the
+ * input pixels packed per second and the allocations one pack makes, so a
+ * regression shows up as a number.  vera-bench THREADS packs the tile sets
+ * on that many threads.  Last, it dithers 640x480 RGB frames onto a 256
+ * color palette in every mode.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "vera_dither.h"
+#include "vera_export.h"
+#include "vera_threads.h"
+
+#define MIN_SECONDS  0.05      /* each case repeats for at least this long */
+#define FRAME_WIDTH  640
+#define FRAME_HEIGHT 480
+
+static const int image_sizes[] = { 64, 256, 1024, 4096 };
+static const int tile_sizes[] = { 8, 16, 32, 64 };
+static const int bpps[] = { 1, 2, 4, 8 };
+static const char * const dither_names[] = { "none", "floyd", "atkinson", "bayer4", "bayer8" };
+
+#define N_ELEMENTS(a)  ((int) (sizeof(a) / sizeof((a)[0])))
+
+// the link wraps the allocator, so every allocation made while packing counts
+static unsigned long allocations;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *p, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+	__atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+	__atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+	return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *p, size_t size)
+{
+	__atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+	return __real_realloc(p, size);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* times one case, printing its best pass; returns -1 if packing failed */
+static int bench(const char *kind,
+		const char         *tile,
+		const VeraImage    *image,
+		const VeraSaveVals *vals,
+		const VeraRunner   *runner)
+{
+	int tiles = vals->export_type != BITMAP;
+	size_t length = tiles ? vera_tile_set_size(image, vals) : vera_bitmap_size(image, vals);
+	uint8_t *dst = malloc(length + 1);
+	double best = 0;
+	double total = 0;
+	unsigned long allocs = 0;
+	int runs = 0;
+	VeraError error;
+
+	if (! dst)
+	{
+		fprintf(stderr, "vera-bench: out of memory\n");
+		return -1;
+	}
+
+	while (runs == 0 || total < MIN_SECONDS)
+	{
+		unsigned long before = __atomic_load_n(&allocations, __ATOMIC_RELAXED);
+		double start = now();
+		int ret = tiles
+			? vera_pack_tile_set(image, vals, runner, dst, &error)
+			: vera_pack_bitmap(image, vals, dst, &error);
+		double seconds = now() - start;
+
+		if (ret != 0)
+		{
+			fprintf(stderr, "vera-bench: %s\n", error.message);
+			free(dst);
+			return -1;
+		}
+
+		allocs = __atomic_load_n(&allocations, __ATOMIC_RELAXED) - before;
+
+		if (runs == 0 || seconds < best)
+			best = seconds;
+
+		total += seconds;
+		runs++;
+	}
+
+	printf("%-7s %4d  %-6s %5dx%-5d %10.1f %7lu\n", kind, vals->tile_bpp, tile,
+			image->width, image->height,
+			best > 0 ? (double) image->width * image->height / best / 1e6 : 0.0,
+			allocs);
+
+	free(dst);
+
+	return 0;
+}
+
+/* times dithering one frame in each mode, whole and kept inside 8x8 tiles */
+static int bench_dither(const uint8_t *rgb)
+{
+	uint8_t cmap[256 * 3];
+	uint8_t *dst = malloc(FRAME_WIDTH * FRAME_HEIGHT);
+
+	if (! dst)
+	{
+		fprintf(stderr, "vera-bench: out of memory\n");
+		return -1;
+	}
+
+	// 8 levels of red and green, 4 of blue
+	for(int i = 0; i < 256; i++)
+	{
+		cmap[i * 3] = (i >> 5) * 255 / 7;
+		cmap[i * 3 + 1] = ((i >> 2) & 7) * 255 / 7;
+		cmap[i * 3 + 2] = (i & 3) * 255 / 3;
+	}
+
+	printf("\n%-9s %5s  %-11s %10s %7s\n", "dither", "tiles", "image", "MB/s", "allocs");
+
+	for(int mode = DITHER_NONE; mode <= DITHER_BAYER_8; mode++)
+	{
+		for(int tiles = 0; tiles < 2; tiles++)
+		{
+			VeraSaveVals vals = vera_default_vals;
+			double best = 0;
+			double total = 0;
+			unsigned long allocs = 0;
+			int runs = 0;
+
+			vals.dither = mode;
+			vals.dither_tiles = tiles;
+
+			while (runs == 0 || total < MIN_SECONDS)
+			{
+				unsigned long before = __atomic_load_n(&allocations, __ATOMIC_RELAXED);
+				double start = now();
+				VeraDitherer dither;
+				double seconds;
+
+				if (vera_dither_init(&dither, cmap, 256, 0, &vals, FRAME_WIDTH) != 0)
+				{
+					fprintf(stderr, "vera-bench: out of memory\n");
+					free(dst);
+					return -1;
+				}
+
+				vera_dither_rows(&dither, rgb, 3, FRAME_HEIGHT, dst);
+				vera_dither_free(&dither);
+				seconds = now() - start;
+
+				allocs = __atomic_load_n(&allocations, __ATOMIC_RELAXED) - before;
+
+				if (runs == 0 || seconds < best)
+					best = seconds;
+
+				total += seconds;
+				runs++;
+			}
+
+			printf("%-9s %5d  %5dx%-5d %10.1f %7lu\n", dither_names[mode], tiles,
+					FRAME_WIDTH, FRAME_HEIGHT,
+					best > 0 ? (double) FRAME_WIDTH * FRAME_HEIGHT / best / 1e6 : 0.0,
+					allocs);
+		}
+	}
+
+	free(dst);
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int n_threads = argc > 1 ? atoi(argv[1]) : 1;
+	VeraRunner runner = { vera_run_threads, &n_threads };
+	int max_size = image_sizes[N_ELEMENTS(image_sizes) - 1];
+	uint8_t *random_pixels;
+	uint8_t *pixels;
+	int ret = 0;
+
+	if (argc > 2 || n_threads < 1)
+	{
+		fprintf(stderr, "usage: vera-bench [THREADS]\n");
+		return 2;
+	}
+
+	random_pixels = malloc((size_t) max_size * max_size);
+	pixels = malloc((size_t) max_size * max_size);
+
+	if (! random_pixels || ! pixels)
+	{
+		fprintf(stderr, "vera-bench: out of memory\n");
+		return 1;
+	}
+
+	// the same pixels every run, so numbers compare across builds
+	srand(1);
+	for(size_t i = 0; i < (size_t) max_size * max_size; i++)
+		random_pixels[i] = rand() >> 7;
+
+	printf("%d thread%s, MB/s of 8-bit input pixels, allocations per pack\n\n",
+			n_threads, n_threads == 1 ? "" : "s");
+	printf("%-7s %4s  %-6s %-11s %10s %7s\n", "kind", "bpp", "tile", "image", "MB/s", "allocs");
+
+	for(int b = 0; ret == 0 && b < N_ELEMENTS(bpps); b++)
+	{
+		for(size_t i = 0; i < (size_t) max_size * max_size; i++)
+			pixels[i] = random_pixels[i] & ((1 << bpps[b]) - 1);
+
+		for(int s = 0; ret == 0 && s < N_ELEMENTS(image_sizes); s++)
+		{
+			VeraSaveVals vals = vera_default_vals;
+			VeraImage image;
+
+			vera_image_from_indices(&image, pixels, image_sizes[s], image_sizes[s], NULL, 0);
+			vals.tile_bpp = bpps[b];
+			vals.export_type = BITMAP;
+
+			ret = bench("bitmap", "-", &image, &vals, NULL);
+
+			vals.export_type = TILESET;
+
+			for(int w = 0; ret == 0 && w < N_ELEMENTS(tile_sizes); w++)
+			{
+				for(int h = 0; ret == 0 && h < N_ELEMENTS(tile_sizes); h++)
+				{
+					char tile[16];
+
+					vals.tile_width = tile_sizes[w];
+					vals.tile_height = tile_sizes[h];
+					snprintf(tile, sizeof(tile), "%dx%d", tile_sizes[w], tile_sizes[h]);
+
+					ret = bench("tiles", tile, &image, &vals, n_threads > 1 ? &runner : NULL);
+				}
+			}
+		}
+	}
+
+	// smooth gradients, where dithering has the most to do
+	for(size_t i = 0; ret == 0 && i < FRAME_WIDTH * FRAME_HEIGHT; i++)
+	{
+		int x = i % FRAME_WIDTH;
+		int y = i / FRAME_WIDTH;
+
+		pixels[i * 3] = x * 255 / (FRAME_WIDTH - 1);
+		pixels[i * 3 + 1] = y * 255 / (FRAME_HEIGHT - 1);
+		pixels[i * 3 + 2] = (x + y) * 255 / (FRAME_WIDTH + FRAME_HEIGHT - 2);
+	}
+
+	if (ret == 0)
+		ret = bench_dither(pixels);
+
+	free(pixels);
+	free(random_pixels);
+
+	return ret == 0 ? 0 : 1;
+}
@@ -0,0 +1,101 @@
+#include "vera_bmp.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BMP_FILE_HEADER_SIZE  14
+#define BMP_INFO_HEADER_SIZE  40
+
+static void put_le16(uint8_t *p, uint16_t v)
+{
+	p[0] = v & 0xff;
+	p[1] = v >> 8;
+}
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+	p[2] = (v >> 16) & 0xff;
+	p[3] = v >> 24;
+}
+
+int vera_bmp_pixels(VeraBmpPixels *pixels, const uint8_t *indices, int width, int height)
+{
+	size_t stride = ((size_t) width + 3) & ~(size_t) 3;
+
+	pixels->width = width;
+	pixels->height = height;
+	pixels->size = stride * height;
+	pixels->data = calloc(pixels->size ? pixels->size : 1, 1);
+
+	if (!pixels->data)
+		return -1;
+
+	// BMP rows run bottom to top
+	for(int y = 0; y < height; y++)
+	{
+		memcpy(pixels->data + (size_t)(height - 1 - y) * stride,
+				indices + (size_t) y * width,
+				width);
+	}
+
+	return 0;
+}
+
+void vera_bmp_pixels_free(VeraBmpPixels *pixels)
+{
+	free(pixels->data);
+	pixels->data = NULL;
+}
+
+int vera_bmp_write(FILE *fp,
+		const VeraBmpPixels *pixels,
+		const uint8_t       *cmap,
+		int                  palsize)
+{
+	uint8_t header[BMP_FILE_HEADER_SIZE + BMP_INFO_HEADER_SIZE + 256 * 4];
+	size_t header_size;
+
+	if (palsize > 256)
+		palsize = 256;
+
+	header_size = BMP_FILE_HEADER_SIZE + BMP_INFO_HEADER_SIZE + (size_t) palsize * 4;
+	memset(header, 0, header_size);
+
+	// file header
+	header[0] = 'B';
+	header[1] = 'M';
+	put_le32(header + 2, (uint32_t)(header_size + pixels->size));
+	put_le32(header + 10, (uint32_t) header_size);
+
+	// BITMAPINFOHEADER
+	uint8_t *info = header + BMP_FILE_HEADER_SIZE;
+	put_le32(info, BMP_INFO_HEADER_SIZE);
+	put_le32(info + 4, (uint32_t) pixels->width);
+	put_le32(info + 8, (uint32_t) pixels->height);
+	put_le16(info + 12, 1);
+	put_le16(info + 14, 8);
+	put_le32(info + 20, (uint32_t) pixels->size);
+	put_le32(info + 24, 2835);   // 72 dpi
+	put_le32(info + 28, 2835);
+	put_le32(info + 32, (uint32_t) palsize);
+	put_le32(info + 36, (uint32_t) palsize);
+
+	// palette, stored as BGR0
+	uint8_t *palette = info + BMP_INFO_HEADER_SIZE;
+	for(int i = 0; i < palsize; i++)
+	{
+		palette[i * 4] = cmap[i * 3 + 2];
+		palette[i * 4 + 1] = cmap[i * 3 + 1];
+		palette[i * 4 + 2] = cmap[i * 3];
+	}
+
+	if (fwrite(header, header_size, 1, fp) != 1
+			|| (pixels->size && fwrite(pixels->data, pixels->size, 1, fp) != 1))
+		return -1;
+
+	return 0;
+}
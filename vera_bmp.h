@@ -0,0 +1,38 @@
+#ifndef VERA_BMP_H
+#define VERA_BMP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * 8-bit indexed BMP output for the images that go with Tiled tile sets.
+ *
+ * The pixel data of a BMP does not depend on its palette, so it is laid out
+ * once with vera_bmp_pixels and then written out with as many different
+ * palettes as needed.
+ */
+
+typedef struct
+{
+	int       width;
+	int       height;
+	size_t    size;
+	uint8_t  *data;      /* bottom-up rows, each padded to 4 bytes */
+} VeraBmpPixels;
+
+/* lays out width * height indices as BMP pixel data, 0 on success */
+int vera_bmp_pixels(VeraBmpPixels *pixels, const uint8_t *indices, int width, int height);
+
+void vera_bmp_pixels_free(VeraBmpPixels *pixels);
+
+/*
+ * Writes pixels to fp as an 8-bit BMP with the palsize color cmap (RGB
+ * triples).  Returns 0 on success or -1 with errno set.
+ */
+int vera_bmp_write(FILE *fp,
+		const VeraBmpPixels *pixels,
+		const uint8_t       *cmap,
+		int                  palsize);
+
+#endif
@@ -0,0 +1,222 @@
+#include "vera_cache.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "vera_hash.h"
+#include "vera_sink.h"
+
+// bump when the exporters change what they write for the same inputs
+#define VERA_CACHE_VERSION  1
+#define CACHE_STRIP_HEIGHT  64
+#define CACHE_SUFFIX        ".vcache"
+
+/* mixes every index of image into *h */
+static int hash_indices(const char *filename,
+		const VeraImage *image,
+		uint64_t        *h,
+		VeraError       *error)
+{
+	int strip_height = image->height < CACHE_STRIP_HEIGHT ? image->height : CACHE_STRIP_HEIGHT;
+	uint8_t *strip = malloc((size_t) image->width * strip_height + 1);
+
+	if (! strip)
+	{
+		vera_set_error(error, ENOMEM, "Out of memory fingerprinting '%s'", filename);
+		return -1;
+	}
+
+	for(int y = 0; y < image->height; y += strip_height)
+	{
+		int rows = image->height - y < strip_height ? image->height - y : strip_height;
+		size_t length = (size_t) image->width * rows;
+
+		if (image->read_rows(image, y, rows, strip) != 0)
+		{
+			vera_set_error(error, EIO, "Could not read rows %d to %d of the image",
+					y, y + rows - 1);
+			free(strip);
+			return -1;
+		}
+
+		*h = vera_hash_mix(*h, vera_hash_bytes(*h, strip, length));
+	}
+
+	free(strip);
+
+	return 0;
+}
+
+int vera_cache_fingerprint(const char *filename,
+		const VeraImage    *image,
+		const VeraSaveVals *vals,
+		uint64_t           *fingerprint,
+		VeraError          *error)
+{
+	// export_cache is left out, it does not change what is written
+	const int settings[] =
+	{
+		vals->file_header,
+		vals->export_type,
+		vals->tile_bpp,
+		vals->tile_width,
+		vals->tile_height,
+		vals->tiled_file,
+		vals->bmp_file,
+		vals->pal_file,
+		vals->dedup_tiles,
+		vals->palette_banks,
+		vals->frames,
+		vals->vram_address,
+		vals->compress,
+		vals->dither,
+		vals->dither_tiles,
+		vals->patch_file,
+		vals->delta_frames,
+		vals->vblank_bytes,
+		vals->frame_palettes,
+		vals->frame_bytes,
+		vals->bank_split,
+		vals->split_tiles,
+		vals->first_bank,
+		image->width,
+		image->height,
+		image->palsize
+	};
+	uint64_t h = VERA_HASH_SEED ^ VERA_CACHE_VERSION;
+
+	for(size_t i = 0; i < sizeof(settings) / sizeof(settings[0]); i++)
+		h = vera_hash_mix(h, (uint32_t) settings[i]);
+
+	h = vera_hash_mix(h, vera_hash_bytes(h, filename, strlen(filename)));
+
+	if (image->cmap)
+		h = vera_hash_mix(h, vera_hash_bytes(h, image->cmap, (size_t) image->palsize * 3));
+
+	if (image->remap)
+		h = vera_hash_mix(h, vera_hash_bytes(h, image->remap, 256));
+
+	if (hash_indices(filename, image, &h, error) != 0)
+		return -1;
+
+	// a mask only mixes in when there is one, so other caches stay valid
+	if (image->collision)
+	{
+		h = vera_hash_mix(h, (uint32_t) image->collision->width);
+		h = vera_hash_mix(h, (uint32_t) image->collision->height);
+
+		if (hash_indices(filename, image->collision, &h, error) != 0)
+			return -1;
+	}
+
+	*fingerprint = h;
+
+	return 0;
+}
+
+int vera_cache_check(const char *filename, uint64_t fingerprint, VeraArtifacts *artifacts)
+{
+	char *name = vera_concat(filename, CACHE_SUFFIX);
+	FILE *fp = name ? fopen(name, "r") : NULL;
+	char line[4096];
+	unsigned long long recorded;
+	int first = artifacts->count;
+	int hit = 0;
+
+	free(name);
+
+	if (! fp)
+		return 0;
+
+	if (fgets(line, sizeof(line), fp)
+			&& sscanf(line, "vera-cache %*d %llx", &recorded) == 1
+			&& recorded == fingerprint)
+	{
+		hit = 1;
+
+		// one line per file: size, modification time and name
+		while (hit && fgets(line, sizeof(line), fp))
+		{
+			long long size, mtime;
+			int offset = 0;
+			struct stat st;
+			char *artifact;
+
+			line[strcspn(line, "\r\n")] = '\0';
+
+			if (sscanf(line, "%lld %lld %n", &size, &mtime, &offset) != 2 || offset == 0)
+			{
+				hit = 0;
+				break;
+			}
+
+			artifact = line + offset;
+
+			hit = stat(artifact, &st) == 0
+				&& (long long) st.st_size == size
+				&& (long long) st.st_mtime == mtime
+				&& vera_artifacts_add(artifacts, artifact, 1) == 0;
+		}
+
+		if (artifacts->count == first)
+			hit = 0;
+	}
+
+	fclose(fp);
+
+	if (! hit)
+	{
+		// forget whatever was added before the mismatch
+		for(int i = first; i < artifacts->count; i++)
+			free(artifacts->items[i].filename);
+
+		artifacts->count = first;
+	}
+
+	return hit;
+}
+
+int vera_cache_write(const char *filename,
+		uint64_t             fingerprint,
+		const VeraArtifact  *items,
+		int                  count,
+		VeraError           *error)
+{
+	char *name = vera_concat(filename, CACHE_SUFFIX);
+	VeraSink sink;
+	int skipped;
+	int ret;
+
+	if (! name)
+	{
+		vera_set_error(error, ENOMEM, "Could not write the export cache of '%s'", filename);
+		return -1;
+	}
+
+	ret = vera_sink_open(&sink, name, NULL, error);
+	free(name);
+
+	if (ret != 0)
+		return -1;
+
+	fprintf(sink.fp, "vera-cache %d %016llx\n", VERA_CACHE_VERSION, (unsigned long long) fingerprint);
+
+	for(int i = 0; i < count; i++)
+		fprintf(sink.fp, "%lld %lld %s\n", items[i].size, items[i].mtime, items[i].filename);
+
+	// write errors are picked up by the flush
+	return vera_sink_commit(&sink, 0, &skipped, error);
+}
+
+void vera_cache_remove(const char *filename)
+{
+	char *name = vera_concat(filename, CACHE_SUFFIX);
+
+	if (name)
+		remove(name);
+
+	free(name);
+}
@@ -0,0 +1,36 @@
+#ifndef VERA_CACHE_H
+#define VERA_CACHE_H
+
+#include <stdint.h>
+
+#include "vera_export.h"
+
+/*
+ * The export cache.  Next to the output file, filename.vcache records a
+ * fingerprint of everything the export was made from (the indices, the
+ * colormap, the collision mask, the settings and the output name) and the
+ * size and modification time of every file it wrote.  When both still
+ * match, an export can be skipped without packing or writing anything.
+ */
+
+int vera_cache_fingerprint(const char *filename,
+		const VeraImage    *image,
+		const VeraSaveVals *vals,
+		uint64_t           *fingerprint,
+		VeraError          *error);
+
+/*
+ * Returns 1 when the cache of filename matches fingerprint and none of its
+ * files has changed since, adding them all to artifacts as skipped.
+ */
+int vera_cache_check(const char *filename, uint64_t fingerprint, VeraArtifacts *artifacts);
+
+int vera_cache_write(const char *filename,
+		uint64_t             fingerprint,
+		const VeraArtifact  *items,
+		int                  count,
+		VeraError           *error);
+
+void vera_cache_remove(const char *filename);
+
+#endif
@@ -0,0 +1,949 @@
+/*
+ * vera-export: the plugin's VERA exporters without GIMP.
+ *
+ * Reads an indexed PNG, BMP or PCX image and writes the same files as
+ * file-vera-save, taking its settings as command line options.  With
+ * --frames 1 every input image becomes one frame of the output, and --plan
+ * lays out the outputs of a batch manifest in VRAM.  --regions cuts the
+ * rectangles of a region list out of the image and writes them as an atlas.
+ * --shared-palette merges the colormaps of the inputs into one palette, and
+ * --collision writes the collision mask of a tile set from a second image.
+ * An input named like intro%04d.png stands for a numbered image sequence.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "vera_export.h"
+#include "vera_load.h"
+#include "vera_lut.h"
+#include "vera_plan.h"
+#include "vera_region.h"
+#include "vera_shared.h"
+#include "vera_stats.h"
+#include "vera_threads.h"
+
+#define MAX_MANIFEST_WORDS  26
+
+enum
+{
+	OPT_EXPORT_TYPE = 256,
+	OPT_FILE_HEADER,
+	OPT_TILE_BPP,
+	OPT_TILE_WIDTH,
+	OPT_TILE_HEIGHT,
+	OPT_TILED_FILE,
+	OPT_BMP_FILE,
+	OPT_PAL_FILE,
+	OPT_DEDUP_TILES,
+	OPT_PALETTE_BANKS,
+	OPT_EXPORT_CACHE,
+	OPT_FRAMES,
+	OPT_VRAM_ADDRESS,
+	OPT_COMPRESS,
+	OPT_DITHER,
+	OPT_DITHER_TILES,
+	OPT_PATCH_FILE,
+	OPT_DELTA_FRAMES,
+	OPT_VBLANK_BYTES,
+	OPT_FRAME_PALETTES,
+	OPT_FRAME_BYTES,
+	OPT_BANK_SPLIT,
+	OPT_SPLIT_TILES,
+	OPT_FIRST_BANK,
+	OPT_THREADS,
+	OPT_PLAN,
+	OPT_PALETTE,
+	OPT_REGIONS,
+	OPT_SHARED_PALETTE,
+	OPT_COLLISION
+};
+
+// same names as the file-vera-save2 arguments
+static const struct option options[] =
+{
+	{ "export-type",   required_argument, NULL, OPT_EXPORT_TYPE },
+	{ "file-header",   required_argument, NULL, OPT_FILE_HEADER },
+	{ "tile-bpp",      required_argument, NULL, OPT_TILE_BPP },
+	{ "tile-width",    required_argument, NULL, OPT_TILE_WIDTH },
+	{ "tile-height",   required_argument, NULL, OPT_TILE_HEIGHT },
+	{ "tiled-file",    required_argument, NULL, OPT_TILED_FILE },
+	{ "bmp-file",      required_argument, NULL, OPT_BMP_FILE },
+	{ "pal-file",      required_argument, NULL, OPT_PAL_FILE },
+	{ "dedup-tiles",   required_argument, NULL, OPT_DEDUP_TILES },
+	{ "palette-banks", required_argument, NULL, OPT_PALETTE_BANKS },
+	{ "export-cache",  required_argument, NULL, OPT_EXPORT_CACHE },
+	{ "frames",        required_argument, NULL, OPT_FRAMES },
+	{ "vram-address",  required_argument, NULL, OPT_VRAM_ADDRESS },
+	{ "compress",      required_argument, NULL, OPT_COMPRESS },
+	{ "dither",        required_argument, NULL, OPT_DITHER },
+	{ "dither-tiles",  required_argument, NULL, OPT_DITHER_TILES },
+	{ "patch-file",    required_argument, NULL, OPT_PATCH_FILE },
+	{ "delta-frames",  required_argument, NULL, OPT_DELTA_FRAMES },
+	{ "vblank-bytes",  required_argument, NULL, OPT_VBLANK_BYTES },
+	{ "frame-palettes", required_argument, NULL, OPT_FRAME_PALETTES },
+	{ "frame-bytes",   required_argument, NULL, OPT_FRAME_BYTES },
+	{ "bank-split",    required_argument, NULL, OPT_BANK_SPLIT },
+	{ "split-tiles",   required_argument, NULL, OPT_SPLIT_TILES },
+	{ "first-bank",    required_argument, NULL, OPT_FIRST_BANK },
+	{ "threads",       required_argument, NULL, OPT_THREADS },
+	{ "plan",          required_argument, NULL, OPT_PLAN },
+	{ "palette",       required_argument, NULL, OPT_PALETTE },
+	{ "regions",       required_argument, NULL, OPT_REGIONS },
+	{ "shared-palette", required_argument, NULL, OPT_SHARED_PALETTE },
+	{ "collision",     required_argument, NULL, OPT_COLLISION },
+	{ "help",          no_argument,       NULL, 'h' },
+	{ NULL, 0, NULL, 0 }
+};
+
+static void usage(FILE *fp)
+{
+	fprintf(fp,
+			"Usage: vera-export [OPTION]... INPUT OUTPUT\n"
+			"  or:  vera-export --frames 1 [OPTION]... INPUT... OUTPUT\n"
+			"  or:  vera-export --plan MANIFEST\n"
+			"Exports an indexed PNG, BMP or PCX image, or an RGB PNG mapped to the colors\n"
+			"of --palette, to VERA binaries.\n"
+			"\n"
+			"  --export-type N     0 tile set, 1 bitmap, 2 sprites (default 0)\n"
+			"  --file-header N     1 to start every file with a 2 byte header (default 0)\n"
+			"  --tile-bpp N        bits per pixel: 1, 2, 4 or 8 (default 4)\n"
+			"  --tile-width N      8, 16, 32 or 64 (default 8)\n"
+			"  --tile-height N     8, 16, 32 or 64 (default 8)\n"
+			"  --tiled-file N      1 to write a Tiled .tsx file (default 1)\n"
+			"  --bmp-file N        1 to write a .bmp for the Tiled file (default 1)\n"
+			"  --pal-file N        1 to write a .PAL palette (default 1)\n"
+			"  --dedup-tiles N     1 to write unique tiles only, plus a .MAP (default 0)\n"
+			"  --palette-banks N   1 to pack 2/4bpp tile colors into palette banks (default 0)\n"
+			"  --export-cache N    1 to skip the export when nothing changed (default 0)\n"
+			"  --frames N          1 to write every INPUT as one frame of OUTPUT (default 0)\n"
+			"  --vram-address N    VRAM address of the data, for sprite attributes and patch\n"
+			"                      records (default 0)\n"
+			"  --compress N        1 to LZSA2 compress the VERA binaries (default 0)\n"
+			"  --dither N          RGB images: 0 none, 1 Floyd-Steinberg, 2 Atkinson,\n"
+			"                      3 Bayer 4x4, 4 Bayer 8x8 (default 0)\n"
+			"  --dither-tiles N    1 to keep the dithering error inside each tile (default 0)\n"
+			"  --patch-file N      1 to write a .PATCH of the tiles or bitmap rows that\n"
+			"                      changed since the last export (default 0)\n"
+			"  --delta-frames N    1 to write only the tiles that changed since the frame\n"
+			"                      before, plus a .UPL upload list (default 0)\n"
+			"  --vblank-bytes N    tile bytes the upload list copies per vblank\n"
+			"                      (default 1024)\n"
+			"  --frame-palettes N  video: 1 to load the palette of every frame whose\n"
+			"                      colors change (default 0)\n"
+			"  --frame-bytes N     video: the bytes a frame can stream in time, checked\n"
+			"                      in the .csv report (default 0, no limit)\n"
+			"  --bank-split N      cut the data into 8 KB banked RAM chunks: 1 one file\n"
+			"                      per bank, 2 one .BANKS file, plus a .BNK (default 0)\n"
+			"  --split-tiles N     1 to fill every bank even if a tile is cut (default 0)\n"
+			"  --first-bank N      banked RAM bank of the first chunk (default 1)\n"
+			"  --threads N         threads packing tiles and frames (default: one per CPU\n"
+			"                      for frames, 1 for a single image)\n"
+			"  --plan MANIFEST     lay out the exported files of a batch manifest in VRAM\n"
+			"  --palette FILE      .PAL file that RGB images are mapped to, read with the\n"
+			"                      same --file-header as the output\n"
+			"  --regions FILE      write the rectangles listed in FILE, one 'name x y width\n"
+			"                      height' per line, as the entries of an atlas\n"
+			"  --shared-palette NAME  merge the colors of every 8 bpp INPUT into one\n"
+			"                      palette, written to NAME.PAL instead of OUTPUT.PAL\n"
+			"  --collision FILE    write the collision mask of a tile set from an indexed\n"
+			"                      image of the same size, solid where the index is not 0\n"
+			"  -h, --help          show this help\n"
+			"\n"
+			"An INPUT holding a number like intro%%04d.png stands for the numbered files\n"
+			"from 0 or 1 on, up to the first one missing.\n"
+			"Numbers starting with 0x are read as hexadecimal.  With VERA_STATS_FILE set,\n"
+			"the timings and byte counts of the export are appended to that file as one\n"
+			"line of JSON.\n");
+}
+
+static int read_number(const char *text, int *value)
+{
+	int hex = text[0] == '0' && (text[1] == 'x' || text[1] == 'X');
+	const char *digits = hex ? text + 2 : text;
+	char *end;
+	long n = strtol(digits, &end, hex ? 16 : 10);
+
+	// large enough for any VRAM address
+	if (end == digits || *end || n < 0 || n > 0x1ffff)
+		return -1;
+
+	*value = n;
+
+	return 0;
+}
+
+static int parse_number(const char *name, const char *text, int *value)
+{
+	if (read_number(text, value) != 0)
+	{
+		fprintf(stderr, "vera-export: --%s: '%s' is not a valid number\n", name, text);
+		return -1;
+	}
+
+	return 0;
+}
+
+// reads a .PAL file into cmap, returning its number of colors or -1
+static int load_palette(const char *filename, int file_header, uint8_t *cmap)
+{
+	uint8_t data[256 * 2 + 3];
+	FILE *fp = fopen(filename, "rb");
+	size_t length;
+	int palsize;
+
+	if (! fp)
+	{
+		fprintf(stderr, "vera-export: could not open '%s': %s\n", filename, strerror(errno));
+		return -1;
+	}
+
+	length = fread(data, 1, sizeof(data), fp);
+	fclose(fp);
+
+	palsize = vera_palette_parse(data, length, file_header, cmap);
+
+	if (palsize < 0)
+		fprintf(stderr, "vera-export: '%s' is not a .PAL file of up to 256 colors%s\n",
+				filename, file_header ? " with a 2 byte header" : "");
+
+	return palsize;
+}
+
+// reads a region list, returning its number of regions or -1
+static int load_regions(const char *filename, VeraRegion **regions)
+{
+	FILE *fp = fopen(filename, "rb");
+	char *text = NULL;
+	long length = -1;
+	VeraError error;
+	int count = -1;
+
+	if (! fp)
+	{
+		fprintf(stderr, "vera-export: could not open '%s': %s\n", filename, strerror(errno));
+		return -1;
+	}
+
+	if (fseek(fp, 0, SEEK_END) == 0 && (length = ftell(fp)) >= 0 && fseek(fp, 0, SEEK_SET) == 0)
+		text = malloc(length + 1);
+
+	if (! text || fread(text, 1, length, fp) != (size_t) length)
+		fprintf(stderr, "vera-export: could not read '%s'\n", filename);
+	else if (vera_regions_parse(text, length, filename, regions, &count, &error) != 0)
+		fprintf(stderr, "vera-export: %s\n", error.message);
+
+	free(text);
+	fclose(fp);
+
+	return count > 0 ? count : -1;
+}
+
+static int append_input(char ***inputs, int *count, int *capacity, const char *name)
+{
+	if (*count == *capacity)
+	{
+		char **grown;
+
+		*capacity = *capacity ? *capacity * 2 : 64;
+		grown = realloc(*inputs, *capacity * sizeof(char *));
+
+		if (! grown)
+			return -1;
+
+		*inputs = grown;
+	}
+
+	if (! ((*inputs)[*count] = strdup(name)))
+		return -1;
+
+	(*count)++;
+
+	return 0;
+}
+
+/*
+ * Lists the input files, with every name holding a number such as
+ * intro%04d.png replaced by the files numbered from 0, or 1 if there is no
+ * 0, up to the first one missing.  Returns the malloc'ed names, or NULL.
+ */
+static char **list_inputs(char * const *names, int count, int *n_inputs)
+{
+	char **inputs = NULL;
+	int capacity = 0;
+	int ret = 0;
+
+	*n_inputs = 0;
+
+	for(int i = 0; ret == 0 && i < count; i++)
+	{
+		const char *name = names[i];
+		const char *number = strchr(name, '%');
+		const char *p = number ? number + 1 : NULL;
+		int zero = p && *p == '0';
+		int width = 0;
+		int found = 0;
+
+		if (p)
+		{
+			p += zero;
+
+			while (*p >= '0' && *p <= '9')
+				width = width * 10 + *p++ - '0';
+		}
+
+		if (! p || *p != 'd' || strchr(p, '%') || width > 9)
+		{
+			ret = append_input(&inputs, n_inputs, &capacity, name);
+			continue;
+		}
+
+		for(int n = 0; ret == 0; n++)
+		{
+			char path[4096];
+
+			snprintf(path, sizeof(path), zero ? "%.*s%0*d%s" : "%.*s%*d%s",
+					(int) (number - name), name, width, n, p + 1);
+
+			if (access(path, R_OK) != 0)
+			{
+				if (n == 0)
+					continue;
+				break;
+			}
+
+			ret = append_input(&inputs, n_inputs, &capacity, path);
+			found++;
+		}
+
+		if (ret == 0 && ! found)
+		{
+			fprintf(stderr, "vera-export: no files are numbered like '%s'\n", name);
+			ret = 1;
+		}
+	}
+
+	if (ret < 0)
+		fprintf(stderr, "vera-export: out of memory\n");
+
+	if (ret != 0)
+	{
+		for(int i = 0; i < *n_inputs; i++)
+			free(inputs[i]);
+
+		free(inputs);
+		inputs = NULL;
+	}
+
+	return inputs;
+}
+
+/*
+ * Merges the colormaps of count inputs into shared, filling 256 entries of
+ * remaps per input.  Returns 0, or -1 with error set.
+ */
+static int share_palette(char * const *names,
+		const VeraIndexedImage *indexed,
+		int                     count,
+		const VeraSaveVals     *vals,
+		VeraSharedPalette      *shared,
+		uint8_t                *remaps,
+		VeraError              *error)
+{
+	vera_shared_init(shared);
+
+	for(int i = 0; i < count; i++)
+	{
+		if (vera_shared_check(vals, names[i], error) != 0
+				|| vera_shared_add(shared, indexed[i].cmap, indexed[i].palsize, names[i],
+					remaps + (size_t) i * 256, error) != 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+/* has images read through remap into the shared palette */
+static void use_shared_palette(VeraImage *images,
+		int                      count,
+		const VeraSharedPalette *shared,
+		const uint8_t           *remap)
+{
+	for(int i = 0; i < count; i++)
+	{
+		images[i].cmap = shared->cmap;
+		images[i].palsize = shared->palsize;
+		images[i].remap = remap;
+	}
+}
+
+/* copies every region of input into pixels, returning the images of the copies */
+static VeraImage *crop_regions(const VeraIndexedImage *input,
+		const VeraRegion *regions,
+		int               count,
+		uint8_t         **pixels)
+{
+	VeraImage *images = calloc(count, sizeof(VeraImage));
+	size_t total = 0;
+	uint8_t *p;
+
+	for(int i = 0; i < count; i++)
+		total += (size_t) regions[i].width * regions[i].height;
+
+	*pixels = p = malloc(total + 1);
+
+	if (! images || ! p)
+	{
+		free(images);
+		free(p);
+		*pixels = NULL;
+		return NULL;
+	}
+
+	for(int i = 0; i < count; i++)
+	{
+		const VeraRegion *r = &regions[i];
+
+		for(int y = 0; y < r->height; y++)
+			memcpy(p + (size_t) y * r->width,
+					input->pixels + (size_t) (r->y + y) * input->width + r->x, r->width);
+
+		vera_image_from_indices(&images[i], p, r->width, r->height, input->cmap, input->palsize);
+		p += (size_t) r->width * r->height;
+	}
+
+	return images;
+}
+
+static int check_vals(const VeraSaveVals *vals)
+{
+	switch (vals->tile_bpp)
+	{
+		case TILE_1BPP:
+		case TILE_2BPP:
+		case TILE_4BPP:
+		case TILE_8BPP:
+			break;
+		default:
+			fprintf(stderr, "vera-export: --tile-bpp must be 1, 2, 4 or 8\n");
+			return -1;
+	}
+
+	if (vals->export_type != TILESET && vals->export_type != BITMAP && vals->export_type != SPRITE)
+	{
+		fprintf(stderr, "vera-export: --export-type must be 0, 1 or 2\n");
+		return -1;
+	}
+
+	if (vals->export_type == SPRITE && vals->tile_bpp != TILE_4BPP && vals->tile_bpp != TILE_8BPP)
+	{
+		fprintf(stderr, "vera-export: sprites must be 4 or 8 bits per pixel\n");
+		return -1;
+	}
+
+	if (vals->export_type != BITMAP)
+	{
+		int w = vals->tile_width;
+		int h = vals->tile_height;
+
+		if ((w != 8 && w != 16 && w != 32 && w != 64) || (h != 8 && h != 16 && h != 32 && h != 64))
+		{
+			fprintf(stderr, "vera-export: tile sizes must be 8, 16, 32 or 64\n");
+			return -1;
+		}
+	}
+
+	if (vals->dither < DITHER_NONE || vals->dither > DITHER_BAYER_8)
+	{
+		fprintf(stderr, "vera-export: --dither must be 0 to 4\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+// splits line in place into words, which may be quoted
+static int split_words(char *line, char **words, int max_words)
+{
+	int count = 0;
+
+	for(;;)
+	{
+		char quote = 0;
+		char *out;
+
+		while (*line == ' ' || *line == '\t')
+			line++;
+
+		if (! *line)
+			return count;
+
+		if (count == max_words)
+			return -1;
+
+		words[count++] = out = line;
+
+		for(; *line && (quote || (*line != ' ' && *line != '\t')); line++)
+		{
+			if (*line == quote)
+				quote = 0;
+			else if (! quote && (*line == '"' || *line == '\''))
+				quote = *line;
+			else
+				*out++ = *line;
+		}
+
+		if (quote)
+			return -1;
+
+		if (*line)
+			line++;
+
+		*out = '\0';
+	}
+}
+
+/*
+ * Plans the files exported from a file-vera-save-batch manifest, which are
+ * expected to exist already, and writes the address maps it asks for.
+ */
+static int plan_manifest(const char *manifest)
+{
+	FILE *fp = fopen(manifest, "r");
+	VeraPlan plan;
+	VeraError error;
+	char line[4096];
+	char *shared_name = NULL;
+	int shared_planned = 0;
+	int line_number = 0;
+	int ret = 0;
+
+	if (! fp)
+	{
+		perror(manifest);
+		return 1;
+	}
+
+	vera_plan_init(&plan);
+
+	while (ret == 0 && fgets(line, sizeof(line), fp))
+	{
+		char *words[MAX_MANIFEST_WORDS];
+		int n_words;
+		VeraSaveVals vals = vera_default_vals;
+		int *settings[] =
+		{
+			(int *) &vals.export_type, &vals.file_header, (int *) &vals.tile_bpp,
+			(int *) &vals.tile_width, (int *) &vals.tile_height, &vals.tiled_file,
+			&vals.bmp_file, &vals.pal_file, &vals.dedup_tiles, &vals.palette_banks,
+			&vals.export_cache, &vals.frames, &vals.vram_address, &vals.compress,
+			(int *) &vals.dither, &vals.dither_tiles, &vals.patch_file, &vals.delta_frames,
+			&vals.vblank_bytes, &vals.frame_palettes, &vals.frame_bytes, &vals.bank_split,
+			&vals.split_tiles, &vals.first_bank
+		};
+		int n_settings;
+
+		line_number++;
+		line[strcspn(line, "\r\n")] = '\0';
+
+		if (line[strspn(line, " \t")] == '\0' || line[strspn(line, " \t")] == '#')
+			continue;
+
+		n_words = split_words(line, words, MAX_MANIFEST_WORDS);
+		n_settings = n_words - 2;
+
+		if (n_words < 0)
+		{
+			vera_set_error(&error, 0, "unbalanced quotes or too many words");
+			ret = -1;
+			break;
+		}
+
+		// collision masks are read by the CPU, there is nothing to plan
+		if (strcmp(words[0], "@collision-layer") == 0)
+			continue;
+
+		if (strcmp(words[0], "@shared-palette") == 0)
+		{
+			if (n_words != 2 || shared_name)
+			{
+				vera_set_error(&error, 0, "expected a single @shared-palette NAME");
+				ret = -1;
+			}
+			else if (! (shared_name = strdup(words[1])))
+			{
+				vera_set_error(&error, ENOMEM, "Out of memory planning VRAM");
+				ret = -1;
+			}
+			continue;
+		}
+
+		if (words[0][0] == '@')
+		{
+			ret = vera_plan_directive(&plan, n_words, words, &error);
+			continue;
+		}
+
+		if (n_settings < 8 || n_settings > 24)
+		{
+			vera_set_error(&error, 0, "expected a source, an output and 8 to 24 settings");
+			ret = -1;
+			break;
+		}
+
+		for(int i = 0; ret == 0 && i < n_settings; i++)
+		{
+			if (read_number(words[i + 2], settings[i]) != 0)
+			{
+				vera_set_error(&error, 0, "'%s' is not a number", words[i + 2]);
+				ret = -1;
+			}
+		}
+
+		// assets after @shared-palette write no palette of their own
+		if (ret == 0 && shared_name)
+		{
+			if (! shared_planned)
+				ret = vera_plan_add_palette(&plan, shared_name, &vals, &error);
+
+			shared_planned = 1;
+			vals.pal_file = 0;
+		}
+
+		if (ret == 0)
+			ret = vera_plan_add_export(&plan, words[1], &vals, &error);
+	}
+
+	fclose(fp);
+	free(shared_name);
+
+	if (ret != 0)
+	{
+		fprintf(stderr, "vera-export: %s:%d: %s\n", manifest, line_number, error.message);
+	}
+	else if (! vera_plan_wanted(&plan))
+	{
+		fprintf(stderr, "vera-export: %s asks for no address map, add @c-header or @ca65\n", manifest);
+		ret = -1;
+	}
+	else if (vera_plan_write(&plan, NULL, &error) != 0)
+	{
+		fprintf(stderr, "vera-export: %s\n", error.message);
+		ret = -1;
+	}
+	else
+	{
+		printf("%s: VRAM planned for %d files\n", manifest, plan.count);
+	}
+
+	vera_plan_clear(&plan);
+
+	return ret == 0 ? 0 : 1;
+}
+
+int main(int argc, char **argv)
+{
+	VeraSaveVals vals = vera_default_vals;
+	VeraIndexedImage *indexed;
+	VeraImage *images;
+	VeraStats stats = { { 0 }, { 0 } };
+	VeraArtifacts artifacts = { NULL, 0, 0, &stats };
+	VeraError error;
+	VeraRunner runner = { vera_run_threads, NULL };
+	long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int n_threads = n_cpus > 0 ? n_cpus : 1;
+	int threads_given = 0;
+	int n_inputs;
+	char **inputs;
+	const char *manifest = NULL;
+	const char *palette_file = NULL;
+	const char *regions_file = NULL;
+	const char *shared_name = NULL;
+	const char *collision_file = NULL;
+	VeraIndexedImage collision = { 0 };
+	VeraImage collision_image;
+	VeraSharedPalette shared;
+	uint8_t *remaps = NULL;
+	VeraRegion *regions = NULL;
+	VeraImage *region_images = NULL;
+	uint8_t *region_pixels = NULL;
+	int n_regions = 0;
+	uint8_t palette[256 * 3];
+	int palsize = 0;
+	int loaded = 0;
+	int ret = 0;
+	int64_t start;
+	int opt;
+
+	while ((opt = getopt_long(argc, argv, "h", options, NULL)) != -1)
+	{
+		int *field;
+
+		switch (opt)
+		{
+			case OPT_EXPORT_TYPE:   field = (int *) &vals.export_type; break;
+			case OPT_FILE_HEADER:   field = &vals.file_header; break;
+			case OPT_TILE_BPP:      field = (int *) &vals.tile_bpp; break;
+			case OPT_TILE_WIDTH:    field = (int *) &vals.tile_width; break;
+			case OPT_TILE_HEIGHT:   field = (int *) &vals.tile_height; break;
+			case OPT_TILED_FILE:    field = &vals.tiled_file; break;
+			case OPT_BMP_FILE:      field = &vals.bmp_file; break;
+			case OPT_PAL_FILE:      field = &vals.pal_file; break;
+			case OPT_DEDUP_TILES:   field = &vals.dedup_tiles; break;
+			case OPT_PALETTE_BANKS: field = &vals.palette_banks; break;
+			case OPT_EXPORT_CACHE:  field = &vals.export_cache; break;
+			case OPT_FRAMES:        field = &vals.frames; break;
+			case OPT_VRAM_ADDRESS:  field = &vals.vram_address; break;
+			case OPT_COMPRESS:      field = &vals.compress; break;
+			case OPT_DITHER:        field = (int *) &vals.dither; break;
+			case OPT_DITHER_TILES:  field = &vals.dither_tiles; break;
+			case OPT_PATCH_FILE:    field = &vals.patch_file; break;
+			case OPT_DELTA_FRAMES:  field = &vals.delta_frames; break;
+			case OPT_VBLANK_BYTES:  field = &vals.vblank_bytes; break;
+			case OPT_FRAME_PALETTES: field = &vals.frame_palettes; break;
+			case OPT_FRAME_BYTES:   field = &vals.frame_bytes; break;
+			case OPT_BANK_SPLIT:    field = &vals.bank_split; break;
+			case OPT_SPLIT_TILES:   field = &vals.split_tiles; break;
+			case OPT_FIRST_BANK:    field = &vals.first_bank; break;
+			case OPT_THREADS:       field = &n_threads; threads_given = 1; break;
+			case OPT_PLAN:
+				manifest = optarg;
+				continue;
+			case OPT_PALETTE:
+				palette_file = optarg;
+				continue;
+			case OPT_REGIONS:
+				regions_file = optarg;
+				continue;
+			case OPT_SHARED_PALETTE:
+				shared_name = optarg;
+				continue;
+			case OPT_COLLISION:
+				collision_file = optarg;
+				continue;
+			case 'h':
+				usage(stdout);
+				return 0;
+			default:
+				usage(stderr);
+				return 2;
+		}
+
+		if (parse_number(options[opt - OPT_EXPORT_TYPE].name, optarg, field) != 0)
+			return 2;
+	}
+
+	if (manifest)
+	{
+		if (optind != argc)
+		{
+			usage(stderr);
+			return 2;
+		}
+
+		return plan_manifest(manifest);
+	}
+
+	n_inputs = argc - optind - 1;
+
+	if (n_inputs < 1 || (n_inputs > 1 && ! vals.frames))
+	{
+		usage(stderr);
+		return 2;
+	}
+
+	if (n_threads < 1)
+	{
+		fprintf(stderr, "vera-export: --threads must be at least 1\n");
+		return 2;
+	}
+
+	if (! (inputs = list_inputs(argv + optind, n_inputs, &n_inputs)))
+		return 1;
+
+	if (n_inputs > 1 && ! vals.frames)
+	{
+		fprintf(stderr, "vera-export: %d numbered inputs need --frames 1\n", n_inputs);
+		return 2;
+	}
+
+	if (check_vals(&vals) != 0)
+		return 2;
+
+	if (regions_file && vals.frames)
+	{
+		fprintf(stderr, "vera-export: --regions cannot be combined with --frames 1\n");
+		return 2;
+	}
+
+	if (collision_file && (vals.frames || regions_file))
+	{
+		fprintf(stderr, "vera-export: --collision cannot be combined with --frames 1 or --regions\n");
+		return 2;
+	}
+
+	if (regions_file && (n_regions = load_regions(regions_file, &regions)) < 0)
+		return 1;
+
+	if (palette_file && (palsize = load_palette(palette_file, vals.file_header, palette)) < 0)
+		return 1;
+
+	indexed = calloc(n_inputs, sizeof(VeraIndexedImage));
+	images = calloc(n_inputs, sizeof(VeraImage));
+
+	if (! indexed || ! images)
+	{
+		fprintf(stderr, "vera-export: out of memory\n");
+		return 1;
+	}
+
+	start = vera_stats_now();
+
+	for(; loaded < n_inputs; loaded++)
+	{
+		VeraIndexedImage *input = &indexed[loaded];
+
+		if (vera_load_indexed(inputs[loaded], palette_file ? palette : NULL, palsize,
+					&vals, input, &error) != 0)
+		{
+			fprintf(stderr, "vera-export: %s\n", error.message);
+			ret = 1;
+			break;
+		}
+
+		vera_image_from_indices(&images[loaded], input->pixels, input->width, input->height,
+				input->cmap, input->palsize);
+		vera_stats_count(&stats, VERA_BYTES_IN, (int64_t) input->width * input->height);
+	}
+
+	if (ret == 0 && collision_file)
+	{
+		if (vera_load_indexed(collision_file, NULL, 0, &vals, &collision, &error) == 0)
+		{
+			vera_image_from_indices(&collision_image, collision.pixels, collision.width,
+					collision.height, NULL, 0);
+			images[0].collision = &collision_image;
+		}
+		else
+		{
+			fprintf(stderr, "vera-export: %s\n", error.message);
+			ret = 1;
+		}
+	}
+
+	if (ret == 0 && shared_name)
+	{
+		remaps = malloc((size_t) n_inputs * 256);
+
+		if (! remaps)
+		{
+			vera_set_error(&error, ENOMEM, "Out of memory merging the palettes");
+			ret = -1;
+		}
+		else
+		{
+			ret = share_palette(inputs, indexed, n_inputs, &vals, &shared, remaps, &error);
+		}
+
+		for(int i = 0; ret == 0 && i < n_inputs; i++)
+			use_shared_palette(&images[i], 1, &shared, remaps + (size_t) i * 256);
+
+		// the shared palette takes the place of the output's own
+		vals.pal_file = 0;
+
+		if (ret != 0)
+		{
+			fprintf(stderr, "vera-export: %s\n", error.message);
+			ret = 1;
+		}
+	}
+
+	if (ret == 0 && regions)
+	{
+		ret = vera_regions_check(regions, n_regions, indexed[0].width, indexed[0].height,
+				&vals, &error);
+
+		if (ret == 0)
+			region_images = crop_regions(&indexed[0], regions, n_regions, &region_pixels);
+
+		if (ret == 0 && ! region_images)
+		{
+			vera_set_error(&error, ENOMEM, "Out of memory cutting out the regions");
+			ret = -1;
+		}
+
+		if (ret == 0 && shared_name)
+			use_shared_palette(region_images, n_regions, &shared, remaps);
+
+		if (ret != 0)
+		{
+			fprintf(stderr, "vera-export: %s\n", error.message);
+			ret = 1;
+		}
+	}
+
+	vera_stats_time(&stats, VERA_PHASE_LOAD, start);
+
+	runner.user_data = &n_threads;
+
+	// a single image is one process per asset, so make -j provides the parallelism unless asked
+	if (ret == 0)
+	{
+		const char *output = argv[argc - 1];
+
+		start = vera_stats_now();
+
+		if (region_images)
+			ret = vera_export_atlas(output, region_images, n_regions, &vals, &runner, &artifacts, &error);
+		else if (vals.frames)
+			ret = vera_export_frames(output, images, n_inputs, &vals, &runner, &artifacts, &error);
+		else
+			ret = vera_export(output, &images[0], &vals, threads_given ? &runner : NULL,
+					&artifacts, &error);
+
+		if (ret == 0 && shared_name)
+			ret = vera_save_palette(shared_name, shared.cmap, shared.palsize, &vals, &artifacts, &error);
+
+		vera_stats_time(&stats, VERA_PHASE_EXPORT, start);
+
+		if (ret != 0)
+		{
+			fprintf(stderr, "vera-export: %s\n", error.message);
+			ret = 1;
+		}
+	}
+
+	// stderr is left to the messages unless a file asks for the statistics
+	if (getenv(VERA_STATS_ENV))
+		vera_stats_emit(&stats, "vera-export", argv[argc - 1], ret ? error.message : NULL);
+
+	for(int i = 0; ret == 0 && i < artifacts.count; i++)
+	{
+		if (artifacts.items[i].skipped)
+			printf("%s: unchanged\n", artifacts.items[i].filename);
+	}
+
+	vera_artifacts_clear(&artifacts);
+
+	for(int i = 0; i < loaded; i++)
+		vera_indexed_image_free(&indexed[i]);
+
+	vera_indexed_image_free(&collision);
+
+	free(remaps);
+	free(region_images);
+	free(region_pixels);
+	free(regions);
+	for(int i = 0; i < n_inputs; i++)
+		free(inputs[i]);
+
+	free(inputs);
+	free(images);
+	free(indexed);
+
+	return ret;
+}
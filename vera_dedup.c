@@ -0,0 +1,225 @@
+#include "vera_dedup.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "vera_hash.h"
+
+struct _VeraDedup
+{
+	int       tile_width;
+	int       tile_height;
+	size_t    tile_size;
+	int       allow_flips;
+
+	// unique tiles, tile_size bytes each
+	uint8_t  *tiles;
+	size_t    count;
+	size_t    capacity;
+
+	// open addressing index of tile number + 1, 0 marks an empty slot
+	uint64_t *hashes;
+	uint32_t *slots;
+	size_t    mask;
+
+	// the flipped forms of the tile being looked up
+	uint8_t  *flipped[4];
+};
+
+static uint64_t hash_tile(const uint8_t *tile, size_t size)
+{
+	return vera_hash_bytes(VERA_HASH_SEED, tile, size);
+}
+
+static void flip_tile(const VeraDedup *dedup, const uint8_t *src, uint8_t *dst, int hflip, int vflip)
+{
+	int w = dedup->tile_width;
+	int h = dedup->tile_height;
+
+	for(int y = 0; y < h; y++)
+	{
+		const uint8_t *row = src + (size_t)(vflip ? h - 1 - y : y) * w;
+		uint8_t *out = dst + (size_t) y * w;
+
+		if (hflip)
+		{
+			for(int x = 0; x < w; x++)
+				out[x] = row[w - 1 - x];
+		}
+		else
+		{
+			memcpy(out, row, w);
+		}
+	}
+}
+
+static void insert_slot(VeraDedup *dedup, uint64_t hash, uint32_t tile)
+{
+	size_t i = hash & dedup->mask;
+
+	while(dedup->slots[i])
+		i = (i + 1) & dedup->mask;
+
+	dedup->hashes[i] = hash;
+	dedup->slots[i] = tile + 1;
+}
+
+static int grow_index(VeraDedup *dedup)
+{
+	size_t old_size = dedup->mask + 1;
+	uint64_t *old_hashes = dedup->hashes;
+	uint32_t *old_slots = dedup->slots;
+	size_t size = old_size * 2;
+
+	dedup->hashes = malloc(size * sizeof(uint64_t));
+	dedup->slots = calloc(size, sizeof(uint32_t));
+
+	if (!dedup->hashes || !dedup->slots)
+	{
+		free(dedup->hashes);
+		free(dedup->slots);
+		dedup->hashes = old_hashes;
+		dedup->slots = old_slots;
+		return 0;
+	}
+
+	dedup->mask = size - 1;
+
+	for(size_t i = 0; i < old_size; i++)
+	{
+		if (old_slots[i])
+			insert_slot(dedup, old_hashes[i], old_slots[i] - 1);
+	}
+
+	free(old_hashes);
+	free(old_slots);
+
+	return 1;
+}
+
+static int find_tile(const VeraDedup *dedup, const uint8_t *tile, uint64_t hash)
+{
+	size_t i = hash & dedup->mask;
+
+	while(dedup->slots[i])
+	{
+		uint32_t n = dedup->slots[i] - 1;
+
+		if (dedup->hashes[i] == hash
+				&& memcmp(dedup->tiles + n * dedup->tile_size, tile, dedup->tile_size) == 0)
+			return (int) n;
+
+		i = (i + 1) & dedup->mask;
+	}
+
+	return -1;
+}
+
+VeraDedup *vera_dedup_new(int tile_width, int tile_height, int allow_flips)
+{
+	VeraDedup *dedup = calloc(1, sizeof(VeraDedup));
+
+	if (!dedup)
+		return NULL;
+
+	dedup->tile_width = tile_width;
+	dedup->tile_height = tile_height;
+	dedup->tile_size = (size_t) tile_width * tile_height;
+	dedup->allow_flips = allow_flips;
+	dedup->mask = 255;
+	dedup->hashes = malloc((dedup->mask + 1) * sizeof(uint64_t));
+	dedup->slots = calloc(dedup->mask + 1, sizeof(uint32_t));
+
+	for(int i = 0; i < 4; i++)
+		dedup->flipped[i] = malloc(dedup->tile_size);
+
+	if (!dedup->hashes || !dedup->slots || !dedup->flipped[3])
+	{
+		vera_dedup_free(dedup);
+		return NULL;
+	}
+
+	return dedup;
+}
+
+void vera_dedup_free(VeraDedup *dedup)
+{
+	if (!dedup)
+		return;
+
+	for(int i = 0; i < 4; i++)
+		free(dedup->flipped[i]);
+
+	free(dedup->tiles);
+	free(dedup->hashes);
+	free(dedup->slots);
+	free(dedup);
+}
+
+int vera_dedup_add(VeraDedup *dedup, const uint8_t *tile, uint8_t *flip, int *added)
+{
+	static const uint8_t flip_bits[4] =
+	{
+		0,
+		VERA_TILE_HFLIP,
+		VERA_TILE_VFLIP,
+		VERA_TILE_HFLIP | VERA_TILE_VFLIP
+	};
+	uint64_t hash = hash_tile(tile, dedup->tile_size);
+	int n = find_tile(dedup, tile, hash);
+
+	*flip = 0;
+	*added = 0;
+
+	if (n >= 0)
+		return n;
+
+	/*
+	 * Flips are involutions: if tile is a flipped copy of a stored tile, the
+	 * stored tile is the same flip of this one.
+	 */
+	for(int f = 1; dedup->allow_flips && f < 4; f++)
+	{
+		flip_tile(dedup, tile, dedup->flipped[f], f & 1, f & 2);
+		n = find_tile(dedup, dedup->flipped[f], hash_tile(dedup->flipped[f], dedup->tile_size));
+
+		if (n >= 0)
+		{
+			*flip = flip_bits[f];
+			return n;
+		}
+	}
+
+	if (dedup->count == dedup->capacity)
+	{
+		size_t capacity = dedup->capacity ? dedup->capacity * 2 : 64;
+		uint8_t *tiles = realloc(dedup->tiles, capacity * dedup->tile_size);
+
+		if (!tiles)
+			return -1;
+
+		dedup->tiles = tiles;
+		dedup->capacity = capacity;
+	}
+
+	// keep the index at most half full
+	if ((dedup->count + 1) * 2 > dedup->mask + 1 && !grow_index(dedup))
+		return -1;
+
+	memcpy(dedup->tiles + dedup->count * dedup->tile_size, tile, dedup->tile_size);
+	insert_slot(dedup, hash, (uint32_t) dedup->count);
+	*added = 1;
+
+	return (int) dedup->count++;
+}
+
+size_t vera_dedup_count(const VeraDedup *dedup)
+{
+	return dedup->count;
+}
+
+void vera_map_entry(uint8_t *entry, int tile, uint8_t flip, int palette_offset)
+{
+	entry[0] = tile & 0xff;
+	entry[1] = (palette_offset & 0x0f) << 4 | flip | ((tile >> 8) & 0x03);
+}
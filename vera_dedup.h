@@ -0,0 +1,42 @@
+#ifndef VERA_DEDUP_H
+#define VERA_DEDUP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Tile deduplication.
+ *
+ * Tiles are given unpacked, one color index per pixel.  Each tile is looked
+ * up as-is and flipped horizontally, vertically and both ways, so a tile that
+ * is a mirror image of one already seen reuses it with the matching flip bits
+ * in the tile map.  Lookups go through a hash index, so the cost per tile
+ * does not grow with the number of unique tiles.
+ */
+
+#define VERA_TILE_HFLIP  0x04
+#define VERA_TILE_VFLIP  0x08
+
+typedef struct _VeraDedup VeraDedup;
+
+VeraDedup *vera_dedup_new(int tile_width, int tile_height, int allow_flips);
+
+void vera_dedup_free(VeraDedup *dedup);
+
+/*
+ * Finds tile among the unique tiles seen so far, adding it if there is no
+ * match.  Returns the tile number and sets *flip to the VERA_TILE_HFLIP and
+ * VERA_TILE_VFLIP bits needed to draw tile from it.  *added is set when the
+ * tile is new, in which case it will be numbered after all previous ones.
+ */
+int vera_dedup_add(VeraDedup *dedup, const uint8_t *tile, uint8_t *flip, int *added);
+
+size_t vera_dedup_count(const VeraDedup *dedup);
+
+/*
+ * Writes the 2 byte VERA layer map entry for a tile: the low 8 bits of the
+ * tile number, then the palette offset, flip bits and tile number bits 8-9.
+ */
+void vera_map_entry(uint8_t *entry, int tile, uint8_t flip, int palette_offset);
+
+#endif
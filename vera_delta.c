@@ -0,0 +1,127 @@
+#include "vera_delta.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vera_hash.h"
+
+#define STEP_LENGTH  6
+
+static void put_le16(uint8_t *p, size_t v)
+{
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+}
+
+void vera_delta_hash(const uint8_t *tiles,
+		size_t          count,
+		size_t          tile_length,
+		uint64_t       *hashes)
+{
+	for(size_t i = 0; i < count; i++)
+		hashes[i] = vera_hash_bytes(VERA_HASH_SEED, tiles + i * tile_length, tile_length);
+}
+
+size_t vera_delta_changed(const uint64_t *hashes, const uint64_t *previous, size_t count)
+{
+	size_t changed = 0;
+
+	for(size_t i = 0; i < count; i++)
+		changed += hashes[i] != previous[i];
+
+	return changed;
+}
+
+size_t vera_delta_encode(const uint8_t *tiles,
+		const uint64_t *hashes,
+		const uint64_t *previous,
+		size_t          count,
+		size_t          tile_length,
+		uint8_t        *dst)
+{
+	uint8_t *p = dst + 2;
+	size_t changed = 0;
+
+	for(size_t i = 0; i < count; i++)
+	{
+		if (hashes[i] == previous[i])
+			continue;
+
+		put_le16(p, i);
+		memcpy(p + 2, tiles + i * tile_length, tile_length);
+		p += 2 + tile_length;
+		changed++;
+	}
+
+	put_le16(dst, changed);
+
+	return p - dst;
+}
+
+int vera_delta_uploads(const char *filename,
+		const size_t   *entries,
+		int             count,
+		size_t          tile_length,
+		int             vblank_bytes,
+		uint8_t       **list,
+		size_t         *length,
+		VeraError      *error)
+{
+	size_t per_step = vblank_bytes > 0 ? (size_t) vblank_bytes / tile_length : 0;
+	size_t steps = 0;
+	uint8_t *p;
+
+	*list = NULL;
+	*length = 0;
+
+	// a tile is copied in one go, so it has to fit a vblank on its own
+	if (per_step == 0)
+	{
+		vera_set_error(error, EINVAL,
+				"The %zu byte tiles of '%s' do not fit the %d bytes uploaded per vblank",
+				tile_length, filename, vblank_bytes);
+		return -1;
+	}
+
+	for(int i = 0; i < count; i++)
+		steps += entries[i] ? (entries[i] + per_step - 1) / per_step : 1;
+
+	if (steps > 0xffff)
+	{
+		vera_set_error(error, EFBIG, "'%s' takes %zu vblanks to upload, more than 65535",
+				filename, steps);
+		return -1;
+	}
+
+	*list = malloc(2 + steps * STEP_LENGTH);
+	if (! *list)
+	{
+		vera_set_error(error, ENOMEM, "Out of memory writing the upload list of '%s'", filename);
+		return -1;
+	}
+
+	put_le16(*list, steps);
+	p = *list + 2;
+
+	for(int i = 0; i < count; i++)
+	{
+		size_t first = 0;
+
+		do
+		{
+			size_t n = entries[i] - first < per_step ? entries[i] - first : per_step;
+
+			put_le16(p, i);
+			put_le16(p + 2, first);
+			put_le16(p + 4, n);
+			p += STEP_LENGTH;
+			first += n;
+		}
+		while (first < entries[i]);
+	}
+
+	*length = p - *list;
+
+	return 0;
+}
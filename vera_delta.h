@@ -0,0 +1,65 @@
+#ifndef VERA_DELTA_H
+#define VERA_DELTA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "vera_export.h"
+
+/*
+ * Delta frames.  An animation whose frames are tile sets of the same size
+ * keeps its first frame whole and every later frame as the tiles that differ
+ * from the frame before it:
+ *
+ *   u16 changed, changed * { u16 tile, tile bytes }
+ *
+ * Tiles are told apart by their hashes, so each frame is only read once.
+ * An upload list splits the tiles of every frame into the steps a player
+ * copies to VRAM, one per vblank:
+ *
+ *   u16 steps, steps * { u16 frame, u16 first, u16 count }
+ *
+ * A step copies count entries of its frame from the first one on: tiles of
+ * the first frame and changed tiles of the others.  A frame with no changed
+ * tiles still takes one empty step, so every frame is shown for a vblank.
+ */
+
+#define VERA_DELTA_MAX_TILES  0xffff
+
+/* hashes each of the count tiles of tile_length bytes that tiles holds */
+void vera_delta_hash(const uint8_t *tiles,
+		size_t          count,
+		size_t          tile_length,
+		uint64_t       *hashes);
+
+/* the number of the count tiles whose hashes differ from previous */
+size_t vera_delta_changed(const uint64_t *hashes, const uint64_t *previous, size_t count);
+
+/*
+ * Writes the tiles whose hashes differ from previous as a delta frame into
+ * dst, which holds 2 + changed * (2 + tile_length) bytes, and returns the
+ * length written.
+ */
+size_t vera_delta_encode(const uint8_t *tiles,
+		const uint64_t *hashes,
+		const uint64_t *previous,
+		size_t          count,
+		size_t          tile_length,
+		uint8_t        *dst);
+
+/*
+ * Builds the upload list of count frames that have entries[i] tiles to copy
+ * each, as many as fit vblank_bytes a step.  *list is malloc'ed and holds
+ * *length bytes.  filename only names the output in errors.  Returns 0, or
+ * -1 with error set.
+ */
+int vera_delta_uploads(const char *filename,
+		const size_t   *entries,
+		int             count,
+		size_t          tile_length,
+		int             vblank_bytes,
+		uint8_t       **list,
+		size_t         *length,
+		VeraError      *error);
+
+#endif
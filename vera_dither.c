@@ -0,0 +1,269 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "vera_dither.h"
+
+#define ERROR_ROWS     3          /* Atkinson reaches two rows down */
+#define TRANSPARENT    0xffff     /* key of a pixel that maps to color 0 */
+
+static inline int clamp_channel(int c)
+{
+	return c < 0 ? 0 : c > 255 ? 255 : c;
+}
+
+/* the 0 to n * n - 1 rank of cell (x, y) of the n by n Bayer matrix */
+static int bayer_rank(int x, int y, int n)
+{
+	int rank = 0;
+
+	for(int bit = 1; bit < n; bit <<= 1)
+		rank = rank << 2 | ((x ^ y) & bit ? 2 : 0) | (y & bit ? 1 : 0);
+
+	return rank;
+}
+
+/*
+ * The ordered modes push a pixel by up to half the step between palette
+ * colors, guessed from the palette size as if its colors were a cube.  A
+ * full 4096 color palette gets the VERA's own step of 17.
+ */
+static void init_threshold(VeraDitherer *dither, int n, int palsize)
+{
+	int levels = 2;
+	int spread;
+
+	while (levels < 16 && levels * levels * levels < palsize)
+		levels++;
+
+	spread = 255 / (levels - 1);
+
+	for(int y = 0; y < n; y++)
+	{
+		for(int x = 0; x < n; x++)
+		{
+			int rank = bayer_rank(x, y, n);
+
+			dither->threshold[y * n + x] = (2 * rank + 1) * spread / (2 * n * n) - spread / 2;
+		}
+	}
+}
+
+int vera_dither_init(VeraDitherer *dither,
+		const uint8_t      *cmap,
+		int                 palsize,
+		int                 transparent,
+		const VeraSaveVals *vals,
+		int                 width)
+{
+	memset(dither, 0, sizeof(VeraDitherer));
+
+	vera_lut_init(&dither->lut, cmap, palsize, transparent);
+
+	dither->mode = vals->dither;
+	dither->width = width;
+
+	// bitmaps have no tiles to keep the error in
+	if (vals->dither_tiles && vals->export_type != BITMAP)
+	{
+		dither->tile_width = vals->tile_width;
+		dither->tile_height = vals->tile_height;
+	}
+
+	for(int i = 0; i < palsize; i++)
+	{
+		for(int c = 0; c < 3; c++)
+			dither->colors[i][c] = vera_color_4bit(cmap[i * 3 + c]) * 17;
+	}
+
+	switch (dither->mode)
+	{
+		case DITHER_FLOYD_STEINBERG:
+		case DITHER_ATKINSON:
+			dither->error = calloc((size_t) ERROR_ROWS * width * 3, sizeof(int16_t));
+			if (! dither->error)
+				return -1;
+			break;
+
+		case DITHER_BAYER_4:
+		case DITHER_BAYER_8:
+			init_threshold(dither, dither->mode == DITHER_BAYER_4 ? 4 : 8, palsize);
+			dither->keys = malloc(width * sizeof(uint16_t));
+			if (! dither->keys)
+				return -1;
+			break;
+
+		default:
+			dither->mode = DITHER_NONE;
+			break;
+	}
+
+	return 0;
+}
+
+/*
+ * One row of Floyd-Steinberg or Atkinson in the span [x0, x1), which is a
+ * tile or the whole row.  No error leaves the span, so nothing is written
+ * outside the row.
+ */
+static void diffuse_span(VeraDitherer *dither,
+		const uint8_t *pixels,
+		int            channels,
+		int16_t       *rows[ERROR_ROWS],
+		int            x0,
+		int            x1,
+		uint8_t       *dst)
+{
+	int atkinson = dither->mode == DITHER_ATKINSON;
+	int16_t *cur = rows[0];
+	int16_t *next = rows[1];
+	int16_t *after = rows[2];
+
+	for(int x = x0; x < x1; x++)
+	{
+		const uint8_t *p = pixels + (size_t) x * channels;
+		int16_t *e = cur + x * 3;
+		int t[3];
+		int color;
+
+		if (channels == 4 && dither->lut.transparent && p[3] < 128)
+		{
+			dst[x] = 0;
+			continue;
+		}
+
+		for(int c = 0; c < 3; c++)
+			t[c] = clamp_channel(p[c] + ((e[c] + 8) >> 4));
+
+		color = dither->lut.index[vera_color_key(t[0], t[1], t[2])];
+		dst[x] = color;
+
+		for(int c = 0; c < 3; c++)
+		{
+			int err = t[c] - dither->colors[color][c];
+			int at = x * 3 + c;
+
+			if (atkinson)
+			{
+				// an eighth to each of six neighbours, the rest is dropped
+				err *= 2;
+
+				if (x + 1 < x1)
+					cur[at + 3] += err;
+				if (x + 2 < x1)
+					cur[at + 6] += err;
+				if (x > x0)
+					next[at - 3] += err;
+				next[at] += err;
+				if (x + 1 < x1)
+					next[at + 3] += err;
+				after[at] += err;
+			}
+			else
+			{
+				if (x + 1 < x1)
+				{
+					cur[at + 3] += err * 7;
+					next[at + 3] += err;
+				}
+				if (x > x0)
+					next[at - 3] += err * 3;
+				next[at] += err * 5;
+			}
+		}
+	}
+}
+
+static void diffuse_row(VeraDitherer *dither,
+		const uint8_t *pixels,
+		int            channels,
+		uint8_t       *dst)
+{
+	size_t row_length = (size_t) dither->width * 3;
+	int span = dither->tile_width ? dither->tile_width : dither->width;
+	int16_t *rows[ERROR_ROWS];
+
+	for(int i = 0; i < ERROR_ROWS; i++)
+		rows[i] = dither->error + ((dither->y + i) % ERROR_ROWS) * row_length;
+
+	// the first row of a tile owes nothing to the tiles above
+	if (dither->tile_height && dither->y % dither->tile_height == 0)
+	{
+		memset(rows[0], 0, row_length * sizeof(int16_t));
+		memset(rows[1], 0, row_length * sizeof(int16_t));
+	}
+
+	for(int x0 = 0; x0 < dither->width; x0 += span)
+		diffuse_span(dither, pixels, channels, rows, x0,
+				x0 + span < dither->width ? x0 + span : dither->width, dst);
+
+	// this row's slot becomes the one two rows down
+	memset(rows[0], 0, row_length * sizeof(int16_t));
+}
+
+static void order_row(VeraDitherer *dither,
+		const uint8_t *pixels,
+		int            channels,
+		uint8_t       *dst)
+{
+	int n = dither->mode == DITHER_BAYER_4 ? 4 : 8;
+	const int16_t *threshold = dither->threshold + (dither->y & (n - 1)) * n;
+	uint16_t *keys = dither->keys;
+
+	// the keys first, in a loop without branches the compiler can vectorize
+	for(int x = 0; x < dither->width; x++)
+	{
+		const uint8_t *p = pixels + (size_t) x * channels;
+		int t = threshold[x & (n - 1)];
+
+		keys[x] = vera_color_key(clamp_channel(p[0] + t), clamp_channel(p[1] + t),
+				clamp_channel(p[2] + t));
+	}
+
+	if (channels == 4 && dither->lut.transparent)
+	{
+		for(int x = 0; x < dither->width; x++)
+		{
+			if (pixels[x * 4 + 3] < 128)
+				keys[x] = TRANSPARENT;
+		}
+	}
+
+	for(int x = 0; x < dither->width; x++)
+		dst[x] = keys[x] == TRANSPARENT ? 0 : dither->lut.index[keys[x]];
+}
+
+void vera_dither_rows(VeraDitherer *dither,
+		const uint8_t *pixels,
+		int            channels,
+		int            rows,
+		uint8_t       *dst)
+{
+	size_t stride = (size_t) dither->width * channels;
+
+	if (dither->mode == DITHER_NONE)
+	{
+		vera_lut_map(&dither->lut, pixels, channels, (size_t) dither->width * rows, dst);
+		dither->y += rows;
+		return;
+	}
+
+	// each row is read before its indices are written over it
+	for(int r = 0; r < rows; r++, dither->y++)
+	{
+		const uint8_t *row = pixels + r * stride;
+		uint8_t *out = dst + (size_t) r * dither->width;
+
+		if (dither->error)
+			diffuse_row(dither, row, channels, out);
+		else
+			order_row(dither, row, channels, out);
+	}
+}
+
+void vera_dither_free(VeraDitherer *dither)
+{
+	free(dither->error);
+	free(dither->keys);
+	dither->error = NULL;
+	dither->keys = NULL;
+}
@@ -0,0 +1,61 @@
+#ifndef VERA_DITHER_H
+#define VERA_DITHER_H
+
+#include <stdint.h>
+
+#include "vera_export.h"
+#include "vera_lut.h"
+
+/*
+ * Dithering of RGB pixels onto a palette as the VERA shows it.  The error a
+ * pixel leaves is measured against its palette color reduced to 4 bits per
+ * channel, so what is spread is the error the hardware really makes.  Rows
+ * are taken top to bottom and only the error owed to the next two rows is
+ * kept, so an image of any height is dithered as it is read.
+ *
+ * The Bayer matrices divide every tile size, so identical tiles always
+ * dither alike.  With dither_tiles set, Floyd-Steinberg and Atkinson keep
+ * the error inside the tile it came from, so tile dedup still finds
+ * repeated tiles.
+ */
+
+typedef struct
+{
+	VeraColorLut  lut;
+	VeraDither    mode;
+	int           width;
+	int           tile_width;     /* the error stays inside tiles of this size, or 0 */
+	int           tile_height;
+	int           y;              /* the next row to dither */
+	int16_t      *error;          /* three rows of RGB error, in 16ths */
+	uint16_t     *keys;           /* a row of 12-bit colors, for the ordered modes */
+	int16_t       threshold[64];  /* the ordered modes' offset per matrix cell */
+	uint8_t       colors[256][3]; /* the palette as the VERA shows it */
+} VeraDitherer;
+
+/*
+ * Sets up dithering of rows width pixels wide onto palsize RGB triples,
+ * with the mode and tile size of vals.  With transparent set, color 0 is
+ * kept for pixels less than half opaque.  Returns 0, or -1 when out of
+ * memory.
+ */
+int vera_dither_init(VeraDitherer *dither,
+		const uint8_t      *cmap,
+		int                 palsize,
+		int                 transparent,
+		const VeraSaveVals *vals,
+		int                 width);
+
+/*
+ * Maps the next rows of RGB (channels 3) or RGBA (channels 4) pixels to
+ * indices.  dst may be the same buffer as pixels.
+ */
+void vera_dither_rows(VeraDitherer *dither,
+		const uint8_t *pixels,
+		int            channels,
+		int            rows,
+		uint8_t       *dst);
+
+void vera_dither_free(VeraDitherer *dither);
+
+#endif
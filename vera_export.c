@@ -0,0 +1,2383 @@
+#include "vera_export.h"
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <libxml/encoding.h>
+#include <libxml/xmlwriter.h>
+
+#include "vera_banks.h"
+#include "vera_bmp.h"
+#include "vera_cache.h"
+#include "vera_dedup.h"
+#include "vera_delta.h"
+#include "vera_hash.h"
+#include "vera_lut.h"
+#include "vera_lzsa2.h"
+#include "vera_pack.h"
+#include "vera_patch.h"
+#include "vera_sink.h"
+#include "vera_split.h"
+#include "vera_sprite.h"
+#include "vera_video.h"
+
+#define BITMAP_STRIP_HEIGHT	64
+#define TILE_BAND_LENGTH	(256 * 1024)	/* packed bytes one task aims for */
+#define TILE_PASS_BANDS		32				/* bands held in memory at once */
+
+const VeraSaveVals vera_default_vals =
+{
+	0,
+	TILESET,
+	TILE_4BPP,
+	TILE_WIDTH_8,
+	TILE_HEIGHT_8,
+	1,
+	1,
+	1,
+	0,
+	0,
+	0,
+	0,
+	0,
+	0,
+	DITHER_NONE,
+	0,
+	0,
+	0,
+	1024,
+	0,
+	0,
+	0,
+	0,
+	1
+};
+
+void vera_set_error(VeraError *error, int code, const char *format, ...)
+{
+	va_list args;
+
+	if (! error)
+		return;
+
+	error->code = code;
+
+	va_start(args, format);
+	vsnprintf(error->message, sizeof(error->message), format, args);
+	va_end(args);
+}
+
+char *vera_concat(const char *a, const char *b)
+{
+	size_t la = strlen(a);
+	size_t lb = strlen(b);
+	char *s = malloc(la + lb + 1);
+
+	if (s)
+	{
+		memcpy(s, a, la);
+		memcpy(s + la, b, lb + 1);
+	}
+
+	return s;
+}
+
+static int read_memory_rows(const VeraImage *image, int y, int rows, uint8_t *dst)
+{
+	const uint8_t *pixels = image->user_data;
+
+	memcpy(dst, pixels + (size_t) y * image->width, (size_t) rows * image->width);
+
+	return 0;
+}
+
+void vera_image_from_indices(VeraImage *image,
+		const uint8_t *pixels,
+		int            width,
+		int            height,
+		const uint8_t *cmap,
+		int            palsize)
+{
+	image->width = width;
+	image->height = height;
+	image->cmap = cmap;
+	image->palsize = palsize;
+	image->remap = NULL;
+	image->collision = NULL;
+	image->read_rows = read_memory_rows;
+	image->user_data = (void *) pixels;
+}
+
+void vera_run_tasks(const VeraRunner *runner, VeraTaskFunc func, void *data, int count)
+{
+	if (runner && runner->run && count > 1)
+	{
+		runner->run(runner->user_data, func, data, count);
+		return;
+	}
+
+	for(int i = 0; i < count; i++)
+		func(data, i);
+}
+
+int vera_artifacts_add(VeraArtifacts *artifacts, const char *filename, int skipped)
+{
+	VeraArtifact *artifact;
+	struct stat st;
+
+	if (artifacts->count == artifacts->capacity)
+	{
+		int capacity = artifacts->capacity ? artifacts->capacity * 2 : 8;
+		VeraArtifact *items = realloc(artifacts->items, capacity * sizeof(VeraArtifact));
+
+		if (! items)
+			return -1;
+
+		artifacts->items = items;
+		artifacts->capacity = capacity;
+	}
+
+	artifact = &artifacts->items[artifacts->count];
+	memset(artifact, 0, sizeof(VeraArtifact));
+
+	artifact->filename = malloc(strlen(filename) + 1);
+	if (! artifact->filename)
+		return -1;
+
+	strcpy(artifact->filename, filename);
+	artifact->skipped = skipped;
+
+	if (stat(filename, &st) == 0)
+	{
+		artifact->size = st.st_size;
+		artifact->mtime = st.st_mtime;
+	}
+
+	artifacts->count++;
+
+	return 0;
+}
+
+void vera_artifacts_clear(VeraArtifacts *artifacts)
+{
+	for(int i = 0; i < artifacts->count; i++)
+		free(artifacts->items[i].filename);
+
+	free(artifacts->items);
+	memset(artifacts, 0, sizeof(VeraArtifacts));
+}
+
+static int set_no_memory(VeraError *error, const char *what)
+{
+	vera_set_error(error, ENOMEM, "Out of memory %s", what);
+	return -1;
+}
+
+static int read_index_strip(const VeraImage *image,
+		int        y,
+		int        rows,
+		uint8_t   *strip,
+		VeraError *error)
+{
+	if (image->read_rows(image, y, rows, strip) != 0)
+	{
+		vera_set_error(error, EIO, "Could not read rows %d to %d of the image",
+				y, y + rows - 1);
+		return -1;
+	}
+
+	if (image->remap)
+	{
+		size_t count = (size_t) image->width * rows;
+
+		for(size_t i = 0; i < count; i++)
+			strip[i] = image->remap[strip[i]];
+	}
+
+	return 0;
+}
+
+/* where the files written for artifacts are timed and counted */
+static VeraStats *stats_of(const VeraArtifacts *artifacts)
+{
+	return artifacts ? artifacts->stats : NULL;
+}
+
+static int record_file(VeraSink *sink,
+		int            ret,
+		VeraArtifacts *artifacts,
+		VeraError     *error)
+{
+	// the sink is gone once committed
+	char *filename = artifacts ? vera_concat(sink->filename, "") : NULL;
+	int skipped;
+
+	if (artifacts && ! filename)
+		ret = set_no_memory(error, "recording exported files");
+
+	ret = vera_sink_commit(sink, ret, &skipped, error);
+
+	if (ret == 0 && artifacts && vera_artifacts_add(artifacts, filename, skipped) != 0)
+		ret = set_no_memory(error, "recording exported files");
+
+	free(filename);
+
+	return ret;
+}
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+	p[2] = (v >> 16) & 0xff;
+	p[3] = v >> 24;
+}
+
+/*
+ * Replaces the contents of a flushed sink with [2 byte header] u32 size,
+ * LZSA2 data, written to a new sink.  The data is not decompressed again
+ * here; vera-lzsa2-test (make check) covers the round trip.
+ */
+static int compress_file(VeraSink *sink,
+		const VeraSaveVals *vals,
+		VeraError          *error)
+{
+	const char *filename = sink->filename;
+	size_t header = vals->file_header ? 2 : 0;
+	uint8_t *data = NULL;
+	uint8_t *packed = NULL;
+	size_t length = 0;
+	size_t packed_length = 0;
+	uint8_t size[4];
+	VeraSink out;
+	int64_t start = vera_stats_now();
+	long end;
+	int ret = -1;
+
+	if (fseek(sink->fp, 0, SEEK_END) == 0 && (end = ftell(sink->fp)) >= (long) header
+			&& fseek(sink->fp, 0, SEEK_SET) == 0)
+	{
+		length = (size_t) end;
+		data = malloc(length + 1);
+
+		if (data && fread(data, 1, length, sink->fp) == length)
+			ret = 0;
+		else if (data)
+			vera_set_error(error, EIO, "Could not read back '%s'", filename);
+		else
+			set_no_memory(error, "compressing");
+	}
+	else
+	{
+		vera_set_error(error, EIO, "Could not read back '%s'", filename);
+	}
+
+	if (ret == 0 && length - header > 0xffffffffu)
+	{
+		vera_set_error(error, EFBIG, "'%s' is too large to compress", filename);
+		ret = -1;
+	}
+
+	if (ret == 0 && vera_lzsa2_compress(data + header, length - header, &packed, &packed_length) != 0)
+	{
+		vera_set_error(error, EFBIG,
+				"Could not compress '%s': it holds more than 65535 bytes that LZSA2 cannot match",
+				filename);
+		ret = -1;
+	}
+
+	vera_stats_time(sink->stats, VERA_PHASE_COMPRESS, start);
+
+	if (ret == 0)
+	{
+		put_le32(size, (uint32_t) (length - header));
+		ret = vera_sink_open(&out, filename, sink->stats, error);
+	}
+
+	if (ret == 0)
+	{
+		ret = vera_sink_write(&out, data, header, error);
+
+		if (ret == 0)
+			ret = vera_sink_write(&out, size, sizeof(size), error);
+
+		if (ret == 0)
+			ret = vera_sink_write(&out, packed, packed_length, error);
+
+		// the compressed file takes the place of the raw one
+		if (ret == 0)
+		{
+			vera_sink_discard(sink);
+			*sink = out;
+		}
+		else
+		{
+			vera_sink_discard(&out);
+		}
+	}
+
+	free(packed);
+	free(data);
+
+	return ret;
+}
+
+/* commits a VERA binary, compressing it first when asked to */
+static int close_binary(VeraSink *sink,
+		int                 ret,
+		const VeraSaveVals *vals,
+		VeraArtifacts      *artifacts,
+		VeraError          *error)
+{
+	if (vals->compress)
+	{
+		ret = vera_sink_flush(sink, ret, error);
+
+		if (ret == 0)
+			ret = compress_file(sink, vals, error);
+	}
+
+	return record_file(sink, ret, artifacts, error);
+}
+
+/* writes length bytes of data as filename plus suffix, with the header and compression of vals */
+static int save_binary(const char *filename,
+		const char         *suffix,
+		const uint8_t      *data,
+		size_t              length,
+		const VeraSaveVals *vals,
+		VeraArtifacts      *artifacts,
+		VeraError          *error)
+{
+	char *name = vera_concat(filename, suffix);
+	VeraSink sink;
+	int ret;
+
+	if (! name)
+		return set_no_memory(error, "exporting");
+
+	ret = vera_sink_open(&sink, name, stats_of(artifacts), error);
+	free(name);
+
+	if (ret != 0)
+		return -1;
+
+	if (vals->file_header)
+	{
+		const uint8_t header[2] = { 0, 0 };
+		ret = vera_sink_write(&sink, header, 2, error);
+	}
+
+	if (ret == 0)
+		ret = vera_sink_write(&sink, data, length, error);
+
+	return close_binary(&sink, ret, vals, artifacts, error);
+}
+
+/* reads what a flushed sink holds after header bytes into a malloc'ed *data */
+static int read_back(VeraSink *sink, size_t header, uint8_t **data, size_t *length, VeraError *error)
+{
+	long end;
+
+	*data = NULL;
+	*length = 0;
+
+	if (fseek(sink->fp, 0, SEEK_END) != 0 || (end = ftell(sink->fp)) < (long) header
+			|| fseek(sink->fp, (long) header, SEEK_SET) != 0)
+	{
+		vera_set_error(error, EIO, "Could not read back '%s'", sink->filename);
+		return -1;
+	}
+
+	*length = (size_t) end - header;
+	*data = malloc(*length + 1);
+
+	if (! *data)
+		return set_no_memory(error, "splitting into banks");
+
+	if (fread(*data, 1, *length, sink->fp) != *length)
+	{
+		free(*data);
+		*data = NULL;
+		vera_set_error(error, EIO, "Could not read back '%s'", sink->filename);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* writes the chunks of a bank split and the descriptor of where they go */
+static int save_banks(const char *filename,
+		const uint8_t        *data,
+		const VeraSplitChunk *chunks,
+		int                   count,
+		const VeraSaveVals   *vals,
+		VeraArtifacts        *artifacts,
+		VeraError            *error)
+{
+	size_t length = count ? chunks[count - 1].start + chunks[count - 1].length : 0;
+	uint8_t *descriptor = malloc(1 + (size_t) count * VERA_SPLIT_ENTRY);
+	int ret = 0;
+
+	if (! descriptor)
+		return set_no_memory(error, "splitting into banks");
+
+	if (vals->bank_split == VERA_SPLIT_FILES)
+	{
+		for(int i = 0; ret == 0 && i < count; i++)
+		{
+			char suffix[8];
+
+			snprintf(suffix, sizeof(suffix), ".B%02X", chunks[i].bank);
+			ret = save_binary(filename, suffix, data + chunks[i].start, chunks[i].length,
+					vals, artifacts, error);
+		}
+	}
+	else
+	{
+		size_t table_length = 1 + (size_t) count * VERA_SPLIT_TABLE_ENTRY;
+		uint8_t *banks = malloc(table_length + length);
+
+		if (banks)
+		{
+			banks[0] = count;
+			vera_split_table(chunks, count, banks + 1);
+			memcpy(banks + table_length, data, length);
+
+			ret = save_binary(filename, ".BANKS", banks, table_length + length, vals, artifacts, error);
+			free(banks);
+		}
+		else
+		{
+			ret = set_no_memory(error, "splitting into banks");
+		}
+	}
+
+	if (ret == 0)
+	{
+		descriptor[0] = count;
+		ret = save_binary(filename, ".BNK", descriptor,
+				1 + vera_split_descriptor(chunks, count, vals, descriptor + 1),
+				vals, artifacts, error);
+	}
+
+	free(descriptor);
+
+	return ret;
+}
+
+/*
+ * Commits the tiles or the bitmap of an export, along with a patch of the
+ * chunks that changed since the last export when vals asks for one.  The
+ * patch and its hashes are only kept once the binary is in place, so a
+ * failure leaves them describing an older file and the next patch covers
+ * both changes.  With bank-split, the data is also cut into banks at
+ * chunk boundaries.
+ */
+static int close_vram_data(VeraSink *sink,
+		int                 ret,
+		size_t              chunk,
+		const VeraSaveVals *vals,
+		VeraArtifacts      *artifacts,
+		VeraError          *error)
+{
+	VeraPatch patch;
+	VeraSplitChunk *chunks = NULL;
+	uint8_t *data = NULL;
+	char *filename = NULL;
+	int n_chunks = 0;
+	int has_patch = 0;
+
+	if (vals->patch_file)
+	{
+		ret = vera_sink_flush(sink, ret, error);
+
+		if (ret == 0)
+			ret = vera_patch_build(&patch, sink, vals->file_header ? 2 : 0, chunk, vals,
+					stats_of(artifacts), error);
+
+		has_patch = ret == 0;
+	}
+
+	// planned before the binary is committed, so a split that cannot work fails it
+	if (vals->bank_split)
+	{
+		size_t length;
+
+		ret = vera_sink_flush(sink, ret, error);
+
+		if (ret == 0)
+			ret = read_back(sink, vals->file_header ? 2 : 0, &data, &length, error);
+
+		if (ret == 0)
+			ret = vera_split_plan(sink->filename, length, chunk, vals, &chunks, &n_chunks, error);
+
+		// the sink is gone once committed
+		if (ret == 0 && ! (filename = vera_concat(sink->filename, "")))
+			ret = set_no_memory(error, "splitting into banks");
+	}
+
+	ret = close_binary(sink, ret, vals, artifacts, error);
+
+	if (has_patch)
+	{
+		ret = record_file(&patch.patch, ret, artifacts, error);
+		ret = record_file(&patch.hashes, ret, artifacts, error);
+	}
+
+	if (ret == 0 && filename)
+		ret = save_banks(filename, data, chunks, n_chunks, vals, artifacts, error);
+
+	free(filename);
+	free(chunks);
+	free(data);
+
+	return ret;
+}
+
+int vera_save_data(const char *filename,
+		const void         *data,
+		size_t              length,
+		VeraArtifacts      *artifacts,
+		VeraError          *error)
+{
+	VeraSink sink;
+
+	if (vera_sink_open(&sink, filename, stats_of(artifacts), error) != 0)
+		return -1;
+
+	return record_file(&sink, vera_sink_write(&sink, data, length, error), artifacts, error);
+}
+
+int vera_use_palette_banks(const VeraSaveVals *vals)
+{
+	// only 2bpp and 4bpp tiles choose their palette through the tile map or sprite attributes
+	return vals->export_type != BITMAP
+		&& vals->palette_banks
+		&& (vals->tile_bpp == TILE_2BPP || vals->tile_bpp == TILE_4BPP);
+}
+
+static int check_sprites(const char *filename, const VeraSaveVals *vals, VeraError *error)
+{
+	if (vals->export_type != SPRITE)
+		return 0;
+
+	if (vals->tile_bpp != TILE_4BPP && vals->tile_bpp != TILE_8BPP)
+	{
+		vera_set_error(error, EINVAL, "Sprites must be 4 or 8 bits per pixel, not %d",
+				vals->tile_bpp);
+		return -1;
+	}
+
+	if (vals->vram_address < 0 || vals->vram_address >= VERA_VRAM_SIZE
+			|| vals->vram_address % VERA_SPRITE_ALIGN)
+	{
+		vera_set_error(error, EINVAL,
+				"The VRAM address of '%s' must be a multiple of %d below 0x%05x, not 0x%x",
+				filename, VERA_SPRITE_ALIGN, VERA_VRAM_SIZE, vals->vram_address);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * A patch only covers the tile or bitmap data, so it cannot follow a tile
+ * map or sprite attributes that change along with deduplicated tiles.
+ */
+static int check_patch(const VeraSaveVals *vals, VeraError *error)
+{
+	if (vals->patch_file && vals->export_type != BITMAP
+			&& (vals->dedup_tiles || vera_use_palette_banks(vals)))
+	{
+		vera_set_error(error, EINVAL, "patch-file cannot be combined with dedup-tiles or palette-banks");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int export_files(const char *filename,
+		const VeraImage    *image,
+		const VeraSaveVals *vals,
+		const VeraRunner   *runner,
+		VeraArtifacts      *artifacts,
+		VeraError          *error)
+{
+	int ret = 0;
+	const uint8_t *cmap = image->cmap;
+	int palsize = image->palsize;
+	uint8_t *collision = NULL;
+	char *bmp_filename;
+
+	if (check_sprites(filename, vals, error) != 0 || check_patch(vals, error) != 0)
+		return -1;
+
+	if (vals->bank_split < VERA_SPLIT_NONE || vals->bank_split > VERA_SPLIT_TABLE)
+	{
+		vera_set_error(error, EINVAL, "bank-split must be 0, 1 or 2, not %d", vals->bank_split);
+		return -1;
+	}
+
+	if (vals->bank_split && vals->compress)
+	{
+		vera_set_error(error, EINVAL, "Banks are staged as they are, bank-split cannot be combined with compress");
+		return -1;
+	}
+
+	if (image->collision && vals->export_type != TILESET)
+	{
+		vera_set_error(error, EINVAL, "Collision masks can only be exported with tile sets");
+		return -1;
+	}
+
+	// the Tiled files below list the collision of every tile
+	if (image->collision)
+		ret = vera_save_collision(filename, image, vals, runner, &collision, artifacts, error);
+
+	// banked tile sets write their own palette
+	if (ret == 0 && cmap && vals->pal_file && ! vera_use_palette_banks(vals))
+	{
+		ret = vera_save_palette(filename, cmap, palsize, vals, artifacts, error);
+	}
+
+	bmp_filename = vera_concat(filename, ".bmp");
+	if (! bmp_filename)
+	{
+		free(collision);
+		return set_no_memory(error, "exporting");
+	}
+
+	switch(vals->export_type)
+	{
+		case TILESET:
+		case SPRITE:
+
+			// generate images for all palettes when using 2bpp or 4bpp
+			if((vals->tile_bpp == TILE_4BPP || vals->tile_bpp == TILE_2BPP)
+					&& ! vera_use_palette_banks(vals))
+			{
+				int num_palettes = palsize / 16;
+				size_t name_length = strlen(filename) + 16;
+				char **numbered_filenames = calloc(num_palettes + 1, sizeof(char *));
+				char **numbered_bmp_filenames = calloc(num_palettes + 1, sizeof(char *));
+				uint8_t **shifted_maps = calloc(num_palettes + 1, sizeof(uint8_t *));
+				int allocated = numbered_filenames && numbered_bmp_filenames && shifted_maps;
+
+				if (! allocated)
+					ret = set_no_memory(error, "exporting");
+
+				for (int i = 0; allocated && i < num_palettes; i++)
+				{
+					shifted_maps[i] = malloc((size_t) palsize * 3);
+					numbered_filenames[i] = malloc(name_length);
+					numbered_bmp_filenames[i] = malloc(name_length + 4);
+
+					if (! shifted_maps[i] || ! numbered_filenames[i] || ! numbered_bmp_filenames[i])
+					{
+						ret = set_no_memory(error, "exporting");
+						break;
+					}
+
+					vera_shift_color_map(cmap, shifted_maps[i], palsize, i*16);
+					snprintf(numbered_filenames[i], name_length, "%s.%d", filename, i);
+					snprintf(numbered_bmp_filenames[i], name_length + 4, "%s.bmp", numbered_filenames[i]);
+				}
+
+				if (ret == 0 && vals->bmp_file)
+				{
+					// write out bitmaps to be used with the .tsx files
+					ret = vera_save_bmp_files(image,
+							(const char * const *) numbered_bmp_filenames,
+							(const uint8_t * const *) shifted_maps,
+							palsize,
+							num_palettes,
+							runner,
+							artifacts,
+							error);
+				}
+
+				for (int i = 0; ret == 0 && i < num_palettes && vals->tiled_file; i++)
+				{
+					ret = vera_save_tsx(numbered_filenames[i],
+							numbered_bmp_filenames[i],
+							image,
+							collision,
+							vals,
+							artifacts,
+							error);
+				}
+
+				for (int i = 0; allocated && i < num_palettes; i++)
+				{
+					free(numbered_filenames[i]);
+					free(numbered_bmp_filenames[i]);
+					free(shifted_maps[i]);
+				}
+
+				free(numbered_filenames);
+				free(numbered_bmp_filenames);
+				free(shifted_maps);
+			}
+			else // NOT 4bpp or 2BPP
+			{
+				if (ret == 0 && vals->bmp_file)
+				{
+					// write out a bitmap to be used with the .tsx file
+					ret = vera_save_bmp_files(image,
+							(const char * const *) &bmp_filename,
+							&cmap,
+							palsize,
+							1,
+							runner,
+							artifacts,
+							error);
+				}
+				if (ret == 0 && vals->tiled_file)
+				{
+					ret = vera_save_tsx(filename, bmp_filename, image, collision, vals, artifacts, error);
+				}
+			}
+
+			if (ret == 0)
+				ret = vera_save_tile_set(filename, image, vals, runner, artifacts, error);
+			break;
+		case BITMAP:
+			if (ret == 0)
+				ret = vera_save_bitmap(filename, image, vals, artifacts, error);
+			break;
+	}
+
+	free(bmp_filename);
+	free(collision);
+
+	return ret;
+}
+
+int vera_export(const char *filename,
+		const VeraImage    *image,
+		const VeraSaveVals *vals,
+		const VeraRunner   *runner,
+		VeraArtifacts      *artifacts,
+		VeraError          *error)
+{
+	VeraArtifacts own = { NULL, 0, 0 };
+	uint64_t fingerprint = 0;
+	int first;
+	int ret;
+
+	if (! vals->export_cache)
+		return export_files(filename, image, vals, runner, artifacts, error);
+
+	// the cache needs the list of files even if the caller does not
+	if (! artifacts)
+		artifacts = &own;
+
+	first = artifacts->count;
+
+	ret = vera_cache_fingerprint(filename, image, vals, &fingerprint, error);
+
+	if (ret == 0 && ! vera_cache_check(filename, fingerprint, artifacts))
+	{
+		ret = export_files(filename, image, vals, runner, artifacts, error);
+
+		if (ret == 0)
+			ret = vera_cache_write(filename, fingerprint,
+					artifacts->items + first, artifacts->count - first, error);
+		else
+			vera_cache_remove(filename);
+	}
+
+	vera_artifacts_clear(&own);
+
+	return ret;
+}
+
+void vera_shift_color_map(const uint8_t *orig,
+		uint8_t *shifted,
+		int      palsize,
+		int      offset)
+{
+	int offset_base = offset * 3;
+	for(int i = 0; i < palsize*3; i+=3)
+	{
+		if(i + offset_base >= palsize * 3)
+		{
+			// this is the last <offset> values in the color map, wrapped around
+			shifted[i] = orig[i + offset_base - palsize * 3];
+			shifted[i+1] = orig[i+1 + offset_base - palsize * 3];
+			shifted[i+2] = orig[i+2 + offset_base - palsize * 3];
+			continue;
+		}
+
+		shifted[i] = orig[i+offset_base];
+		shifted[i+1] = orig[i+1+offset_base];
+		shifted[i+2] = orig[i+2+offset_base];
+	}
+}
+
+int vera_save_tsx(const char *filename,
+		const char         *bmp_filename,
+		const VeraImage    *image,
+		const uint8_t      *collision,
+		const VeraSaveVals *vals,
+		VeraArtifacts      *artifacts,
+		VeraError          *error)
+{
+	// write out the tsx file
+	char *tsx_filename = vera_concat(filename, ".tsx");
+	VeraSink sink;
+
+	int rc;
+	xmlOutputBufferPtr out;
+	xmlTextWriterPtr writer;
+
+	if (! tsx_filename)
+		return set_no_memory(error, "writing the Tiled file");
+
+	rc = vera_sink_open(&sink, tsx_filename, stats_of(artifacts), error);
+	free(tsx_filename);
+
+	if (rc != 0)
+		return -1;
+
+	// the writer only flushes into the sink's FILE, it never closes it
+	out = xmlOutputBufferCreateFile(sink.fp, NULL);
+	writer = out ? xmlNewTextWriter(out) : NULL;
+	if(writer == NULL)
+	{
+		if (out)
+			xmlOutputBufferClose(out);
+		vera_sink_discard(&sink);
+		return set_no_memory(error, "writing the Tiled file");
+	}
+
+	rc = xmlTextWriterStartDocument(writer, NULL, "UTF-8", NULL);
+	if (rc < 0)
+	{
+		vera_set_error(error, errno, "Error starting document '%s': %s",
+				filename, strerror(errno));
+		xmlFreeTextWriter(writer);
+		vera_sink_discard(&sink);
+		return -1;
+	}
+
+	int width, height, tile_count, columns;
+
+	/* get info about the current image */
+	width  = image->width;
+	height = image->height;
+
+	tile_count = (width * height) / (vals->tile_width * vals->tile_height);
+	columns = width / vals->tile_width;
+
+	char val_string[16];
+
+	xmlTextWriterStartElement(writer, BAD_CAST "tileset");
+	xmlTextWriterWriteAttribute(writer, BAD_CAST "version", BAD_CAST "1.5");
+	xmlTextWriterWriteAttribute(writer, BAD_CAST "tiledversion", BAD_CAST "1.8.0");
+	xmlTextWriterWriteAttribute(writer, BAD_CAST "name", BAD_CAST filename);
+	snprintf(val_string, sizeof(val_string), "%d", vals->tile_width);
+	xmlTextWriterWriteAttribute(writer,BAD_CAST "tilewidth", BAD_CAST val_string);
+	snprintf(val_string, sizeof(val_string), "%d", vals->tile_height);
+	xmlTextWriterWriteAttribute(writer, BAD_CAST "tileheight", BAD_CAST val_string);
+	snprintf(val_string, sizeof(val_string), "%d", tile_count);
+	xmlTextWriterWriteAttribute(writer, BAD_CAST "tilecount", BAD_CAST val_string);
+	snprintf(val_string, sizeof(val_string), "%d", columns);
+	xmlTextWriterWriteAttribute(writer, BAD_CAST "columns", BAD_CAST val_string);
+
+	xmlTextWriterStartElement(writer, BAD_CAST "image");
+	xmlTextWriterWriteAttribute(writer, BAD_CAST "source", BAD_CAST bmp_filename);
+	xmlTextWriterWriteAttribute(writer, BAD_CAST "trans", BAD_CAST "000000");
+	snprintf(val_string, sizeof(val_string), "%d", width);
+	xmlTextWriterWriteAttribute(writer, BAD_CAST "width", BAD_CAST val_string);
+	snprintf(val_string, sizeof(val_string), "%d", height);
+	xmlTextWriterWriteAttribute(writer, BAD_CAST "height", BAD_CAST val_string);
+	xmlTextWriterEndElement(writer); // image
+
+	// empty tiles are left out, they have no properties
+	for(int i = 0; collision && i < tile_count; i++)
+	{
+		if (collision[i] == VERA_COLLISION_EMPTY)
+			continue;
+
+		snprintf(val_string, sizeof(val_string), "%d", i);
+		xmlTextWriterStartElement(writer, BAD_CAST "tile");
+		xmlTextWriterWriteAttribute(writer, BAD_CAST "id", BAD_CAST val_string);
+		xmlTextWriterStartElement(writer, BAD_CAST "properties");
+		xmlTextWriterStartElement(writer, BAD_CAST "property");
+		xmlTextWriterWriteAttribute(writer, BAD_CAST "name", BAD_CAST "collision");
+		xmlTextWriterWriteAttribute(writer, BAD_CAST "value",
+				BAD_CAST (collision[i] == VERA_COLLISION_SOLID ? "solid" : "partial"));
+		xmlTextWriterEndElement(writer); // property
+		xmlTextWriterEndElement(writer); // properties
+		xmlTextWriterEndElement(writer); // tile
+	}
+
+	xmlTextWriterEndElement(writer); // tileset
+
+	rc = xmlTextWriterEndDocument(writer);
+
+	xmlFreeTextWriter(writer);
+
+	if (rc < 0)
+		vera_set_error(error, EIO, "Could not write to '%s'", sink.filename);
+
+	return record_file(&sink, rc < 0 ? -1 : 0, artifacts, error);
+}
+
+int vera_save_collision(const char *filename,
+		const VeraImage    *image,
+		const VeraSaveVals *vals,
+		const VeraRunner   *runner,
+		uint8_t           **tiles,
+		VeraArtifacts      *artifacts,
+		VeraError          *error)
+{
+	const VeraImage *collision = image->collision;
+	VeraSaveVals mask_vals = *vals;
+	VeraImage mask = *collision;
+	uint8_t solid[256];
+	size_t tile_length;
+	size_t count;
+	size_t length;
+	uint8_t *masks;
+	uint8_t *summary;
+	int ret;
+
+	*tiles = NULL;
+
+	if (collision->width != image->width || collision->height != image->height)
+	{
+		vera_set_error(error, EINVAL, "The collision mask of '%s' is %dx%d, not %dx%d like the image",
+				filename, collision->width, collision->height, image->width, image->height);
+		return -1;
+	}
+
+	// every solid pixel reads as 1, so the 1 bpp tile packer lays out the mask
+	memset(solid, 1, sizeof(solid));
+	solid[0] = 0;
+	mask.remap = solid;
+	mask_vals.tile_bpp = TILE_1BPP;
+
+	tile_length = vera_packed_size(TILE_1BPP, (size_t) vals->tile_width * vals->tile_height);
+	count = (size_t) (image->width / vals->tile_width) * (image->height / vals->tile_height);
+	length = vera_tile_set_size(&mask, &mask_vals);
+
+	masks = malloc(length + 1);
+	summary = malloc(count + 1);
+
+	if (! masks || ! summary)
+		ret = set_no_memory(error, "writing the collision mask");
+	else
+		ret = vera_pack_tile_set(&mask, &mask_vals, runner, masks, error);
+
+	for(size_t i = 0; ret == 0 && i < count; i++)
+	{
+		const uint8_t *tile = masks + i * tile_length;
+		int set = 0;
+		int clear = 0;
+
+		// tile rows are whole bytes, so a solid tile is all 0xff
+		for(size_t j = 0; j < tile_length; j++)
+		{
+			set |= tile[j] != 0;
+			clear |= tile[j] != 0xff;
+		}
+
+		summary[i] = ! set ? VERA_COLLISION_EMPTY : ! clear ? VERA_COLLISION_SOLID : VERA_COLLISION_PARTIAL;
+	}
+
+	if (ret == 0)
+		ret = save_binary(filename, ".MASK", masks, length, vals, artifacts, error);
+
+	if (ret == 0)
+		ret = save_binary(filename, ".COL", summary, count, vals, artifacts, error);
+
+	free(masks);
+
+	if (ret != 0)
+	{
+		free(summary);
+		return -1;
+	}
+
+	*tiles = summary;
+
+	return 0;
+}
+
+static void copy_tile(const uint8_t *strip,
+		int            width,
+		int            x,
+		int            tile_width,
+		int            tile_height,
+		uint8_t       *tile_pixels)
+{
+	for(int ty = 0; ty < tile_height; ty++)
+	{
+		memcpy(tile_pixels + ty * tile_width,
+				strip + (size_t) ty * width + x * tile_width,
+				tile_width);
+	}
+}
+
+/*
+ * First pass of a banked tile set export: collects the colors of every tile,
+ * packs them into 16 color palette banks and writes the resulting palette.
+ */
+static int assign_palette_banks(const char *filename,
+		const VeraImage    *image,
+		const VeraSaveVals *vals,
+		int            t_width,
+		int            t_height,
+		uint8_t       *strip,
+		uint8_t       *tile_pixels,
+		VeraColorSet  *tile_colors,
+		VeraBanks     *banks,
+		VeraArtifacts *artifacts,
+		VeraError     *error)
+{
+	int width = image->width;
+	int tile_width = vals->tile_width;
+	int tile_height = vals->tile_height;
+	int bank_size = vals->tile_bpp == TILE_4BPP ? 16 : 4;
+	size_t bad_tile = 0;
+	int ret = 0;
+
+	for(int y = 0; y < t_height; y++)
+	{
+		if (read_index_strip(image, y * tile_height, tile_height, strip, error) != 0)
+			return -1;
+
+		for(int x = 0; x < t_width; x++)
+		{
+			copy_tile(strip, width, x, tile_width, tile_height, tile_pixels);
+			vera_color_set_from_pixels(&tile_colors[(size_t) y * t_width + x],
+					tile_pixels, (size_t) tile_width * tile_height);
+		}
+	}
+
+	switch (vera_banks_solve(banks, tile_colors, (size_t) t_width * t_height, bank_size, &bad_tile))
+	{
+		case VERA_BANKS_OK:
+			break;
+		case VERA_BANKS_TILE_COLORS:
+			vera_set_error(error, EINVAL,
+					"The tile at column %d, row %d uses more than %d colors besides color 0",
+					(int) (bad_tile % t_width), (int) (bad_tile / t_width), bank_size - 1);
+			return -1;
+		case VERA_BANKS_TOO_MANY:
+			vera_set_error(error, EINVAL,
+					"The tiles of '%s' need more than %d palette banks",
+					filename, VERA_MAX_BANKS);
+			return -1;
+		default:
+			return set_no_memory(error, "assigning palette banks");
+	}
+
+	if (vals->pal_file && image->cmap)
+	{
+		uint8_t *bank_cmap = malloc((size_t) banks->bank_count * 16 * 3);
+
+		if (! bank_cmap)
+			return set_no_memory(error, "assigning palette banks");
+
+		vera_banks_colormap(banks, image->cmap, image->palsize, bank_cmap);
+		ret = vera_save_palette(filename, bank_cmap, banks->bank_count * 16, vals, artifacts, error);
+
+		free(bank_cmap);
+	}
+
+	return ret;
+}
+
+typedef struct
+{
+	const VeraImage     *image;
+	const VeraSaveVals  *vals;
+	int                  row;       /* first tile row */
+	int                  rows;
+	uint8_t             *dst;
+	VeraError            error;
+	int                  ret;
+} TileBand;
+
+/* packs a band of tile rows, which lands at a fixed offset of the tile set */
+static void pack_tile_band(void *data, int index)
+{
+	TileBand *band = (TileBand *) data + index;
+	const VeraSaveVals *vals = band->vals;
+	int width = band->image->width;
+	int t_width = width / vals->tile_width;
+	size_t tile_row_length = vera_packed_size(vals->tile_bpp,
+			(size_t) vals->tile_width * vals->tile_height) * t_width;
+	uint8_t *strip = malloc((size_t) width * vals->tile_height + 1);
+	uint8_t *row_buf = malloc(vera_packed_size(vals->tile_bpp, width) + 1);
+	VeraPacker packer;
+
+	vera_packer_init(&packer, vals->tile_bpp, VERA_KERNEL_AUTO);
+
+	if (! strip || ! row_buf)
+		band->ret = set_no_memory(&band->error, "writing the tile set");
+
+	for(int y = 0; band->ret == 0 && y < band->rows; y++)
+	{
+		band->ret = read_index_strip(band->image, (band->row + y) * vals->tile_height,
+				vals->tile_height, strip, &band->error);
+
+		if (band->ret == 0)
+			vera_pack_tile_row(&packer, strip, width, t_width, vals->tile_width,
+					vals->tile_height, band->dst + y * tile_row_length, row_buf);
+	}
+
+	free(row_buf);
+	free(strip);
+}
+
+// tile rows per band, so a pass of bands stays small but still spreads over every band
+static int tile_band_rows(int t_height, size_t tile_row_length)
+{
+	int band_rows = tile_row_length < TILE_BAND_LENGTH ? TILE_BAND_LENGTH / tile_row_length : 1;
+
+	if (band_rows > (t_height + TILE_PASS_BANDS - 1) / TILE_PASS_BANDS)
+		band_rows = (t_height + TILE_PASS_BANDS - 1) / TILE_PASS_BANDS;
+
+	return band_rows > 0 ? band_rows : 1;
+}
+
+/* packs tile rows [row, row + rows), at most a pass of bands, into dst */
+static int pack_tile_pass(const VeraImage *image,
+		const VeraSaveVals *vals,
+		const VeraRunner   *runner,
+		TileBand           *bands,
+		int                 row,
+		int                 rows,
+		int                 band_rows,
+		uint8_t            *dst,
+		VeraError          *error)
+{
+	size_t tile_row_length = vera_packed_size(vals->tile_bpp,
+			(size_t) vals->tile_width * vals->tile_height) * (image->width / vals->tile_width);
+	int count = (rows + band_rows - 1) / band_rows;
+
+	for(int i = 0; i < count; i++)
+	{
+		bands[i].image = image;
+		bands[i].vals = vals;
+		bands[i].row = row + i * band_rows;
+		bands[i].rows = rows - i * band_rows < band_rows ? rows - i * band_rows : band_rows;
+		bands[i].dst = dst + tile_row_length * i * band_rows;
+		bands[i].ret = 0;
+	}
+
+	vera_run_tasks(runner, pack_tile_band, bands, count);
+
+	for(int i = 0; i < count; i++)
+	{
+		if (bands[i].ret != 0)
+		{
+			if (error)
+				*error = bands[i].error;
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+size_t vera_tile_set_size(const VeraImage *image, const VeraSaveVals *vals)
+{
+	return vera_packed_size(vals->tile_bpp, (size_t) vals->tile_width * vals->tile_height)
+		* (image->width / vals->tile_width) * (image->height / vals->tile_height);
+}
+
+int vera_pack_tile_set(const VeraImage *image,
+		const VeraSaveVals *vals,
+		const VeraRunner   *runner,
+		uint8_t            *dst,
+		VeraError          *error)
+{
+	int t_width = image->width / vals->tile_width;
+	int t_height = image->height / vals->tile_height;
+	size_t tile_row_length = vera_packed_size(vals->tile_bpp,
+			(size_t) vals->tile_width * vals->tile_height) * t_width;
+	int band_rows = tile_band_rows(t_height, tile_row_length);
+	int pass_rows = band_rows * TILE_PASS_BANDS;
+	TileBand *bands;
+	int ret = 0;
+
+	if (t_width == 0 || t_height == 0)
+		return 0;
+
+	bands = calloc(TILE_PASS_BANDS, sizeof(TileBand));
+	if (! bands)
+		return set_no_memory(error, "packing the tile set");
+
+	for(int row = 0; ret == 0 && row < t_height; row += pass_rows)
+	{
+		int rows = t_height - row < pass_rows ? t_height - row : pass_rows;
+
+		ret = pack_tile_pass(image, vals, runner, bands, row, rows, band_rows,
+				dst + tile_row_length * row, error);
+	}
+
+	free(bands);
+
+	return ret;
+}
+
+/*
+ * Writes every tile in order.  Bands of tile rows are packed in parallel
+ * through runner, a pass of them at a time, and written once the whole pass
+ * is done, so the file is the same however many threads run.
+ */
+static int write_tile_bands(VeraSink *sink,
+		const VeraImage    *image,
+		const VeraSaveVals *vals,
+		const VeraRunner   *runner,
+		VeraError          *error)
+{
+	int t_width = image->width / vals->tile_width;
+	int t_height = image->height / vals->tile_height;
+	size_t tile_row_length = vera_packed_size(vals->tile_bpp,
+			(size_t) vals->tile_width * vals->tile_height) * t_width;
+	int band_rows = tile_band_rows(t_height, tile_row_length);
+	int pass_rows;
+	uint8_t *pass_buf;
+	TileBand *bands;
+	int ret = 0;
+
+	if (t_width == 0 || t_height == 0)
+		return 0;
+
+	pass_rows = band_rows * TILE_PASS_BANDS;
+	if (pass_rows > t_height)
+		pass_rows = t_height;
+
+	pass_buf = malloc(tile_row_length * pass_rows + 1);
+	bands = calloc(TILE_PASS_BANDS, sizeof(TileBand));
+
+	if (! pass_buf || ! bands)
+		ret = set_no_memory(error, "writing the tile set");
+
+	for(int row = 0; ret == 0 && row < t_height; row += pass_rows)
+	{
+		int rows = t_height - row < pass_rows ? t_height - row : pass_rows;
+
+		ret = pack_tile_pass(image, vals, runner, bands, row, rows, band_rows, pass_buf, error);
+
+		if (ret == 0)
+			ret = vera_sink_write(sink, pass_buf, tile_row_length * rows, error);
+	}
+
+	free(bands);
+	free(pass_buf);
+
+	return ret;
+}
+
+/* writes the attributes of the sprite stored as the given tile of the BIN */
+static int sprite_entry(uint8_t *entry,
+		int                 tile,
+		uint8_t             flip,
+		int                 bank,
+		size_t              tile_length,
+		const VeraSaveVals *vals,
+		const char         *filename,
+		VeraError          *error)
+{
+	size_t address = vals->vram_address + (size_t) tile * tile_length;
+
+	if (address + tile_length > VERA_VRAM_SIZE)
+	{
+		vera_set_error(error, EINVAL,
+				"The sprites of '%s' do not fit in VRAM from address 0x%05x",
+				filename, vals->vram_address);
+		return -1;
+	}
+
+	vera_sprite_attributes(entry, address, vals->tile_bpp,
+			vals->tile_width, vals->tile_height, flip, bank);
+
+	return 0;
+}
+
+int vera_save_tile_set(const char *filename,
+		const VeraImage    *image,
+		const VeraSaveVals *vals,
+		const VeraRunner   *runner,
+		VeraArtifacts      *artifacts,
+		VeraError          *error)
+{
+	uint8_t          *strip;
+	uint8_t          *tile_buf;
+	uint8_t          *tile_pixels = NULL;
+	uint8_t          *map_buf = NULL;        /* map entries or sprite attributes of a row */
+	char             *map_filename = NULL;
+	VeraSink          sink;
+	VeraSink          map_sink;
+	VeraDedup        *dedup = NULL;
+	VeraBanks         banks;
+	VeraColorSet     *tile_colors = NULL;
+	int               width, height;
+	int               has_map = 0;
+	int               use_banks = vera_use_palette_banks(vals);
+	int               dedup_tiles = vals->dedup_tiles || use_banks;
+	int               sprites = vals->export_type == SPRITE;
+	size_t            entry_size = sprites ? VERA_SPRITE_ATTR_SIZE : 2;
+	int               ret = 0;
+
+	if (check_sprites(filename, vals, error) != 0 || check_patch(vals, error) != 0)
+		return -1;
+
+	if (vera_sink_open(&sink, filename, stats_of(artifacts), error) != 0)
+		return -1;
+
+	// sprites always get their attributes, tile sets only have a map when deduplicated
+	if (dedup_tiles || sprites)
+	{
+		map_filename = vera_concat(filename, sprites ? ".SPR" : ".MAP");
+
+		if (map_filename)
+			has_map = vera_sink_open(&map_sink, map_filename, stats_of(artifacts), error) == 0;
+		else
+			set_no_memory(error, "writing the tile map");
+
+		free(map_filename);
+
+		if (! has_map)
+		{
+			vera_sink_discard(&sink);
+			return -1;
+		}
+	}
+
+	/* get info about the current image */
+	width  = image->width;
+	height = image->height;
+
+	VeraPacker packer;
+	vera_packer_init(&packer, vals->tile_bpp, VERA_KERNEL_AUTO);
+
+	int tile_width = vals->tile_width;
+	int tile_height = vals->tile_height;
+	int t_width = width / tile_width;
+	int t_height = height / tile_height;
+	size_t tile_length = vera_packed_size(vals->tile_bpp, (size_t) tile_width * tile_height);
+	size_t tile_row_length = tile_length * t_width;
+
+	// deduplicating only holds one row of tiles in memory
+	strip = malloc((size_t) width * tile_height + 1);
+	tile_buf = malloc(tile_row_length + 1);
+
+	if (! strip || ! tile_buf)
+		ret = set_no_memory(error, "writing the tile set");
+
+	if (ret == 0 && has_map)
+	{
+		map_buf = malloc((size_t) t_width * entry_size + 1);
+
+		if (! map_buf)
+			ret = set_no_memory(error, "writing the tile map");
+	}
+
+	if (ret == 0 && dedup_tiles)
+	{
+		// 1bpp tile maps have no flip bits, and only an 8 bit tile index
+		dedup = vera_dedup_new(tile_width, tile_height, vals->tile_bpp != TILE_1BPP);
+		tile_pixels = malloc((size_t) tile_width * tile_height);
+
+		if (! dedup || ! tile_pixels)
+			ret = set_no_memory(error, "removing duplicate tiles");
+	}
+
+	if (ret == 0 && use_banks)
+	{
+		tile_colors = malloc(((size_t) t_width * t_height + 1) * sizeof(VeraColorSet));
+
+		if (tile_colors)
+			ret = assign_palette_banks(filename, image, vals,
+					t_width, t_height, strip, tile_pixels, tile_colors, &banks, artifacts, error);
+		else
+			ret = set_no_memory(error, "assigning palette banks");
+	}
+
+	if(ret == 0 && vals->file_header)
+	{
+		// 2 byte header
+		const uint8_t header[2] = { 0, 0 };
+		ret = vera_sink_write(&sink, header, 2, error);
+
+		if (ret == 0 && has_map)
+			ret = vera_sink_write(&map_sink, header, 2, error);
+	}
+
+	if (ret == 0 && ! dedup_tiles)
+	{
+		ret = write_tile_bands(&sink, image, vals, runner, error);
+
+		// every tile is its own sprite
+		for(int y = 0; ret == 0 && sprites && y < t_height; y++)
+		{
+			for(int x = 0; ret == 0 && x < t_width; x++)
+				ret = sprite_entry(map_buf + x * entry_size, y * t_width + x, 0, 0,
+						tile_length, vals, filename, error);
+
+			if (ret == 0)
+				ret = vera_sink_write(&map_sink, map_buf, (size_t) t_width * entry_size, error);
+		}
+	}
+
+	// deduplication depends on the tiles before, so it stays in order
+	for(int y = 0; ret == 0 && dedup_tiles && y < t_height; y++)
+	{
+		ret = read_index_strip(image, y * tile_height, tile_height, strip, error);
+		if (ret != 0)
+			break;
+
+		size_t unique_length = 0;
+
+		for(int x = 0; ret == 0 && x < t_width; x++)
+		{
+			uint8_t flip;
+			int added;
+			int tile;
+			int bank = 0;
+
+			copy_tile(strip, width, x, tile_width, tile_height, tile_pixels);
+
+			if (use_banks)
+			{
+				bank = vera_banks_find(&banks, &tile_colors[(size_t) y * t_width + x]);
+				vera_banks_remap(&banks, bank, tile_pixels, (size_t) tile_width * tile_height);
+			}
+
+			tile = vera_dedup_add(dedup, tile_pixels, &flip, &added);
+
+			if (tile < 0)
+			{
+				ret = set_no_memory(error, "removing duplicate tiles");
+				break;
+			}
+
+			if (! sprites && tile > (vals->tile_bpp == TILE_1BPP ? 255 : 1023))
+			{
+				vera_set_error(error, EINVAL,
+						"'%s' has more unique tiles than a VERA tile map can address",
+						filename);
+				ret = -1;
+				break;
+			}
+
+			if (added)
+			{
+				// tile rows are whole bytes, so a tile packs in one pass
+				packer.pack(tile_pixels, tile_buf + unique_length, (size_t) tile_width * tile_height);
+				unique_length += tile_length;
+			}
+
+			if (sprites)
+			{
+				ret = sprite_entry(map_buf + x * entry_size, tile, flip, bank,
+						tile_length, vals, filename, error);
+				continue;
+			}
+
+			vera_map_entry(map_buf + x * 2, tile, flip, bank);
+
+			// in 1bpp mode the second byte holds the colors: foreground 1 on background 0
+			if (vals->tile_bpp == TILE_1BPP)
+				map_buf[x * 2 + 1] = 0x01;
+		}
+
+		if (ret == 0)
+			ret = vera_sink_write(&sink, tile_buf, unique_length, error);
+
+		if (ret == 0)
+			ret = vera_sink_write(&map_sink, map_buf, (size_t) t_width * entry_size, error);
+	}
+
+	vera_dedup_free(dedup);
+	free(tile_colors);
+	free(map_buf);
+	free(tile_pixels);
+	free(tile_buf);
+	free(strip);
+
+	ret = close_vram_data(&sink, ret, tile_length, vals, artifacts, error);
+
+	if (has_map)
+		ret = close_binary(&map_sink, ret, vals, artifacts, error);
+
+	return ret;
+}
+
+size_t vera_bitmap_size(const VeraImage *image, const VeraSaveVals *vals)
+{
+	return vera_packed_size(vals->tile_bpp, (size_t) image->width * image->height);
+}
+
+int vera_pack_bitmap(const VeraImage *image,
+		const VeraSaveVals *vals,
+		uint8_t            *dst,
+		VeraError          *error)
+{
+	int width = image->width;
+	int height = image->height;
+	int strip_height = height < BITMAP_STRIP_HEIGHT ? height : BITMAP_STRIP_HEIGHT;
+	uint8_t *strip = malloc((size_t) width * strip_height + 1);
+	VeraPacker packer;
+	int ret = 0;
+
+	vera_packer_init(&packer, vals->tile_bpp, VERA_KERNEL_AUTO);
+
+	if (! strip)
+		return set_no_memory(error, "packing the bitmap");
+
+	// strips of a multiple of 8 rows always end on a byte boundary
+	for(int y = 0; ret == 0 && y < height; y += strip_height)
+	{
+		int rows = height - y < strip_height ? height - y : strip_height;
+
+		ret = read_index_strip(image, y, rows, strip, error);
+
+		if (ret == 0)
+		{
+			packer.pack(strip, dst, (size_t) width * rows);
+			dst += vera_packed_size(vals->tile_bpp, (size_t) width * rows);
+		}
+	}
+
+	free(strip);
+
+	return ret;
+}
+
+int vera_save_bitmap(const char *filename,
+		const VeraImage    *image,
+		const VeraSaveVals *vals,
+		VeraArtifacts      *artifacts,
+		VeraError          *error)
+{
+	uint8_t          *strip;
+	uint8_t          *bitmap_buf;
+	VeraSink          sink;
+	int               width, height;
+	int               ret = 0;
+
+	if (vera_sink_open(&sink, filename, stats_of(artifacts), error) != 0)
+		return -1;
+
+	/* get info about the current image */
+	width  = image->width;
+	height = image->height;
+
+	VeraPacker packer;
+	vera_packer_init(&packer, vals->tile_bpp, VERA_KERNEL_AUTO);
+
+	/*
+	 * The bitmap is one continuous run of pixels.  A strip height that is a
+	 * multiple of 8 always ends on a byte boundary, so each strip can be
+	 * packed and written on its own.
+	 */
+	int strip_height = height < BITMAP_STRIP_HEIGHT ? height : BITMAP_STRIP_HEIGHT;
+
+	strip = malloc((size_t) width * strip_height + 1);
+	bitmap_buf = malloc(vera_packed_size(vals->tile_bpp, (size_t) width * strip_height) + 1);
+
+	if (! strip || ! bitmap_buf)
+		ret = set_no_memory(error, "writing the bitmap");
+
+	if(ret == 0 && vals->file_header)
+	{
+		// 2 byte header
+		const uint8_t header[2] = { 0, 0 };
+		ret = vera_sink_write(&sink, header, 2, error);
+	}
+
+	for(int y = 0; ret == 0 && y < height; y += strip_height)
+	{
+		int rows = height - y < strip_height ? height - y : strip_height;
+		size_t pixels = (size_t) width * rows;
+
+		ret = read_index_strip(image, y, rows, strip, error);
+		if (ret != 0)
+			break;
+
+		packer.pack(strip, bitmap_buf, pixels);
+
+		ret = vera_sink_write(&sink, bitmap_buf, vera_packed_size(vals->tile_bpp, pixels), error);
+	}
+
+	free(bitmap_buf);
+	free(strip);
+
+	// a row, or eight when rows do not end on a byte boundary
+	size_t row_bits = (size_t) width * vals->tile_bpp;
+
+	return close_vram_data(&sink, ret, row_bits % 8 ? row_bits : row_bits / 8,
+			vals, artifacts, error);
+}
+
+typedef struct
+{
+	const VeraImage     *image;
+	const VeraSaveVals  *vals;
+	uint8_t             *data;
+	size_t               length;
+	uint64_t            *hashes;    /* delta frames: the hash of every tile */
+	const uint64_t      *previous;  /* and of every tile of the frame before */
+	size_t               entries;   /* tiles to upload */
+	VeraError            error;
+	int                  ret;
+} Frame;
+
+/* the bytes of one packed tile */
+static size_t tile_length(const VeraSaveVals *vals)
+{
+	return vera_packed_size(vals->tile_bpp, (size_t) vals->tile_width * vals->tile_height);
+}
+
+/* packs a frame into memory, every tile in order or the whole bitmap */
+static void pack_frame(void *data, int index)
+{
+	Frame *frame = (Frame *) data + index;
+	int tileset = frame->vals->export_type != BITMAP;
+
+	frame->length = tileset
+		? vera_tile_set_size(frame->image, frame->vals)
+		: vera_bitmap_size(frame->image, frame->vals);
+
+	frame->data = malloc(frame->length + 1);
+
+	// frames are already spread over the threads, so each packs on its own
+	if (! frame->data)
+		frame->ret = set_no_memory(&frame->error, "packing frames");
+	else if (tileset)
+		frame->ret = vera_pack_tile_set(frame->image, frame->vals, NULL, frame->data, &frame->error);
+	else
+		frame->ret = vera_pack_bitmap(frame->image, frame->vals, frame->data, &frame->error);
+
+	if (frame->ret == 0 && frame->vals->delta_frames && tileset)
+	{
+		size_t length = tile_length(frame->vals);
+
+		frame->entries = frame->length / length;
+		frame->hashes = malloc(frame->entries * sizeof(uint64_t) + 1);
+
+		if (frame->hashes)
+			vera_delta_hash(frame->data, frame->entries, length, frame->hashes);
+		else
+			frame->ret = set_no_memory(&frame->error, "hashing frames");
+	}
+}
+
+/* replaces a packed frame with the tiles that changed since the frame before */
+static void delta_frame(void *data, int index)
+{
+	Frame *frame = (Frame *) data + index + 1;
+	size_t length = tile_length(frame->vals);
+	size_t count = frame->entries;
+	size_t changed = vera_delta_changed(frame->hashes, frame->previous, count);
+	uint8_t *delta = malloc(2 + changed * (2 + length));
+
+	if (! delta)
+	{
+		frame->ret = set_no_memory(&frame->error, "writing delta frames");
+		return;
+	}
+
+	frame->length = vera_delta_encode(frame->data, frame->hashes, frame->previous, count,
+			length, delta);
+	frame->entries = changed;
+	free(frame->data);
+	frame->data = delta;
+}
+
+static int check_delta_frames(const char *filename,
+		const VeraImage    *images,
+		int                 count,
+		const VeraSaveVals *vals,
+		VeraError          *error)
+{
+	size_t tiles;
+
+	for(int i = 1; i < count; i++)
+	{
+		if (images[i].width != images[0].width || images[i].height != images[0].height)
+		{
+			vera_set_error(error, EINVAL,
+					"Delta frames of '%s' need the same size: frame %d is %dx%d, frame 0 is %dx%d",
+					filename, i, images[i].width, images[i].height,
+					images[0].width, images[0].height);
+			return -1;
+		}
+	}
+
+	// bitmaps are written as video
+	if (vals->export_type == BITMAP)
+	{
+		if (vals->compress)
+		{
+			vera_set_error(error, EINVAL, "Video is streamed as it is, it cannot be combined with compress");
+			return -1;
+		}
+
+		return 0;
+	}
+
+	// checked up front as well, so nothing is written when the upload list would fail
+	if (vals->vblank_bytes < 0 || (size_t) vals->vblank_bytes < tile_length(vals))
+	{
+		vera_set_error(error, EINVAL, "A %zu byte tile does not fit the %d bytes uploaded per vblank",
+				tile_length(vals), vals->vblank_bytes);
+		return -1;
+	}
+
+	tiles = (size_t) (images[0].width / vals->tile_width) * (images[0].height / vals->tile_height);
+
+	if (tiles > VERA_DELTA_MAX_TILES)
+	{
+		vera_set_error(error, EFBIG, "Delta frames of '%s' hold %zu tiles, more than %d",
+				filename, tiles, VERA_DELTA_MAX_TILES);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* writes the upload list of delta frames as filename.UPL */
+static int save_uploads(const char *filename,
+		const Frame        *frames,
+		int                 count,
+		const VeraSaveVals *vals,
+		VeraArtifacts      *artifacts,
+		VeraError          *error)
+{
+	size_t *entries = malloc(count * sizeof(size_t));
+	uint8_t *list;
+	size_t length;
+	int ret;
+
+	if (! entries)
+		return set_no_memory(error, "writing the upload list");
+
+	for(int i = 0; i < count; i++)
+		entries[i] = frames[i].entries;
+
+	ret = vera_delta_uploads(filename, entries, count, tile_length(vals), vals->vblank_bytes,
+			&list, &length, error);
+	free(entries);
+
+	if (ret == 0)
+	{
+		ret = save_binary(filename, ".UPL", list, length, vals, artifacts, error);
+		free(list);
+	}
+
+	return ret;
+}
+
+/* an atlas also records the size of every entry in its table */
+static int write_frames(const char *filename,
+		const Frame        *frames,
+		int                 count,
+		int                 atlas,
+		const VeraSaveVals *vals,
+		VeraArtifacts      *artifacts,
+		VeraError          *error)
+{
+	size_t entry_length = atlas ? 12 : 8;
+	size_t table_length = 2 + (size_t) count * entry_length;
+	uint8_t *table = malloc(table_length);
+	size_t offset = 0;
+	VeraSink sink;
+	int ret = 0;
+
+	if (! table)
+		return set_no_memory(error, "writing frames");
+
+	table[0] = count & 0xff;
+	table[1] = count >> 8;
+
+	for(int i = 0; i < count; i++)
+	{
+		uint8_t *entry = table + 2 + i * entry_length;
+
+		put_le32(entry, (uint32_t) offset);
+		put_le32(entry + 4, (uint32_t) frames[i].length);
+		offset += frames[i].length;
+
+		if (atlas)
+		{
+			entry[8] = frames[i].image->width & 0xff;
+			entry[9] = frames[i].image->width >> 8;
+			entry[10] = frames[i].image->height & 0xff;
+			entry[11] = frames[i].image->height >> 8;
+		}
+
+		if (offset > 0xffffffffu)
+		{
+			free(table);
+			vera_set_error(error, EFBIG, "'%s' would be larger than 4 GB", filename);
+			return -1;
+		}
+	}
+
+	if (vera_sink_open(&sink, filename, stats_of(artifacts), error) != 0)
+	{
+		free(table);
+		return -1;
+	}
+
+	if (vals->file_header)
+	{
+		// 2 byte header
+		const uint8_t header[2] = { 0, 0 };
+		ret = vera_sink_write(&sink, header, 2, error);
+	}
+
+	if (ret == 0)
+		ret = vera_sink_write(&sink, table, table_length, error);
+
+	for(int i = 0; ret == 0 && i < count; i++)
+		ret = vera_sink_write(&sink, frames[i].data, frames[i].length, error);
+
+	free(table);
+
+	return close_binary(&sink, ret, vals, artifacts, error);
+}
+
+typedef struct
+{
+	const Frame         *frame;
+	const Frame         *before;   /* the frame shown before, or NULL */
+	int                  colors;   /* palette entries the frame loads */
+	uint8_t             *data;
+	size_t               length;
+	VeraError            error;
+	int                  ret;
+} VideoFrame;
+
+/* whether the frame shows other colors than the one before */
+static int palette_changed(const VeraImage *image, const VeraImage *before)
+{
+	uint8_t a[256 * 2];
+	uint8_t b[256 * 2];
+
+	if (! before || ! before->cmap || image->palsize != before->palsize)
+		return 1;
+
+	vera_palette_pack(image->cmap, image->palsize, a);
+	vera_palette_pack(before->cmap, before->palsize, b);
+
+	return memcmp(a, b, (size_t) image->palsize * 2) != 0;
+}
+
+/* encodes a packed bitmap as its palette and the runs that changed */
+static void encode_video_frame(void *data, int index)
+{
+	VideoFrame *video = (VideoFrame *) data + index;
+	const Frame *frame = video->frame;
+	const uint8_t *before = video->before ? video->before->data : NULL;
+	size_t runs = vera_video_runs(before, frame->data, frame->length, NULL);
+	size_t palette = (size_t) video->colors * 2;
+	uint8_t *p;
+
+	video->length = 6 + palette + runs;
+	video->data = p = malloc(video->length);
+
+	if (! p)
+	{
+		video->ret = set_no_memory(&video->error, "encoding video");
+		return;
+	}
+
+	put_le32(p, (uint32_t) (video->length - 4));
+	p[4] = video->colors & 0xff;
+	p[5] = video->colors >> 8;
+	vera_palette_pack(frame->image->cmap, video->colors, p + 6);
+	vera_video_runs(before, frame->data, frame->length, p + 6 + palette);
+}
+
+/* lists the bytes of every frame, and whether it goes over vals->frame_bytes */
+static int save_video_report(const char *filename,
+		const VideoFrame   *video,
+		int                 count,
+		const VeraSaveVals *vals,
+		VeraArtifacts      *artifacts,
+		VeraError          *error)
+{
+	char *name = vera_concat(filename, ".csv");
+	char *report = malloc(64 + (size_t) count * 64);
+	size_t length = 0;
+	int ret;
+
+	if (! name || ! report)
+	{
+		free(report);
+		free(name);
+		return set_no_memory(error, "writing the video report");
+	}
+
+	length += sprintf(report, "frame,bytes,colors,over_budget\n");
+
+	for(int i = 0; i < count; i++)
+	{
+		length += sprintf(report + length, "%d,%zu,%d,%d\n", i, video[i].length, video[i].colors,
+				vals->frame_bytes > 0 && video[i].length > (size_t) vals->frame_bytes);
+	}
+
+	ret = vera_save_data(name, report, length, artifacts, error);
+
+	free(report);
+	free(name);
+
+	return ret;
+}
+
+/* writes packed bitmap frames as a video, see vera_video.h */
+static int save_video(const char *filename,
+		const Frame        *frames,
+		int                 count,
+		const VeraSaveVals *vals,
+		const VeraRunner   *runner,
+		VeraArtifacts      *artifacts,
+		VeraError          *error)
+{
+	const VeraImage *image = frames[0].image;
+	VideoFrame *video = calloc(count, sizeof(VideoFrame));
+	uint8_t header[2 + VERA_VIDEO_HEADER] = { 0 };
+	uint8_t *p = header;
+	VeraSink sink;
+	int ret = 0;
+
+	if (! video)
+		return set_no_memory(error, "encoding video");
+
+	for(int i = 0; i < count; i++)
+	{
+		const VeraImage *before = i ? frames[i - 1].image : NULL;
+
+		video[i].frame = &frames[i];
+		video[i].before = i ? &frames[i - 1] : NULL;
+
+		if (vals->frame_palettes && frames[i].image->cmap && palette_changed(frames[i].image, before))
+			video[i].colors = frames[i].image->palsize < 256 ? frames[i].image->palsize : 256;
+	}
+
+	vera_run_tasks(runner, encode_video_frame, video, count);
+
+	for(int i = 0; i < count && ret == 0; i++)
+	{
+		if (video[i].ret != 0)
+		{
+			if (error)
+				*error = video[i].error;
+			ret = -1;
+		}
+	}
+
+	if (vals->file_header)
+		p += 2;
+
+	p[0] = count & 0xff;
+	p[1] = count >> 8;
+	p[2] = image->width & 0xff;
+	p[3] = image->width >> 8;
+	p[4] = image->height & 0xff;
+	p[5] = image->height >> 8;
+	p[6] = vals->tile_bpp;
+
+	if (ret == 0)
+		ret = vera_sink_open(&sink, filename, stats_of(artifacts), error);
+
+	if (ret == 0)
+	{
+		ret = vera_sink_write(&sink, header, p + VERA_VIDEO_HEADER - header, error);
+
+		for(int i = 0; ret == 0 && i < count; i++)
+			ret = vera_sink_write(&sink, video[i].data, video[i].length, error);
+
+		ret = close_binary(&sink, ret, vals, artifacts, error);
+	}
+
+	if (ret == 0)
+		ret = save_video_report(filename, video, count, vals, artifacts, error);
+
+	for(int i = 0; i < count; i++)
+		free(video[i].data);
+
+	free(video);
+
+	return ret;
+}
+
+/* passes on the first error of the frames */
+static int frames_status(const Frame *frames, int count, VeraError *error)
+{
+	for(int i = 0; i < count; i++)
+	{
+		if (frames[i].ret != 0)
+		{
+			if (error)
+				*error = frames[i].error;
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int export_frame_files(const char *filename,
+		const VeraImage    *images,
+		int                 count,
+		int                 atlas,
+		const VeraSaveVals *vals,
+		const VeraRunner   *runner,
+		VeraArtifacts      *artifacts,
+		VeraError          *error)
+{
+	const char *kind = atlas ? "Region" : "Frame";
+	Frame *frames;
+	int ret = 0;
+
+	if (count < 1 || count > 0xffff)
+	{
+		vera_set_error(error, EINVAL, "'%s' needs between 1 and 65535 %ss, not %d",
+				filename, atlas ? "region" : "frame", count);
+		return -1;
+	}
+
+	if (check_sprites(filename, vals, error) != 0)
+		return -1;
+
+	if (vals->export_type != BITMAP && (vals->dedup_tiles || vera_use_palette_banks(vals)))
+	{
+		vera_set_error(error, EINVAL,
+				"%s export writes every tile, it cannot be combined with dedup-tiles or palette-banks",
+				kind);
+		return -1;
+	}
+
+	if (vals->patch_file)
+	{
+		vera_set_error(error, EINVAL, "%s export cannot be combined with patch-file", kind);
+		return -1;
+	}
+
+	if (vals->bank_split)
+	{
+		vera_set_error(error, EINVAL, "%s export cannot be combined with bank-split", kind);
+		return -1;
+	}
+
+	if (vals->delta_frames && atlas)
+	{
+		vera_set_error(error, EINVAL, "Region export cannot be combined with delta-frames");
+		return -1;
+	}
+
+	if (vals->delta_frames && check_delta_frames(filename, images, count, vals, error) != 0)
+		return -1;
+
+	if (images[0].cmap && vals->pal_file)
+		ret = vera_save_palette(filename, images[0].cmap, images[0].palsize, vals, artifacts, error);
+
+	if (ret != 0)
+		return ret;
+
+	frames = calloc(count, sizeof(Frame));
+	if (! frames)
+		return set_no_memory(error, "packing frames");
+
+	for(int i = 0; i < count; i++)
+	{
+		frames[i].image = &images[i];
+		frames[i].vals = vals;
+	}
+
+	vera_run_tasks(runner, pack_frame, frames, count);
+
+	ret = frames_status(frames, count, error);
+
+	if (ret == 0 && vals->delta_frames && vals->export_type == BITMAP)
+	{
+		ret = save_video(filename, frames, count, vals, runner, artifacts, error);
+	}
+	else if (ret == 0 && vals->delta_frames)
+	{
+		// every frame is hashed before any is replaced by its changes
+		for(int i = 1; i < count; i++)
+			frames[i].previous = frames[i - 1].hashes;
+
+		vera_run_tasks(runner, delta_frame, frames, count - 1);
+		ret = frames_status(frames, count, error);
+
+		if (ret == 0)
+			ret = write_frames(filename, frames, count, atlas, vals, artifacts, error);
+
+		if (ret == 0)
+			ret = save_uploads(filename, frames, count, vals, artifacts, error);
+	}
+	else if (ret == 0)
+	{
+		ret = write_frames(filename, frames, count, atlas, vals, artifacts, error);
+	}
+
+	for(int i = 0; i < count; i++)
+	{
+		free(frames[i].hashes);
+		free(frames[i].data);
+	}
+
+	free(frames);
+
+	return ret;
+}
+
+static int export_frames(const char *filename,
+		const VeraImage    *frames,
+		int                 count,
+		int                 atlas,
+		const VeraSaveVals *vals,
+		const VeraRunner   *runner,
+		VeraArtifacts      *artifacts,
+		VeraError          *error)
+{
+	VeraArtifacts own = { NULL, 0, 0 };
+	uint64_t fingerprint = VERA_HASH_SEED ^ (uint64_t) count;
+	int first;
+	int ret = 0;
+
+	if (atlas)
+		fingerprint = vera_hash_mix(fingerprint, atlas);
+
+	if (! vals->export_cache)
+		return export_frame_files(filename, frames, count, atlas, vals, runner, artifacts, error);
+
+	if (! artifacts)
+		artifacts = &own;
+
+	first = artifacts->count;
+
+	for(int i = 0; ret == 0 && i < count; i++)
+	{
+		uint64_t frame_fingerprint;
+
+		ret = vera_cache_fingerprint(filename, &frames[i], vals, &frame_fingerprint, error);
+		fingerprint = vera_hash_mix(fingerprint, frame_fingerprint);
+	}
+
+	if (ret == 0 && ! vera_cache_check(filename, fingerprint, artifacts))
+	{
+		ret = export_frame_files(filename, frames, count, atlas, vals, runner, artifacts, error);
+
+		if (ret == 0)
+			ret = vera_cache_write(filename, fingerprint,
+					artifacts->items + first, artifacts->count - first, error);
+		else
+			vera_cache_remove(filename);
+	}
+
+	vera_artifacts_clear(&own);
+
+	return ret;
+}
+
+int vera_export_frames(const char *filename,
+		const VeraImage    *frames,
+		int                 count,
+		const VeraSaveVals *vals,
+		const VeraRunner   *runner,
+		VeraArtifacts      *artifacts,
+		VeraError          *error)
+{
+	return export_frames(filename, frames, count, 0, vals, runner, artifacts, error);
+}
+
+int vera_export_atlas(const char *filename,
+		const VeraImage    *regions,
+		int                 count,
+		const VeraSaveVals *vals,
+		const VeraRunner   *runner,
+		VeraArtifacts      *artifacts,
+		VeraError          *error)
+{
+	return export_frames(filename, regions, count, 1, vals, runner, artifacts, error);
+}
+
+typedef struct
+{
+	const char           *filename;
+	const uint8_t        *cmap;
+	int                   palsize;
+	const VeraBmpPixels  *pixels;
+	VeraStats            *stats;
+	int                   skipped;
+	VeraError             error;
+	int                   ret;
+} BmpFile;
+
+static void write_bmp_file(void *data, int index)
+{
+	BmpFile *bmp = (BmpFile *) data + index;
+	VeraSink sink;
+
+	if (vera_sink_open(&sink, bmp->filename, bmp->stats, &bmp->error) != 0)
+	{
+		bmp->ret = -1;
+		return;
+	}
+
+	if (vera_bmp_write(sink.fp, bmp->pixels, bmp->cmap, bmp->palsize) != 0)
+	{
+		int errsv = errno ? errno : EIO;
+
+		vera_set_error(&bmp->error, errsv, "Could not write '%s': %s",
+				bmp->filename, strerror(errsv));
+		bmp->ret = -1;
+	}
+
+	bmp->ret = vera_sink_commit(&sink, bmp->ret, &bmp->skipped, &bmp->error);
+}
+
+/*
+ * The pixels are read and laid out once, and the files are written through
+ * runner, without touching the image colormap.
+ */
+int vera_save_bmp_files(const VeraImage *image,
+		const char * const    *filenames,
+		const uint8_t * const *cmaps,
+		int                    palsize,
+		int                    count,
+		const VeraRunner      *runner,
+		VeraArtifacts         *artifacts,
+		VeraError             *error)
+{
+	uint8_t          *indices;
+	VeraBmpPixels     pixels;
+	BmpFile          *bmps;
+	int               ret = 0;
+
+	if (count < 1)
+		return 0;
+
+	indices = malloc((size_t) image->width * image->height + 1);
+	if (! indices)
+		return set_no_memory(error, "writing BMP files");
+
+	if (read_index_strip(image, 0, image->height, indices, error) != 0)
+	{
+		free(indices);
+		return -1;
+	}
+
+	if (vera_bmp_pixels(&pixels, indices, image->width, image->height) != 0)
+	{
+		free(indices);
+		return set_no_memory(error, "writing BMP files");
+	}
+
+	free(indices);
+
+	bmps = calloc(count, sizeof(BmpFile));
+	if (! bmps)
+	{
+		vera_bmp_pixels_free(&pixels);
+		return set_no_memory(error, "writing BMP files");
+	}
+
+	for(int i = 0; i < count; i++)
+	{
+		bmps[i].filename = filenames[i];
+		bmps[i].cmap = cmaps[i];
+		bmps[i].palsize = palsize;
+		bmps[i].pixels = &pixels;
+		bmps[i].stats = stats_of(artifacts);
+	}
+
+	vera_run_tasks(runner, write_bmp_file, bmps, count);
+
+	for(int i = 0; i < count && ret == 0; i++)
+	{
+		if (bmps[i].ret != 0)
+		{
+			if (error)
+				*error = bmps[i].error;
+			ret = -1;
+		}
+		else if (artifacts && vera_artifacts_add(artifacts, bmps[i].filename, bmps[i].skipped) != 0)
+		{
+			ret = set_no_memory(error, "recording exported files");
+		}
+	}
+
+	free(bmps);
+	vera_bmp_pixels_free(&pixels);
+
+	return ret;
+}
+
+int vera_save_palette(const char *filename,
+		const uint8_t      *cmap,
+		int                 palsize,
+		const VeraSaveVals *vals,
+		VeraArtifacts      *artifacts,
+		VeraError          *error)
+{
+	VeraSink    sink;
+	uint8_t    *pal_buf;
+	char       *newfile;
+	int pal_buf_length = palsize * 2;
+	int pal_buf_index = 0; // start past the 2 byte header
+	int ret;
+
+	if(vals->file_header)
+	{
+		pal_buf_length += 2;
+		pal_buf_index += 2;
+	}
+
+	pal_buf = malloc(pal_buf_length + 1); // 2 bytes per color, 2 byte header
+	if (! pal_buf)
+		return set_no_memory(error, "writing the palette");
+
+	if(vals->file_header)
+	{
+		// 2 byte header
+		pal_buf[0] = 0;
+		pal_buf[1] = 0;
+	}
+
+
+	vera_palette_pack(cmap, palsize, pal_buf + pal_buf_index);
+
+	/* we have colormap too, write it into filename+PAL.BIN */
+	newfile = vera_concat(filename, ".PAL");
+
+	if (newfile)
+		ret = vera_sink_open(&sink, newfile, stats_of(artifacts), error);
+	else
+		ret = set_no_memory(error, "writing the palette");
+
+	free(newfile);
+
+	if (ret != 0)
+	{
+		free(pal_buf);
+		return -1;
+	}
+
+	ret = vera_sink_write(&sink, pal_buf, pal_buf_length, error);
+	ret = close_binary(&sink, ret, vals, artifacts, error);
+
+	free(pal_buf);
+
+	return ret;
+}
@@ -0,0 +1,330 @@
+#ifndef VERA_EXPORT_H
+#define VERA_EXPORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "vera_stats.h"
+
+/*
+ * The VERA exporters: tile sets, bitmaps, palettes and the Tiled files that
+ * go with them.  Nothing here knows about GIMP; the plugin, the vera-export
+ * command line tool and vera-bench all describe their image with a
+ * VeraImage and hand it to vera_export, or to the packers to get the data
+ * in memory.  make libvera.a builds these modules as a static library.
+ */
+
+typedef enum
+{
+	TILESET = 0,
+	BITMAP = 1,
+	SPRITE = 2
+} VeraExport;
+
+typedef enum
+{
+	TILE_1BPP = 1,
+	TILE_2BPP = 2,
+	TILE_4BPP = 4,
+	TILE_8BPP = 8
+} TileBpp;
+
+typedef enum
+{
+	TILE_WIDTH_8 = 8,
+	TILE_WIDTH_16 = 16,
+	TILE_WIDTH_32 = 32,
+	TILE_WIDTH_64 = 64
+} TileWidth;
+
+typedef enum
+{
+	TILE_HEIGHT_8 = 8,
+	TILE_HEIGHT_16 = 16,
+	TILE_HEIGHT_32 = 32,
+	TILE_HEIGHT_64 = 64
+} TileHeight;
+
+typedef enum
+{
+	DITHER_NONE = 0,
+	DITHER_FLOYD_STEINBERG = 1,
+	DITHER_ATKINSON = 2,
+	DITHER_BAYER_4 = 3,
+	DITHER_BAYER_8 = 4
+} VeraDither;
+
+typedef struct
+{
+	int            file_header;
+	VeraExport     export_type;	 /* tileset, bitmap or sprites */
+	TileBpp        tile_bpp;     /* Bits per pixel format for tiles */
+	TileWidth      tile_width;
+	TileHeight     tile_height;
+	int            tiled_file;
+	int            bmp_file;
+	int            pal_file;
+	int            dedup_tiles;  /* write unique tiles only, plus a tile map */
+	int            palette_banks; /* pack 2/4bpp tile colors into 16 color banks */
+	int            export_cache; /* skip the export when its inputs are unchanged */
+	int            frames;       /* export every visible layer as one frame */
+	int            vram_address; /* where sprites are loaded, for their attributes */
+	int            compress;     /* LZSA2 compress the VERA binaries */
+	VeraDither     dither;       /* how RGB images are dithered onto the palette */
+	int            dither_tiles; /* keep the error diffusion inside each tile */
+	int            patch_file;   /* write a VRAM patch of what changed since the last export */
+	int            delta_frames; /* frames after the first only hold the tiles that changed */
+	int            vblank_bytes; /* tile bytes a delta frame player uploads per vblank */
+	int            frame_palettes; /* video: frames load their palette when it changes */
+	int            frame_bytes;  /* video: the bytes a frame may take to stream in time, or 0 */
+	int            bank_split;   /* cut the data into 8 KB banks: 1 a file each, 2 one file */
+	int            split_tiles;  /* fill every bank, even if a tile or row is cut in two */
+	int            first_bank;   /* the banked RAM bank of the first chunk */
+} VeraSaveVals;
+
+extern const VeraSaveVals vera_default_vals;
+
+/*
+ * An indexed image.  read_rows fills dst with rows [y, y + rows) as one
+ * color index per pixel, width bytes per row, and returns 0 on success.  It
+ * may be called from several threads at once.  With remap set, every index
+ * read is replaced by its entry there before it is packed.  A tile set can
+ * carry a collision mask of the same size, where any nonzero index is solid.
+ */
+typedef struct VeraImage VeraImage;
+
+struct VeraImage
+{
+	int             width;
+	int             height;
+	const uint8_t  *cmap;      /* palsize RGB triples, or NULL */
+	int             palsize;
+	const uint8_t  *remap;     /* 256 indices into cmap, or NULL */
+	const VeraImage *collision; /* mask written with the tile set, or NULL */
+	int           (*read_rows) (const VeraImage *image, int y, int rows, uint8_t *dst);
+	void           *user_data;
+};
+
+typedef struct
+{
+	int   code;                /* an errno value */
+	char  message[512];
+} VeraError;
+
+/*
+ * The files an export produced.  A file whose contents would not change is
+ * left alone, keeping its modification time, and is marked as skipped.
+ */
+typedef struct
+{
+	char      *filename;
+	int        skipped;
+	long long  size;
+	long long  mtime;
+} VeraArtifact;
+
+typedef struct
+{
+	VeraArtifact  *items;
+	int            count;
+	int            capacity;
+	VeraStats     *stats;     /* times and counts the export, or NULL */
+} VeraArtifacts;
+
+/* runs func (data, i) for every i in [0, count), in any order or thread */
+typedef void (*VeraTaskFunc) (void *data, int index);
+
+typedef struct
+{
+	void (*run) (void *user_data, VeraTaskFunc func, void *data, int count);
+	void  *user_data;
+} VeraRunner;
+
+void vera_set_error(VeraError *error, int code, const char *format, ...)
+	__attribute__((format(printf, 3, 4)));
+
+/* returns a malloc'ed copy of a followed by b, or NULL when out of memory */
+char *vera_concat(const char *a, const char *b);
+
+/* describes width * height indices held in memory; pixels must outlive image */
+void vera_image_from_indices(VeraImage *image,
+		const uint8_t *pixels,
+		int            width,
+		int            height,
+		const uint8_t *cmap,
+		int            palsize);
+
+/* runs tasks through runner, or one after the other when runner is NULL */
+void vera_run_tasks(const VeraRunner *runner, VeraTaskFunc func, void *data, int count);
+
+/* records filename with its current size and modification time */
+int vera_artifacts_add(VeraArtifacts *artifacts, const char *filename, int skipped);
+
+void vera_artifacts_clear(VeraArtifacts *artifacts);
+
+/*
+ * Writes every file an export produces: the palette, the BMP and Tiled
+ * files that go with a tile set, and the tile set or bitmap itself.  All of
+ * these return 0 on success, or -1 with error set, and add the files they
+ * wrote to artifacts unless it is NULL.
+ */
+int vera_export(const char *filename,
+		const VeraImage    *image,
+		const VeraSaveVals *vals,
+		const VeraRunner   *runner,
+		VeraArtifacts      *artifacts,
+		VeraError          *error);
+
+/*
+ * Writes count images, a tile set or a bitmap each, as the frames of one
+ * file, after a table of where each frame starts:
+ *
+ *   [2 byte header] u16 count, count * { u32 offset, u32 length }, frames
+ *
+ * Values are little endian and offsets count from the end of the table.
+ * Frames are packed in parallel through runner, and the file does not depend
+ * on how many threads run.  Every tile of a frame is written, so
+ * dedup-tiles and palette-banks do not apply, and the palette is taken
+ * from the first frame.
+ *
+ * With delta-frames, the frames are tile sets of the same size and only the
+ * first is written whole; the others hold the tiles that changed since the
+ * frame before, as vera_delta.h lays out, and filename.UPL lists what to
+ * upload in each vblank.  Bitmap frames are written as a video instead, as
+ * vera_video.h lays out, and filename.csv lists the bytes of every frame
+ * against frame-bytes.
+ */
+int vera_export_frames(const char *filename,
+		const VeraImage    *frames,
+		int                 count,
+		const VeraSaveVals *vals,
+		const VeraRunner   *runner,
+		VeraArtifacts      *artifacts,
+		VeraError          *error);
+
+/*
+ * Writes count regions of an image, each cut out as an image of its own, as
+ * the entries of one atlas file.  It is packed like vera_export_frames, but
+ * every table entry also holds the size of its region in pixels:
+ *
+ *   [2 byte header] u16 count,
+ *                   count * { u32 offset, u32 length, u16 width, u16 height },
+ *                   regions
+ */
+int vera_export_atlas(const char *filename,
+		const VeraImage    *regions,
+		int                 count,
+		const VeraSaveVals *vals,
+		const VeraRunner   *runner,
+		VeraArtifacts      *artifacts,
+		VeraError          *error);
+
+/* the bytes vera_pack_tile_set writes: every whole tile of the image */
+size_t vera_tile_set_size(const VeraImage *image, const VeraSaveVals *vals);
+
+/*
+ * Packs every tile of image in order into dst, without deduplication,
+ * palette banks or a header.  Bands of tile rows run in parallel through
+ * runner.  Returns 0, or -1 with error set.
+ */
+int vera_pack_tile_set(const VeraImage *image,
+		const VeraSaveVals *vals,
+		const VeraRunner   *runner,
+		uint8_t            *dst,
+		VeraError          *error);
+
+/* the bytes vera_pack_bitmap writes */
+size_t vera_bitmap_size(const VeraImage *image, const VeraSaveVals *vals);
+
+/* packs image as one bitmap into dst.  Returns 0, or -1 with error set. */
+int vera_pack_bitmap(const VeraImage *image,
+		const VeraSaveVals *vals,
+		uint8_t            *dst,
+		VeraError          *error);
+
+/*
+ * Without dedup-tiles or palette-banks, every tile is written in order and
+ * bands of tile rows are packed in parallel through runner.
+ */
+int vera_save_tile_set(const char *filename,
+		const VeraImage    *image,
+		const VeraSaveVals *vals,
+		const VeraRunner   *runner,
+		VeraArtifacts      *artifacts,
+		VeraError          *error);
+
+int vera_save_bitmap(const char *filename,
+		const VeraImage    *image,
+		const VeraSaveVals *vals,
+		VeraArtifacts      *artifacts,
+		VeraError          *error);
+
+/* collision holds the VeraCollision of every tile, or is NULL */
+int vera_save_tsx(const char *filename,
+		const char         *bmp_filename,
+		const VeraImage    *image,
+		const uint8_t      *collision,
+		const VeraSaveVals *vals,
+		VeraArtifacts      *artifacts,
+		VeraError          *error);
+
+typedef enum
+{
+	VERA_COLLISION_EMPTY = 0,
+	VERA_COLLISION_SOLID = 1,
+	VERA_COLLISION_PARTIAL = 2
+} VeraCollision;
+
+/*
+ * Writes the collision mask of image, one entry per tile of the image in
+ * row order, the same order as the tile set, its tile map and the Tiled
+ * tile ids:
+ *
+ *   filename.MASK   [2 byte header] one bit per pixel, each tile packed like
+ *                   a 1 bpp tile, solid pixels set
+ *   filename.COL    [2 byte header] one VeraCollision byte per tile
+ *
+ * *tiles receives a malloc'ed copy of the .COL bytes.
+ */
+int vera_save_collision(const char *filename,
+		const VeraImage    *image,
+		const VeraSaveVals *vals,
+		const VeraRunner   *runner,
+		uint8_t           **tiles,
+		VeraArtifacts      *artifacts,
+		VeraError          *error);
+
+int vera_save_palette(const char *filename,
+		const uint8_t      *cmap,
+		int                 palsize,
+		const VeraSaveVals *vals,
+		VeraArtifacts      *artifacts,
+		VeraError          *error);
+
+/* writes length bytes of data as filename, like every other export file */
+int vera_save_data(const char *filename,
+		const void         *data,
+		size_t              length,
+		VeraArtifacts      *artifacts,
+		VeraError          *error);
+
+/* writes the image as count BMP files that only differ in their palette */
+int vera_save_bmp_files(const VeraImage *image,
+		const char * const    *filenames,
+		const uint8_t * const *cmaps,
+		int                    palsize,
+		int                    count,
+		const VeraRunner      *runner,
+		VeraArtifacts         *artifacts,
+		VeraError             *error);
+
+/* rotates cmap down by offset colors into shifted, both palsize colors */
+void vera_shift_color_map(const uint8_t *orig,
+		uint8_t *shifted,
+		int      palsize,
+		int      offset);
+
+/* whether a tile set or sprite export chooses 16 color palette banks per tile */
+int vera_use_palette_banks(const VeraSaveVals *vals);
+
+#endif
@@ -0,0 +1,28 @@
+#include "vera_hash.h"
+
+#include <string.h>
+
+uint64_t vera_hash_bytes(uint64_t seed, const void *data, size_t size)
+{
+	const uint8_t *bytes = data;
+	uint64_t h = seed ^ size;
+	size_t i = 0;
+
+	for(; i + 8 <= size; i += 8)
+	{
+		uint64_t word;
+
+		memcpy(&word, bytes + i, 8);
+		h = (h ^ word) * 0xff51afd7ed558ccdull;
+		h ^= h >> 32;
+	}
+
+	for(; i < size; i++)
+		h = (h ^ bytes[i]) * 0x100000001b3ull;
+
+	h ^= h >> 29;
+	h *= 0xc4ceb9fe1a85ec53ull;
+	h ^= h >> 32;
+
+	return h;
+}
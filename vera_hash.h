@@ -0,0 +1,26 @@
+#ifndef VERA_HASH_H
+#define VERA_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A fast 64-bit hash for tiles, image strips and whole outputs.  It is not
+ * cryptographic; it only has to tell apart data that is meant to differ.
+ * Hashing a long run of data in pieces gives a different, but equally
+ * stable, result than hashing it in one go, so callers always split it the
+ * same way.
+ */
+
+#define VERA_HASH_SEED  0x9e3779b97f4a7c15ull
+
+uint64_t vera_hash_bytes(uint64_t seed, const void *data, size_t size);
+
+/* folds value into a running hash */
+static inline uint64_t vera_hash_mix(uint64_t hash, uint64_t value)
+{
+	hash = (hash ^ value) * 0xff51afd7ed558ccdull;
+	return hash ^ (hash >> 32);
+}
+
+#endif
@@ -0,0 +1,554 @@
+#include "vera_load.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <png.h>
+
+#include "vera_dither.h"
+
+#define BMP_FILE_HEADER_SIZE  14
+#define PCX_HEADER_SIZE       128
+
+static uint16_t get_le16(const uint8_t *p)
+{
+	return p[0] | p[1] << 8;
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+static int bad_file(VeraError *error, const char *filename, const char *why)
+{
+	vera_set_error(error, EINVAL, "'%s' %s", filename, why);
+	return -1;
+}
+
+static int alloc_pixels(VeraIndexedImage *image, int width, int height, const char *filename, VeraError *error)
+{
+	// tile and bitmap sizes are ints, so keep well clear of overflow
+	if (width <= 0 || height <= 0 || width > 65535 || height > 65535)
+		return bad_file(error, filename, "has an unsupported size");
+
+	image->width = width;
+	image->height = height;
+	image->pixels = calloc((size_t) width * height, 1);
+
+	if (! image->pixels)
+	{
+		vera_set_error(error, ENOMEM, "Out of memory loading '%s'", filename);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int read_file(const char *filename, uint8_t **data, size_t *size, VeraError *error)
+{
+	FILE *fp = fopen(filename, "rb");
+	long length;
+
+	if (! fp)
+	{
+		vera_set_error(error, errno, "Could not open '%s': %s", filename, strerror(errno));
+		return -1;
+	}
+
+	if (fseek(fp, 0, SEEK_END) != 0 || (length = ftell(fp)) < 0 || fseek(fp, 0, SEEK_SET) != 0)
+	{
+		vera_set_error(error, errno, "Could not read '%s': %s", filename, strerror(errno));
+		fclose(fp);
+		return -1;
+	}
+
+	*size = length;
+	*data = malloc(*size + 1);
+
+	if (! *data)
+	{
+		vera_set_error(error, ENOMEM, "Out of memory loading '%s'", filename);
+		fclose(fp);
+		return -1;
+	}
+
+	if (*size && fread(*data, *size, 1, fp) != 1)
+	{
+		vera_set_error(error, EIO, "Could not read '%s'", filename);
+		free(*data);
+		fclose(fp);
+		return -1;
+	}
+
+	fclose(fp);
+
+	return 0;
+}
+
+static int load_png(const char *filename,
+		const uint8_t      *target,
+		int                 target_size,
+		const VeraSaveVals *vals,
+		VeraIndexedImage   *image,
+		VeraError          *error)
+{
+	png_structp png;
+	png_infop info;
+	png_colorp palette;
+	png_bytep * volatile rows = NULL;
+	uint8_t * volatile rgba = NULL;
+	VeraDitherer dither;
+	png_uint_32 width, height;
+	int bit_depth, color_type, num_palette;
+	int indexed;
+	int alpha = 0;
+	FILE *fp = fopen(filename, "rb");
+
+	if (! fp)
+	{
+		vera_set_error(error, errno, "Could not open '%s': %s", filename, strerror(errno));
+		return -1;
+	}
+
+	png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+	info = png ? png_create_info_struct(png) : NULL;
+
+	if (! info)
+	{
+		png_destroy_read_struct(&png, NULL, NULL);
+		fclose(fp);
+		vera_set_error(error, ENOMEM, "Out of memory loading '%s'", filename);
+		return -1;
+	}
+
+	if (setjmp(png_jmpbuf(png)))
+	{
+		png_destroy_read_struct(&png, &info, NULL);
+		free(rows);
+		free(rgba);
+		fclose(fp);
+		vera_indexed_image_free(image);
+		return bad_file(error, filename, "is not a valid PNG file");
+	}
+
+	png_init_io(png, fp);
+	png_read_info(png, info);
+	png_get_IHDR(png, info, &width, &height, &bit_depth, &color_type, NULL, NULL, NULL);
+
+	indexed = color_type == PNG_COLOR_TYPE_PALETTE;
+
+	if (indexed && ! png_get_PLTE(png, info, &palette, &num_palette))
+	{
+		png_destroy_read_struct(&png, &info, NULL);
+		fclose(fp);
+		return bad_file(error, filename, "is an indexed PNG without a palette");
+	}
+
+	if (! indexed && ! target)
+	{
+		png_destroy_read_struct(&png, &info, NULL);
+		fclose(fp);
+		return bad_file(error, filename,
+				"is not an indexed PNG, give --palette to map its colors to a VERA palette");
+	}
+
+	if (indexed)
+	{
+		// one byte per index, whatever the stored depth
+		if (bit_depth < 8)
+			png_set_packing(png);
+	}
+	else
+	{
+		// any other PNG is read as 8-bit RGBA
+		alpha = (color_type & PNG_COLOR_MASK_ALPHA) || png_get_valid(png, info, PNG_INFO_tRNS);
+
+		png_set_expand(png);
+		png_set_strip_16(png);
+		png_set_gray_to_rgb(png);
+		png_set_filler(png, 0xff, PNG_FILLER_AFTER);
+	}
+
+	png_read_update_info(png, info);
+
+	if (alloc_pixels(image, width, height, filename, error) != 0)
+	{
+		png_destroy_read_struct(&png, &info, NULL);
+		fclose(fp);
+		return -1;
+	}
+
+	image->palsize = indexed ? num_palette : target_size;
+	for(int i = 0; i < image->palsize; i++)
+	{
+		image->cmap[i * 3] = indexed ? palette[i].red : target[i * 3];
+		image->cmap[i * 3 + 1] = indexed ? palette[i].green : target[i * 3 + 1];
+		image->cmap[i * 3 + 2] = indexed ? palette[i].blue : target[i * 3 + 2];
+	}
+
+	if (! indexed)
+	{
+		rgba = malloc((size_t) width * height * 4);
+		if (! rgba)
+			png_error(png, "out of memory");
+	}
+
+	rows = malloc(height * sizeof(png_bytep));
+	if (! rows)
+		png_error(png, "out of memory");
+
+	for(png_uint_32 y = 0; y < height; y++)
+		rows[y] = indexed ? image->pixels + (size_t) y * width : rgba + (size_t) y * width * 4;
+
+	png_read_image(png, rows);
+	png_read_end(png, NULL);
+
+	free(rows);
+	png_destroy_read_struct(&png, &info, NULL);
+	fclose(fp);
+
+	if (! indexed)
+	{
+		if (vera_dither_init(&dither, target, target_size, alpha, vals, width) != 0)
+		{
+			vera_dither_free(&dither);
+			free(rgba);
+			vera_indexed_image_free(image);
+			vera_set_error(error, ENOMEM, "Out of memory loading '%s'", filename);
+			return -1;
+		}
+
+		vera_dither_rows(&dither, rgba, 4, height, image->pixels);
+		vera_dither_free(&dither);
+		free(rgba);
+	}
+
+	return 0;
+}
+
+/* decodes RLE8 (bits 8) or RLE4 (bits 4) pixel data into bottom-up rows */
+static int decode_bmp_rle(const uint8_t *src, size_t size, int bits, VeraIndexedImage *image)
+{
+	size_t i = 0;
+	int x = 0;
+	int y = 0;
+
+	while (i + 1 < size)
+	{
+		int count = src[i];
+		int value = src[i + 1];
+
+		i += 2;
+
+		if (count > 0)
+		{
+			// an encoded run, alternating nibbles in RLE4
+			for(int n = 0; n < count && x < image->width; n++, x++)
+			{
+				int index = bits == 8 ? value : (n & 1 ? value & 0x0f : value >> 4);
+
+				if (y < image->height)
+					image->pixels[(size_t) y * image->width + x] = index;
+			}
+			continue;
+		}
+
+		switch (value)
+		{
+			case 0: // end of line
+				x = 0;
+				y++;
+				break;
+			case 1: // end of bitmap
+				return 0;
+			case 2: // delta
+				if (i + 1 >= size)
+					return -1;
+				x += src[i];
+				y += src[i + 1];
+				i += 2;
+				break;
+			default: // an absolute run of value pixels, padded to 16 bits
+			{
+				size_t bytes = bits == 8 ? (size_t) value : ((size_t) value + 1) / 2;
+
+				if (i + bytes > size)
+					return -1;
+
+				for(int n = 0; n < value; n++, x++)
+				{
+					int index = bits == 8 ? src[i + n] : (n & 1 ? src[i + n / 2] & 0x0f : src[i + n / 2] >> 4);
+
+					if (x < image->width && y < image->height)
+						image->pixels[(size_t) y * image->width + x] = index;
+				}
+
+				i += (bytes + 1) & ~(size_t) 1;
+				break;
+			}
+		}
+	}
+
+	return 0;
+}
+
+static int load_bmp(const char *filename, const uint8_t *data, size_t size,
+		VeraIndexedImage *image, VeraError *error)
+{
+	const uint8_t *info = data + BMP_FILE_HEADER_SIZE;
+	uint32_t offset, info_size, compression, colors;
+	int32_t width, height;
+	int bits, top_down;
+
+	if (size < BMP_FILE_HEADER_SIZE + 40)
+		return bad_file(error, filename, "is not a valid BMP file");
+
+	offset = get_le32(data + 10);
+	info_size = get_le32(info);
+	width = (int32_t) get_le32(info + 4);
+	height = (int32_t) get_le32(info + 8);
+	bits = get_le16(info + 14);
+	compression = get_le32(info + 16);
+	colors = get_le32(info + 32);
+
+	if (info_size < 40 || offset > size)
+		return bad_file(error, filename, "is not a valid BMP file");
+
+	if (bits != 1 && bits != 4 && bits != 8)
+		return bad_file(error, filename, "is not an indexed BMP, VERA export requires an indexed image");
+
+	if (! (compression == 0 || (compression == 1 && bits == 8) || (compression == 2 && bits == 4)))
+		return bad_file(error, filename, "uses an unsupported BMP compression");
+
+	top_down = height < 0;
+	if (top_down)
+		height = -height;
+
+	if (alloc_pixels(image, width, height, filename, error) != 0)
+		return -1;
+
+	if (colors == 0 || colors > (1u << bits))
+		colors = 1u << bits;
+
+	// the palette follows the info header as BGR0 entries
+	if (BMP_FILE_HEADER_SIZE + (size_t) info_size + (size_t) colors * 4 > size)
+	{
+		vera_indexed_image_free(image);
+		return bad_file(error, filename, "is not a valid BMP file");
+	}
+
+	image->palsize = colors;
+	for(uint32_t i = 0; i < colors; i++)
+	{
+		const uint8_t *entry = info + info_size + i * 4;
+
+		image->cmap[i * 3] = entry[2];
+		image->cmap[i * 3 + 1] = entry[1];
+		image->cmap[i * 3 + 2] = entry[0];
+	}
+
+	if (compression)
+	{
+		if (decode_bmp_rle(data + offset, size - offset, bits, image) != 0)
+		{
+			vera_indexed_image_free(image);
+			return bad_file(error, filename, "has corrupt RLE data");
+		}
+	}
+	else
+	{
+		size_t stride = (((size_t) width * bits + 31) / 32) * 4;
+
+		if (offset + stride * height > size)
+		{
+			vera_indexed_image_free(image);
+			return bad_file(error, filename, "is truncated");
+		}
+
+		for(int y = 0; y < height; y++)
+		{
+			const uint8_t *row = data + offset + stride * y;
+			uint8_t *dst = image->pixels + (size_t) y * width;
+
+			for(int x = 0; x < width; x++)
+			{
+				int shift = 8 - bits - (x * bits) % 8;
+
+				dst[x] = (row[x * bits / 8] >> shift) & ((1 << bits) - 1);
+			}
+		}
+	}
+
+	// rows were read bottom-up; flip them into place
+	if (! top_down)
+	{
+		uint8_t *tmp = malloc(width);
+
+		if (! tmp)
+		{
+			vera_indexed_image_free(image);
+			vera_set_error(error, ENOMEM, "Out of memory loading '%s'", filename);
+			return -1;
+		}
+
+		for(int y = 0; y < height / 2; y++)
+		{
+			uint8_t *a = image->pixels + (size_t) y * width;
+			uint8_t *b = image->pixels + (size_t) (height - 1 - y) * width;
+
+			memcpy(tmp, a, width);
+			memcpy(a, b, width);
+			memcpy(b, tmp, width);
+		}
+
+		free(tmp);
+	}
+
+	return 0;
+}
+
+static int load_pcx(const char *filename, const uint8_t *data, size_t size,
+		VeraIndexedImage *image, VeraError *error)
+{
+	int bits, planes, bytes_per_line, width, height;
+	size_t line_length, pos = PCX_HEADER_SIZE;
+	uint8_t *line;
+
+	if (size < PCX_HEADER_SIZE || data[2] != 1)
+		return bad_file(error, filename, "is not a valid PCX file");
+
+	bits = data[3];
+	planes = data[65];
+	bytes_per_line = get_le16(data + 66);
+	width = get_le16(data + 8) - get_le16(data + 4) + 1;
+	height = get_le16(data + 10) - get_le16(data + 6) + 1;
+
+	// 8 bit and packed 1/2/4 bit images have one plane, EGA style ones 1 bit planes
+	if (! ((bits == 8 && planes == 1)
+				|| ((bits == 2 || bits == 4) && planes == 1)
+				|| (bits == 1 && planes >= 1 && planes <= 4)))
+		return bad_file(error, filename, "is not an indexed PCX, VERA export requires an indexed image");
+
+	if (bytes_per_line * 8 < width * bits)
+		return bad_file(error, filename, "is not a valid PCX file");
+
+	if (alloc_pixels(image, width, height, filename, error) != 0)
+		return -1;
+
+	if (bits == 8)
+	{
+		// the 256 color palette is appended to the image data
+		if (size < PCX_HEADER_SIZE + 769 || data[size - 769] != 0x0c)
+		{
+			vera_indexed_image_free(image);
+			return bad_file(error, filename, "has no 256 color palette");
+		}
+
+		memcpy(image->cmap, data + size - 768, 768);
+		image->palsize = 256;
+		size -= 769;
+	}
+	else
+	{
+		memcpy(image->cmap, data + 16, 48);
+		image->palsize = 1 << (bits * planes);
+	}
+
+	line_length = (size_t) bytes_per_line * planes;
+	line = malloc(line_length);
+
+	if (! line)
+	{
+		vera_indexed_image_free(image);
+		vera_set_error(error, ENOMEM, "Out of memory loading '%s'", filename);
+		return -1;
+	}
+
+	for(int y = 0; y < height; y++)
+	{
+		uint8_t *dst = image->pixels + (size_t) y * width;
+		size_t n = 0;
+
+		// runs are marked by the top two bits of a count byte
+		while (n < line_length && pos < size)
+		{
+			uint8_t b = data[pos++];
+			size_t count = 1;
+
+			if ((b & 0xc0) == 0xc0 && pos < size)
+			{
+				count = b & 0x3f;
+				b = data[pos++];
+			}
+
+			for(; count && n < line_length; count--)
+				line[n++] = b;
+		}
+
+		for(int x = 0; x < width; x++)
+		{
+			int index = 0;
+
+			if (bits == 8)
+				index = line[x];
+			else if (planes == 1)
+				index = (line[x * bits / 8] >> (8 - bits - (x * bits) % 8)) & ((1 << bits) - 1);
+			else
+			{
+				for(int p = 0; p < planes; p++)
+					index |= ((line[p * bytes_per_line + x / 8] >> (7 - x % 8)) & 1) << p;
+			}
+
+			dst[x] = index;
+		}
+	}
+
+	free(line);
+
+	return 0;
+}
+
+int vera_load_indexed(const char *filename,
+		const uint8_t      *target,
+		int                 target_size,
+		const VeraSaveVals *vals,
+		VeraIndexedImage   *image,
+		VeraError          *error)
+{
+	static const uint8_t png_signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	uint8_t *data;
+	size_t size;
+	int ret;
+
+	memset(image, 0, sizeof(VeraIndexedImage));
+
+	if (read_file(filename, &data, &size, error) != 0)
+		return -1;
+
+	if (size >= 8 && memcmp(data, png_signature, 8) == 0)
+	{
+		// libpng reads the file itself
+		free(data);
+		return load_png(filename, target, target_size, vals, image, error);
+	}
+
+	if (size >= 2 && data[0] == 'B' && data[1] == 'M')
+		ret = load_bmp(filename, data, size, image, error);
+	else if (size >= 1 && data[0] == 0x0a)
+		ret = load_pcx(filename, data, size, image, error);
+	else
+		ret = bad_file(error, filename, "is not a PNG, BMP or PCX image");
+
+	free(data);
+
+	return ret;
+}
+
+void vera_indexed_image_free(VeraIndexedImage *image)
+{
+	free(image->pixels);
+	image->pixels = NULL;
+}
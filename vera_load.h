@@ -0,0 +1,39 @@
+#ifndef VERA_LOAD_H
+#define VERA_LOAD_H
+
+#include <stdint.h>
+
+#include "vera_export.h"
+
+/*
+ * Readers for the image formats vera-export takes as input: palette PNG,
+ * 1/4/8-bit BMP (uncompressed or RLE) and PCX, plus RGB, RGBA and gray PNG
+ * mapped to a target palette.  The format is told from the contents, not
+ * the file name.
+ */
+
+typedef struct
+{
+	int       width;
+	int       height;
+	uint8_t  *pixels;            /* width * height color indices, top row first */
+	uint8_t   cmap[256 * 3];
+	int       palsize;
+} VeraIndexedImage;
+
+/*
+ * Loads filename, mapping the colors of a PNG that is not indexed to the
+ * nearest of target_size RGB triples in target, which then become its
+ * colormap, dithered as vals asks.  Without a target such images are
+ * refused.  Returns 0 on success, or -1 with error set.
+ */
+int vera_load_indexed(const char *filename,
+		const uint8_t      *target,
+		int                 target_size,
+		const VeraSaveVals *vals,
+		VeraIndexedImage   *image,
+		VeraError          *error);
+
+void vera_indexed_image_free(VeraIndexedImage *image);
+
+#endif
@@ -0,0 +1,101 @@
+#include "vera_lut.h"
+
+void vera_lut_init(VeraColorLut *lut, const uint8_t *cmap, int palsize, int transparent)
+{
+	uint8_t colors[256][3];
+	int first = transparent && palsize > 1 ? 1 : 0;
+
+	lut->transparent = transparent;
+
+	for(int i = 0; i < palsize; i++)
+	{
+		for(int c = 0; c < 3; c++)
+			colors[i][c] = vera_color_4bit(cmap[i * 3 + c]);
+	}
+
+	for(int key = 0; key < VERA_LUT_SIZE; key++)
+	{
+		int r = key >> 8;
+		int g = (key >> 4) & 0x0f;
+		int b = key & 0x0f;
+		int best = first;
+		int best_distance = 1 << 30;
+
+		for(int i = first; i < palsize; i++)
+		{
+			int dr = r - colors[i][0];
+			int dg = g - colors[i][1];
+			int db = b - colors[i][2];
+			int distance = dr * dr + dg * dg + db * db;
+
+			if (distance < best_distance)
+			{
+				best = i;
+				best_distance = distance;
+
+				if (distance == 0)
+					break;
+			}
+		}
+
+		lut->index[key] = best;
+	}
+}
+
+void vera_lut_map(const VeraColorLut *lut,
+		const uint8_t *pixels,
+		int            channels,
+		size_t         count,
+		uint8_t       *dst)
+{
+	// dst never gets ahead of the pixel being read, so it can share the buffer
+	for(size_t i = 0; i < count; i++, pixels += channels)
+	{
+		if (channels == 4 && lut->transparent && pixels[3] < 128)
+			dst[i] = 0;
+		else
+			dst[i] = lut->index[vera_color_key(pixels[0], pixels[1], pixels[2])];
+	}
+}
+
+int vera_palette_parse(const uint8_t *data, size_t length, int file_header, uint8_t *cmap)
+{
+	int palsize;
+
+	if (file_header)
+	{
+		if (length < 2)
+			return -1;
+
+		data += 2;
+		length -= 2;
+	}
+
+	if (length == 0 || length % 2 || length > 256 * 2)
+		return -1;
+
+	palsize = length / 2;
+
+	// GB in the first byte, R in the low nibble of the second
+	for(int i = 0; i < palsize; i++)
+	{
+		cmap[i * 3] = (data[i * 2 + 1] & 0x0f) * 17;
+		cmap[i * 3 + 1] = (data[i * 2] >> 4) * 17;
+		cmap[i * 3 + 2] = (data[i * 2] & 0x0f) * 17;
+	}
+
+	return palsize;
+}
+
+void vera_palette_pack(const uint8_t *cmap, int palsize, uint8_t *dst)
+{
+	for(int i = 0; i < palsize; i++)
+	{
+		int r = vera_color_4bit(cmap[i * 3]);
+		int g = vera_color_4bit(cmap[i * 3 + 1]);
+		int b = vera_color_4bit(cmap[i * 3 + 2]);
+
+		dst[i * 2] = g << 4 | b;
+		dst[i * 2 + 1] = r;
+	}
+}
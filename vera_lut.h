@@ -0,0 +1,60 @@
+#ifndef VERA_LUT_H
+#define VERA_LUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * RGB to palette index conversion.  The VERA only shows 12-bit color, so
+ * every RGB color falls into one of 4096 buckets, and a table holding the
+ * nearest palette entry of each bucket maps a pixel with a single lookup.
+ * Colors are reduced to 4 bits per channel the same way the .PAL writer
+ * does, so a color that is in the palette always maps to its own entry.
+ */
+
+#define VERA_LUT_SIZE  4096
+
+typedef struct
+{
+	uint8_t  index[VERA_LUT_SIZE];
+	int      transparent;       /* alpha below 128 maps to 0, which nothing else does */
+} VeraColorLut;
+
+/* an 8-bit channel as the VERA's 4 bits */
+static inline int vera_color_4bit(int c)
+{
+	return (c * 15 + 135) >> 8;
+}
+
+static inline int vera_color_key(int r, int g, int b)
+{
+	return vera_color_4bit(r) << 8 | vera_color_4bit(g) << 4 | vera_color_4bit(b);
+}
+
+/*
+ * Fills the table from palsize RGB triples.  With transparent set, entry 0
+ * is kept for transparent pixels.  Ties go to the lower index.
+ */
+void vera_lut_init(VeraColorLut *lut, const uint8_t *cmap, int palsize, int transparent);
+
+/*
+ * Maps count RGB (channels 3) or RGBA (channels 4) pixels to indices.  dst
+ * may be the same buffer as pixels.
+ */
+void vera_lut_map(const VeraColorLut *lut,
+		const uint8_t *pixels,
+		int            channels,
+		size_t         count,
+		uint8_t       *dst);
+
+/*
+ * Reads a .PAL file of length bytes, as written with or without the 2 byte
+ * header, into cmap, which holds 256 RGB triples.  Returns the number of
+ * colors, or -1 if length does not fit a palette.
+ */
+int vera_palette_parse(const uint8_t *data, size_t length, int file_header, uint8_t *cmap);
+
+/* packs palsize RGB triples into dst, 2 bytes per color as a .PAL file holds them */
+void vera_palette_pack(const uint8_t *cmap, int palsize, uint8_t *dst);
+
+#endif
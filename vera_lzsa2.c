@@ -0,0 +1,636 @@
+#include "vera_lzsa2.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define MIN_MATCH         2
+#define MAX_LENGTH        65535     /* literals or match bytes in one command */
+#define MAX_OFFSET        65535
+#define HASH_BITS         15
+#define MAX_CHAIN         128       /* match candidates looked at per position */
+#define MAX_MATCHES       32
+#define ALL_LENGTHS       256       /* up to here every match length is tried */
+#define LONG_MATCH        1024      /* taken as it is, without parsing inside it */
+#define EOD_MARKER        232
+
+#define INFINITE_COST     INT64_MAX
+
+typedef struct
+{
+	int  offset;
+	int  length;
+} Match;
+
+/* how position i is reached: literals from `from`, then a match ending at i */
+typedef struct
+{
+	int64_t  cost;              /* in bits */
+	int      from;
+	int      offset;
+	int      length;
+	int      rep;               /* offset of the match ending here, for repeats */
+} Arrival;
+
+/* sliding window minimum of arrival costs, for one band of literal run lengths */
+typedef struct
+{
+	int  *items;
+	int   head;
+	int   tail;
+	int   min_run;
+	int   max_run;
+	int   extra_bits;
+} Window;
+
+static int match_extra_bits(int length)
+{
+	if (length < 9)
+		return 0;
+	if (length < 24)
+		return 4;
+	if (length < 256)
+		return 12;
+	return 28;
+}
+
+static int offset_bits(int offset)
+{
+	if (offset <= 32)
+		return 4;
+	if (offset <= 512)
+		return 8;
+	if (offset <= 8192 + 512)
+		return 12;
+	return 16;
+}
+
+static int match_length(const uint8_t *src, size_t length, size_t pos, int offset)
+{
+	size_t max = length - pos < MAX_LENGTH ? length - pos : MAX_LENGTH;
+	size_t n = 0;
+
+	while (n < max && src[pos + n] == src[pos + n - offset])
+		n++;
+
+	return (int) n;
+}
+
+static uint32_t hash3(const uint8_t *p)
+{
+	return ((uint32_t) p[0] << 16 | p[1] << 8 | p[2]) * 2654435761u >> (32 - HASH_BITS);
+}
+
+/*
+ * Collects the matches at pos, each longer than the one before it and at
+ * the nearest offset that reaches its length, since nearer offsets never
+ * cost more bits.
+ */
+static int find_matches(const uint8_t *src,
+		size_t         length,
+		size_t         pos,
+		const int     *prev,
+		int            head,
+		Match         *matches)
+{
+	int count = 0;
+	int best = MIN_MATCH - 1;
+
+	// two byte matches only pay off at short offsets, which are cheap to try
+	for(int offset = 1; offset <= 32 && (size_t) offset <= pos; offset++)
+	{
+		int n = match_length(src, length, pos, offset);
+
+		if (n > best && count < MAX_MATCHES)
+		{
+			matches[count].offset = offset;
+			matches[count++].length = best = n;
+		}
+	}
+
+	for(int chain = 0, candidate = head; candidate >= 0 && chain < MAX_CHAIN;
+			chain++, candidate = prev[candidate])
+	{
+		int offset = (int) pos - candidate;
+		int n;
+
+		if (offset > MAX_OFFSET || pos + best >= length)
+			break;
+
+		if (offset <= 32 || src[candidate + best] != src[pos + best])
+			continue;
+
+		n = match_length(src, length, pos, offset);
+
+		if (n > best && count < MAX_MATCHES)
+		{
+			matches[count].offset = offset;
+			matches[count++].length = best = n;
+
+			if (n >= LONG_MATCH)
+				break;
+		}
+	}
+
+	return count;
+}
+
+static void window_push(Window *window, const Arrival *arrivals, int pos)
+{
+	int64_t key = arrivals[pos].cost - 8 * (int64_t) pos;
+
+	while (window->tail > window->head
+			&& arrivals[window->items[window->tail - 1]].cost
+				- 8 * (int64_t) window->items[window->tail - 1] >= key)
+		window->tail--;
+
+	window->items[window->tail++] = pos;
+}
+
+static void relax(Arrival *arrivals, int from, int64_t cost, int pos, int offset, int length)
+{
+	Arrival *arrival = &arrivals[pos + length];
+
+	if (cost < arrival->cost)
+	{
+		arrival->cost = cost;
+		arrival->from = from;
+		arrival->offset = offset;
+		arrival->length = length;
+		arrival->rep = offset;
+	}
+}
+
+typedef struct
+{
+	uint8_t  *data;
+	size_t    length;
+	size_t    nibble;           /* byte holding a pending low nibble, or SIZE_MAX */
+} Writer;
+
+static void put_byte(Writer *writer, uint8_t value)
+{
+	writer->data[writer->length++] = value;
+}
+
+static void put_nibble(Writer *writer, int value)
+{
+	if (writer->nibble == SIZE_MAX)
+	{
+		writer->nibble = writer->length;
+		put_byte(writer, value << 4);
+	}
+	else
+	{
+		writer->data[writer->nibble] |= value & 0x0f;
+		writer->nibble = SIZE_MAX;
+	}
+}
+
+static void put_literal_count(Writer *writer, int count)
+{
+	if (count < 3)
+		return;
+
+	if (count < 18)
+	{
+		put_nibble(writer, count - 3);
+	}
+	else if (count < 256)
+	{
+		put_nibble(writer, 15);
+		put_byte(writer, count - 18);
+	}
+	else
+	{
+		put_nibble(writer, 15);
+		put_byte(writer, 239);
+		put_byte(writer, count & 0xff);
+		put_byte(writer, count >> 8);
+	}
+}
+
+static void put_match_length(Writer *writer, int length)
+{
+	if (length < 9)
+		return;
+
+	if (length < 24)
+	{
+		put_nibble(writer, length - 9);
+	}
+	else if (length < 256)
+	{
+		put_nibble(writer, 15);
+		put_byte(writer, length - 24);
+	}
+	else
+	{
+		put_nibble(writer, 15);
+		put_byte(writer, 233);
+		put_byte(writer, length & 0xff);
+		put_byte(writer, length >> 8);
+	}
+}
+
+/* writes one command; offset 0 marks the end of data */
+static void put_command(Writer *writer,
+		const uint8_t *literals,
+		int            count,
+		int            offset,
+		int            length,
+		int            previous_offset)
+{
+	uint16_t negative = (uint16_t) -offset;
+	uint8_t token = (count < 3 ? count : 3) << 3;
+
+	if (offset == 0)
+		token |= 0xe0 | 7;
+	else
+		token |= length - MIN_MATCH < 7 ? length - MIN_MATCH : 7;
+
+	// the Z bit is stored inverted
+	if (offset == 0 || offset == previous_offset)
+		token |= 0xe0;
+	else if (offset <= 32)
+		token |= 0x00 | ((negative & 0x01) << 5 ^ 0x20);
+	else if (offset <= 512)
+		token |= 0x40 | ((negative & 0x100) >> 3 ^ 0x20);
+	else if (offset <= 8192 + 512)
+		token |= 0x80 | (((uint16_t) (negative + 512) & 0x100) >> 3 ^ 0x20);
+	else
+		token |= 0xc0;
+
+	put_byte(writer, token);
+	put_literal_count(writer, count);
+	memcpy(writer->data + writer->length, literals, count);
+	writer->length += count;
+
+	if (offset == 0)
+	{
+		put_nibble(writer, 15);
+		put_byte(writer, EOD_MARKER);
+		return;
+	}
+
+	if (offset != previous_offset)
+	{
+		if (offset <= 32)
+		{
+			put_nibble(writer, (negative & 0x1e) >> 1);
+		}
+		else if (offset <= 512)
+		{
+			put_byte(writer, negative & 0xff);
+		}
+		else if (offset <= 8192 + 512)
+		{
+			uint16_t value = negative + 512;
+
+			put_nibble(writer, (value >> 9) & 0x0f);
+			put_byte(writer, value & 0xff);
+		}
+		else
+		{
+			put_byte(writer, negative >> 8);
+			put_byte(writer, negative & 0xff);
+		}
+	}
+
+	put_match_length(writer, length);
+}
+
+int vera_lzsa2_compress(const uint8_t *src, size_t length, uint8_t **dst, size_t *dst_length)
+{
+	int n = (int) length;
+	Arrival *arrivals = NULL;
+	int *prev = NULL;
+	int *heads = NULL;
+	int *window_items = NULL;
+	int *path = NULL;
+	Window windows[4] =
+	{
+		{ NULL, 0, 0, 0, 2, 0 },
+		{ NULL, 0, 0, 3, 17, 4 },
+		{ NULL, 0, 0, 18, 255, 12 },
+		{ NULL, 0, 0, 256, MAX_LENGTH, 28 }
+	};
+	Match matches[MAX_MATCHES];
+	Writer writer = { NULL, 0, SIZE_MAX };
+	int skip_until = 0;
+	int ret = -1;
+	int end_from = -1;
+	int64_t end_cost = INFINITE_COST;
+	int commands = 0;
+	int literal_start = 0;
+	int previous_offset = 0;
+
+	if (length > (size_t) INT32_MAX / 2)
+		return -1;
+
+	arrivals = malloc((n + 1) * sizeof(Arrival));
+	prev = malloc((n + 1) * sizeof(int));
+	heads = malloc(((size_t) 1 << HASH_BITS) * sizeof(int));
+	window_items = malloc(4 * (size_t) (n + 1) * sizeof(int));
+	path = malloc((n + 1) * sizeof(int));
+
+	// worst case: one literal run split by the fewest matches, plus the marker
+	writer.data = malloc(length + length / 32 + 16);
+
+	if (! arrivals || ! prev || ! heads || ! window_items || ! path || ! writer.data)
+		goto out;
+
+	for(int i = 0; i < 4; i++)
+		windows[i].items = window_items + (size_t) i * (n + 1);
+
+	memset(heads, 0xff, ((size_t) 1 << HASH_BITS) * sizeof(int));
+
+	for(int i = 0; i <= n; i++)
+		arrivals[i].cost = INFINITE_COST;
+
+	arrivals[0].cost = 0;
+	arrivals[0].from = -1;
+	arrivals[0].rep = 0;
+
+	for(int pos = 0; pos <= n; pos++)
+	{
+		int64_t cost = INFINITE_COST;
+		int from = -1;
+		int match_count = 0;
+		int head = -1;
+		int rep;
+
+		// the arrivals whose literal runs now reach pos enter their windows
+		for(int i = 0; i < 4; i++)
+		{
+			Window *window = &windows[i];
+			int entering = pos - window->min_run;
+
+			if (entering >= 0 && arrivals[entering].cost != INFINITE_COST)
+				window_push(window, arrivals, entering);
+
+			while (window->tail > window->head && window->items[window->head] < pos - window->max_run)
+				window->head++;
+
+			if (window->tail > window->head)
+			{
+				int start = window->items[window->head];
+				int64_t c = arrivals[start].cost + 8 * (int64_t) (pos - start) + window->extra_bits;
+
+				if (c < cost)
+				{
+					cost = c;
+					from = start;
+				}
+			}
+		}
+
+		if (pos == n)
+		{
+			end_cost = cost;
+			end_from = from;
+			break;
+		}
+
+		if (pos + 3 <= n)
+		{
+			uint32_t hash = hash3(src + pos);
+
+			head = heads[hash];
+			prev[pos] = head;
+			heads[hash] = pos;
+		}
+		else
+		{
+			prev[pos] = -1;
+		}
+
+		if (from < 0 || pos < skip_until)
+			continue;
+
+		// 8 bits of token for the command ending in a match here
+		cost += 8;
+
+		rep = arrivals[from].rep;
+
+		if (rep > 0 && rep <= pos)
+		{
+			int longest = match_length(src, length, pos, rep);
+
+			for(int len = MIN_MATCH; len <= longest; len++)
+			{
+				if (len > ALL_LENGTHS && len != longest)
+					continue;
+
+				relax(arrivals, from, cost + match_extra_bits(len), pos, rep, len);
+			}
+		}
+
+		match_count = find_matches(src, length, pos, prev, head, matches);
+
+		for(int m = 0, shortest = MIN_MATCH; m < match_count; m++)
+		{
+			int offset = matches[m].offset;
+			int longest = matches[m].length;
+
+			for(int len = shortest; len <= longest; len++)
+			{
+				if (len > ALL_LENGTHS && len != longest)
+					continue;
+
+				relax(arrivals, from, cost + offset_bits(offset) + match_extra_bits(len),
+						pos, offset, len);
+			}
+
+			shortest = longest + 1;
+
+			if (longest >= LONG_MATCH)
+				skip_until = pos + longest;
+		}
+	}
+
+	if (end_from < 0 || end_cost == INFINITE_COST)
+		goto out;
+
+	// walk back from the end to find the commands
+
+	for(int pos = end_from; pos > 0; pos = arrivals[pos].from)
+		path[commands++] = pos;
+
+	for(int c = commands - 1; c >= 0; c--)
+	{
+		const Arrival *arrival = &arrivals[path[c]];
+		int match_start = path[c] - arrival->length;
+
+		put_command(&writer, src + literal_start, match_start - literal_start,
+				arrival->offset, arrival->length, previous_offset);
+
+		previous_offset = arrival->offset;
+		literal_start = path[c];
+	}
+
+	put_command(&writer, src + literal_start, n - literal_start, 0, 0, previous_offset);
+
+	*dst = writer.data;
+	*dst_length = writer.length;
+	writer.data = NULL;
+	ret = 0;
+
+out:
+	free(writer.data);
+	free(path);
+	free(window_items);
+	free(heads);
+	free(prev);
+	free(arrivals);
+
+	return ret;
+}
+
+typedef struct
+{
+	const uint8_t  *data;
+	size_t          length;
+	size_t          pos;
+	int             pending;    /* low nibble still to read, or -1 */
+	int             error;
+} Reader;
+
+static int get_byte(Reader *reader)
+{
+	if (reader->pos >= reader->length)
+	{
+		reader->error = 1;
+		return 0;
+	}
+
+	return reader->data[reader->pos++];
+}
+
+static int get_nibble(Reader *reader)
+{
+	int value;
+
+	if (reader->pending >= 0)
+	{
+		value = reader->pending;
+		reader->pending = -1;
+		return value;
+	}
+
+	value = get_byte(reader);
+	reader->pending = value & 0x0f;
+
+	return value >> 4;
+}
+
+int vera_lzsa2_decompress(const uint8_t *src,
+		size_t   src_length,
+		uint8_t *dst,
+		size_t   capacity,
+		size_t  *dst_length)
+{
+	Reader reader = { src, src_length, 0, -1, 0 };
+	size_t out = 0;
+	size_t offset = 0;
+
+	while (! reader.error)
+	{
+		int token = get_byte(&reader);
+		size_t count = (token >> 3) & 0x03;
+		size_t length = token & 0x07;
+
+		if (count == 3)
+		{
+			count += get_nibble(&reader);
+
+			if (count == 18)
+			{
+				count += get_byte(&reader);
+
+				if (count == 257)
+				{
+					count = get_byte(&reader);
+					count |= get_byte(&reader) << 8;
+				}
+			}
+		}
+
+		if (reader.error || count > src_length - reader.pos || count > capacity - out)
+			return -1;
+
+		memcpy(dst + out, src + reader.pos, count);
+		reader.pos += count;
+		out += count;
+
+		// the Z bit is stored inverted
+		int z = ((token >> 5) & 1) ^ 1;
+		uint16_t negative;
+
+		switch (token >> 5)
+		{
+			case 0:
+			case 1:
+				negative = 0xffe0 | get_nibble(&reader) << 1 | z;
+				offset = 0x10000 - negative;
+				break;
+			case 2:
+			case 3:
+				negative = 0xfe00 | z << 8 | get_byte(&reader);
+				offset = 0x10000 - negative;
+				break;
+			case 4:
+			case 5:
+				negative = 0xe000 | get_nibble(&reader) << 9 | z << 8;
+				negative |= get_byte(&reader);
+				offset = 0x10000 - negative + 512;
+				break;
+			case 6:
+				negative = get_byte(&reader) << 8;
+				negative |= get_byte(&reader);
+				offset = 0x10000 - negative;
+				break;
+			default:
+				// repeat the previous offset
+				break;
+		}
+
+		length += MIN_MATCH;
+
+		if (length == 9)
+		{
+			length += get_nibble(&reader);
+
+			if (length == 24)
+			{
+				int value = get_byte(&reader);
+
+				if (value == EOD_MARKER)
+					break;
+
+				if (value == 233)
+				{
+					length = get_byte(&reader);
+					length |= get_byte(&reader) << 8;
+				}
+				else
+				{
+					length += value;
+				}
+			}
+		}
+
+		if (reader.error || offset == 0 || offset > out || length > capacity - out)
+			return -1;
+
+		// copied a byte at a time, as matches may overlap what they write
+		for(size_t i = 0; i < length; i++, out++)
+			dst[out] = dst[out - offset];
+	}
+
+	if (reader.error)
+		return -1;
+
+	*dst_length = out;
+
+	return 0;
+}
@@ -0,0 +1,36 @@
+#ifndef VERA_LZSA2_H
+#define VERA_LZSA2_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * LZSA2 compression, in the raw block format the Commander X16 kernal's
+ * memory_decompress routine reads: a sequence of commands, each a token
+ * followed by literals and a match, ending with the end of data marker.
+ *
+ * The encoder does an optimal parse: for every position it knows the
+ * cheapest way, in bits, to reach it through literal runs, matches at any
+ * offset the match finder saw and repeats of the previous offset, and
+ * picks the cheapest path through the whole input.
+ */
+
+/*
+ * Compresses length bytes of src into a new buffer returned in *dst.
+ * Returns 0, or -1 when out of memory or when more than 65535 bytes in a
+ * row have no match to break them up, which a raw block cannot hold.
+ */
+int vera_lzsa2_compress(const uint8_t *src, size_t length, uint8_t **dst, size_t *dst_length);
+
+/*
+ * Decompresses a raw block of src_length bytes into dst, which holds
+ * capacity bytes, setting *dst_length.  Returns 0, or -1 if the block is
+ * malformed or does not fit.
+ */
+int vera_lzsa2_decompress(const uint8_t *src,
+		size_t   src_length,
+		uint8_t *dst,
+		size_t   capacity,
+		size_t  *dst_length);
+
+#endif
@@ -0,0 +1,128 @@
+/*
+ * vera-lzsa2-test: round trips vera_lzsa2_compress through
+ * vera_lzsa2_decompress.
+ *
+ * Covers empty input, input with nothing to match, long runs and a mix of
+ * both, and checks that more than 65535 bytes in a row without a match fail
+ * to compress as vera_lzsa2.h says.  Prints each failing case and exits
+ * non-zero if there was one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vera_lzsa2.h"
+
+// the longest literal run a raw block holds
+#define MAX_LITERALS  65535
+
+static int failures;
+
+static void fail(const char *name, const char *what)
+{
+	printf("FAIL %s: %s\n", name, what);
+	failures++;
+}
+
+static void round_trip(const char *name, const uint8_t *src, size_t length)
+{
+	uint8_t *packed = NULL;
+	uint8_t *check = malloc(length + 1);
+	size_t packed_length = 0;
+	size_t check_length = 0;
+
+	if (! check)
+	{
+		fail(name, "out of memory");
+		return;
+	}
+
+	if (vera_lzsa2_compress(src, length, &packed, &packed_length) != 0)
+		fail(name, "did not compress");
+	else if (vera_lzsa2_decompress(packed, packed_length, check, length, &check_length) != 0)
+		fail(name, "did not decompress");
+	else if (check_length != length || memcmp(check, src, length) != 0)
+		fail(name, "decompressed to different data");
+	else
+		printf("ok %s: %zu -> %zu bytes\n", name, length, packed_length);
+
+	free(packed);
+	free(check);
+}
+
+/*
+ * Writes the 65537 bytes in which every pair of bytes appears once, so no
+ * match of the 2 bytes LZSA2 needs at least can be found.
+ */
+static size_t unmatched_bytes(uint8_t *dst)
+{
+	size_t n = 0;
+
+	for(int a = 0; a < 256; a++)
+	{
+		dst[n++] = a;
+
+		for(int b = a + 1; b < 256; b++)
+		{
+			dst[n++] = a;
+			dst[n++] = b;
+		}
+	}
+
+	dst[n++] = 0;
+
+	return n;
+}
+
+int main(void)
+{
+	size_t length = 256 * 1024;
+	uint8_t *data = malloc(length);
+	uint8_t *packed = NULL;
+	size_t packed_length = 0;
+	size_t unmatched;
+
+	if (! data)
+	{
+		printf("FAIL: out of memory\n");
+		return 1;
+	}
+
+	round_trip("empty", (const uint8_t *) "", 0);
+
+	unmatched = unmatched_bytes(data);
+	round_trip("incompressible", data, MAX_LITERALS);
+
+	if (vera_lzsa2_compress(data, unmatched, &packed, &packed_length) == 0)
+		fail("unmatched", "more than 65535 unmatched bytes compressed");
+	else
+		printf("ok unmatched: %zu bytes refused\n", unmatched);
+
+	free(packed);
+
+	srand(1);
+	for(size_t i = 0; i < length; i++)
+		data[i] = rand();
+
+	round_trip("random", data, length);
+
+	memset(data, 0x5a, length);
+	round_trip("run", data, length);
+
+	// runs of every length up to 300 between bytes that do not repeat
+	for(size_t i = 0, run = 1; i < length; run = run % 300 + 1)
+	{
+		for(size_t j = 0; j < run && i < length; j++)
+			data[i++] = run & 0xff;
+
+		if (i < length)
+			data[i++] = rand();
+	}
+
+	round_trip("runs", data, length);
+
+	free(data);
+
+	return failures ? 1 : 0;
+}
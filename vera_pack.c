@@ -0,0 +1,351 @@
+#include "vera_pack.h"
+
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define VERA_PACK_X86 1
+#include <immintrin.h>
+#endif
+
+/*
+ * Scalar kernels.  These are the portable fallback and also finish off the
+ * pixels left over after the vector kernels run out of whole blocks.
+ */
+
+static void pack_1bpp_scalar(const uint8_t *src, uint8_t *dst, size_t count)
+{
+	size_t i = 0;
+
+	for(; i + 8 <= count; i += 8)
+	{
+		*dst++ = (src[i] & 1) << 7 | (src[i+1] & 1) << 6
+			| (src[i+2] & 1) << 5 | (src[i+3] & 1) << 4
+			| (src[i+4] & 1) << 3 | (src[i+5] & 1) << 2
+			| (src[i+6] & 1) << 1 | (src[i+7] & 1);
+	}
+
+	if (i < count)
+	{
+		uint8_t byte = 0;
+
+		for(int shift = 7; i < count; i++, shift--)
+			byte |= (src[i] & 1) << shift;
+
+		*dst = byte;
+	}
+}
+
+static void pack_2bpp_scalar(const uint8_t *src, uint8_t *dst, size_t count)
+{
+	size_t i = 0;
+
+	for(; i + 4 <= count; i += 4)
+	{
+		*dst++ = (src[i] & 3) << 6 | (src[i+1] & 3) << 4
+			| (src[i+2] & 3) << 2 | (src[i+3] & 3);
+	}
+
+	if (i < count)
+	{
+		uint8_t byte = 0;
+
+		for(int shift = 6; i < count; i++, shift -= 2)
+			byte |= (src[i] & 3) << shift;
+
+		*dst = byte;
+	}
+}
+
+static void pack_4bpp_scalar(const uint8_t *src, uint8_t *dst, size_t count)
+{
+	size_t i = 0;
+
+	for(; i + 2 <= count; i += 2)
+		*dst++ = (src[i] & 0x0f) << 4 | (src[i+1] & 0x0f);
+
+	if (i < count)
+		*dst = (src[i] & 0x0f) << 4;
+}
+
+static void pack_8bpp(const uint8_t *src, uint8_t *dst, size_t count)
+{
+	memcpy(dst, src, count);
+}
+
+#ifdef VERA_PACK_X86
+
+/*
+ * The vector kernels are all built from one step: take two registers of
+ * bytes and combine each even/odd pair into (even << shift) | odd, halving
+ * the data.  4bpp is one step, 2bpp two and 1bpp three.
+ */
+
+__attribute__((target("sse2")))
+static inline __m128i pair_sse2(__m128i a, __m128i b, int shift)
+{
+	const __m128i low = _mm_set1_epi16(0x00ff);
+	const __m128i count = _mm_cvtsi32_si128(shift);
+
+	a = _mm_or_si128(_mm_sll_epi16(_mm_and_si128(a, low), count), _mm_srli_epi16(a, 8));
+	b = _mm_or_si128(_mm_sll_epi16(_mm_and_si128(b, low), count), _mm_srli_epi16(b, 8));
+
+	return _mm_packus_epi16(a, b);
+}
+
+__attribute__((target("sse2")))
+static inline __m128i load_sse2(const uint8_t *src, __m128i mask)
+{
+	return _mm_and_si128(_mm_loadu_si128((const __m128i *) src), mask);
+}
+
+// 128 pixels -> 16 bytes
+__attribute__((target("sse2")))
+static void pack_1bpp_sse2(const uint8_t *src, uint8_t *dst, size_t count)
+{
+	const __m128i mask = _mm_set1_epi8(0x01);
+	size_t i = 0;
+
+	for(; i + 128 <= count; i += 128, dst += 16)
+	{
+		const uint8_t *s = src + i;
+		__m128i p0 = pair_sse2(load_sse2(s, mask), load_sse2(s + 16, mask), 1);
+		__m128i p1 = pair_sse2(load_sse2(s + 32, mask), load_sse2(s + 48, mask), 1);
+		__m128i p2 = pair_sse2(load_sse2(s + 64, mask), load_sse2(s + 80, mask), 1);
+		__m128i p3 = pair_sse2(load_sse2(s + 96, mask), load_sse2(s + 112, mask), 1);
+
+		p0 = pair_sse2(p0, p1, 2);
+		p2 = pair_sse2(p2, p3, 2);
+		_mm_storeu_si128((__m128i *) dst, pair_sse2(p0, p2, 4));
+	}
+
+	pack_1bpp_scalar(src + i, dst, count - i);
+}
+
+// 64 pixels -> 16 bytes
+__attribute__((target("sse2")))
+static void pack_2bpp_sse2(const uint8_t *src, uint8_t *dst, size_t count)
+{
+	const __m128i mask = _mm_set1_epi8(0x03);
+	size_t i = 0;
+
+	for(; i + 64 <= count; i += 64, dst += 16)
+	{
+		const uint8_t *s = src + i;
+		__m128i p0 = pair_sse2(load_sse2(s, mask), load_sse2(s + 16, mask), 2);
+		__m128i p1 = pair_sse2(load_sse2(s + 32, mask), load_sse2(s + 48, mask), 2);
+
+		_mm_storeu_si128((__m128i *) dst, pair_sse2(p0, p1, 4));
+	}
+
+	pack_2bpp_scalar(src + i, dst, count - i);
+}
+
+// 32 pixels -> 16 bytes
+__attribute__((target("sse2")))
+static void pack_4bpp_sse2(const uint8_t *src, uint8_t *dst, size_t count)
+{
+	const __m128i mask = _mm_set1_epi8(0x0f);
+	size_t i = 0;
+
+	for(; i + 32 <= count; i += 32, dst += 16)
+	{
+		_mm_storeu_si128((__m128i *) dst,
+				pair_sse2(load_sse2(src + i, mask), load_sse2(src + i + 16, mask), 4));
+	}
+
+	pack_4bpp_scalar(src + i, dst, count - i);
+}
+
+/*
+ * AVX2 packs within 128-bit lanes, so every step is followed by a
+ * permute to put the two halves of each source back in order.
+ */
+
+__attribute__((target("avx2")))
+static inline __m256i pair_avx2(__m256i a, __m256i b, int shift)
+{
+	const __m256i low = _mm256_set1_epi16(0x00ff);
+	const __m128i count = _mm_cvtsi32_si128(shift);
+
+	a = _mm256_or_si256(_mm256_sll_epi16(_mm256_and_si256(a, low), count), _mm256_srli_epi16(a, 8));
+	b = _mm256_or_si256(_mm256_sll_epi16(_mm256_and_si256(b, low), count), _mm256_srli_epi16(b, 8));
+
+	return _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xd8);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i load_avx2(const uint8_t *src, __m256i mask)
+{
+	return _mm256_and_si256(_mm256_loadu_si256((const __m256i *) src), mask);
+}
+
+// 256 pixels -> 32 bytes
+__attribute__((target("avx2")))
+static void pack_1bpp_avx2(const uint8_t *src, uint8_t *dst, size_t count)
+{
+	const __m256i mask = _mm256_set1_epi8(0x01);
+	size_t i = 0;
+
+	for(; i + 256 <= count; i += 256, dst += 32)
+	{
+		const uint8_t *s = src + i;
+		__m256i p0 = pair_avx2(load_avx2(s, mask), load_avx2(s + 32, mask), 1);
+		__m256i p1 = pair_avx2(load_avx2(s + 64, mask), load_avx2(s + 96, mask), 1);
+		__m256i p2 = pair_avx2(load_avx2(s + 128, mask), load_avx2(s + 160, mask), 1);
+		__m256i p3 = pair_avx2(load_avx2(s + 192, mask), load_avx2(s + 224, mask), 1);
+
+		p0 = pair_avx2(p0, p1, 2);
+		p2 = pair_avx2(p2, p3, 2);
+		_mm256_storeu_si256((__m256i *) dst, pair_avx2(p0, p2, 4));
+	}
+
+	pack_1bpp_sse2(src + i, dst, count - i);
+}
+
+// 128 pixels -> 32 bytes
+__attribute__((target("avx2")))
+static void pack_2bpp_avx2(const uint8_t *src, uint8_t *dst, size_t count)
+{
+	const __m256i mask = _mm256_set1_epi8(0x03);
+	size_t i = 0;
+
+	for(; i + 128 <= count; i += 128, dst += 32)
+	{
+		const uint8_t *s = src + i;
+		__m256i p0 = pair_avx2(load_avx2(s, mask), load_avx2(s + 32, mask), 2);
+		__m256i p1 = pair_avx2(load_avx2(s + 64, mask), load_avx2(s + 96, mask), 2);
+
+		_mm256_storeu_si256((__m256i *) dst, pair_avx2(p0, p1, 4));
+	}
+
+	pack_2bpp_sse2(src + i, dst, count - i);
+}
+
+// 64 pixels -> 32 bytes
+__attribute__((target("avx2")))
+static void pack_4bpp_avx2(const uint8_t *src, uint8_t *dst, size_t count)
+{
+	const __m256i mask = _mm256_set1_epi8(0x0f);
+	size_t i = 0;
+
+	for(; i + 64 <= count; i += 64, dst += 32)
+	{
+		_mm256_storeu_si256((__m256i *) dst,
+				pair_avx2(load_avx2(src + i, mask), load_avx2(src + i + 32, mask), 4));
+	}
+
+	pack_4bpp_sse2(src + i, dst, count - i);
+}
+
+#endif // VERA_PACK_X86
+
+static VeraPackKernel best_kernel(void)
+{
+#ifdef VERA_PACK_X86
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx2"))
+		return VERA_KERNEL_AVX2;
+	if (__builtin_cpu_supports("sse2"))
+		return VERA_KERNEL_SSE2;
+#endif
+	return VERA_KERNEL_SCALAR;
+}
+
+void vera_packer_init(VeraPacker *packer, int bpp, VeraPackKernel kernel)
+{
+	VeraPackKernel best = best_kernel();
+
+	if (kernel == VERA_KERNEL_AUTO || kernel > best)
+		kernel = best;
+
+	packer->bpp = bpp;
+	packer->kernel = kernel;
+
+	switch(bpp)
+	{
+		case 1:
+			packer->pack = pack_1bpp_scalar;
+			break;
+		case 2:
+			packer->pack = pack_2bpp_scalar;
+			break;
+		case 4:
+			packer->pack = pack_4bpp_scalar;
+			break;
+		default:
+			packer->bpp = 8;
+			packer->pack = pack_8bpp;
+			break;
+	}
+
+#ifdef VERA_PACK_X86
+	switch(kernel)
+	{
+		case VERA_KERNEL_AVX2:
+			if (bpp == 1)
+				packer->pack = pack_1bpp_avx2;
+			else if (bpp == 2)
+				packer->pack = pack_2bpp_avx2;
+			else if (bpp == 4)
+				packer->pack = pack_4bpp_avx2;
+			break;
+		case VERA_KERNEL_SSE2:
+			if (bpp == 1)
+				packer->pack = pack_1bpp_sse2;
+			else if (bpp == 2)
+				packer->pack = pack_2bpp_sse2;
+			else if (bpp == 4)
+				packer->pack = pack_4bpp_sse2;
+			break;
+		default:
+			break;
+	}
+#endif
+}
+
+const char *vera_pack_kernel_name(VeraPackKernel kernel)
+{
+	switch(kernel)
+	{
+		case VERA_KERNEL_SCALAR:
+			return "scalar";
+		case VERA_KERNEL_SSE2:
+			return "sse2";
+		case VERA_KERNEL_AVX2:
+			return "avx2";
+		default:
+			return "auto";
+	}
+}
+
+size_t vera_packed_size(int bpp, size_t count)
+{
+	return (count * bpp + 7) / 8;
+}
+
+void vera_pack_tile_row(const VeraPacker *packer,
+		const uint8_t *src,
+		size_t         stride,
+		int            tiles_across,
+		int            tile_width,
+		int            tile_height,
+		uint8_t       *dst,
+		uint8_t       *row_buf)
+{
+	size_t line_bytes = vera_packed_size(packer->bpp, tile_width);
+	size_t tile_bytes = line_bytes * tile_height;
+
+	// pack each full image row in one go, then deal its bytes out to the tiles
+	for(int ty = 0; ty < tile_height; ty++)
+	{
+		packer->pack(src + ty * stride, row_buf, (size_t) tiles_across * tile_width);
+
+		for(int x = 0; x < tiles_across; x++)
+		{
+			memcpy(dst + x * tile_bytes + ty * line_bytes,
+					row_buf + x * line_bytes,
+					line_bytes);
+		}
+	}
+}
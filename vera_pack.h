@@ -0,0 +1,61 @@
+#ifndef VERA_PACK_H
+#define VERA_PACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Pixel packing for VERA tile and bitmap data.
+ *
+ * The packers take one byte per pixel (a color index) and pack them into
+ * 1, 2, 4 or 8 bits per pixel, leftmost pixel in the most significant bits,
+ * which is the layout the VERA reads from VRAM.  The kernel is picked once
+ * per export, so the inner loops never branch on the bit depth.
+ */
+
+typedef enum
+{
+	VERA_KERNEL_AUTO = 0,
+	VERA_KERNEL_SCALAR,
+	VERA_KERNEL_SSE2,
+	VERA_KERNEL_AVX2
+} VeraPackKernel;
+
+/* packs count indices from src into dst, zero padding a partial last byte */
+typedef void (*VeraPackFunc)(const uint8_t *src, uint8_t *dst, size_t count);
+
+typedef struct
+{
+	int             bpp;
+	VeraPackKernel  kernel;
+	VeraPackFunc    pack;
+} VeraPacker;
+
+/*
+ * Selects the packing kernel for the given bit depth.  VERA_KERNEL_AUTO
+ * picks the widest one the CPU supports; asking for a kernel the CPU or
+ * compiler can't provide falls back to the next narrower one.
+ */
+void vera_packer_init(VeraPacker *packer, int bpp, VeraPackKernel kernel);
+
+const char *vera_pack_kernel_name(VeraPackKernel kernel);
+
+/* number of bytes count pixels occupy at the given bit depth */
+size_t vera_packed_size(int bpp, size_t count);
+
+/*
+ * Packs one row of tiles.  src holds tile_height rows of at least
+ * tiles_across * tile_width indices, stride bytes apart, and dst receives
+ * tiles_across complete tiles one after another.  row_buf is scratch space
+ * of vera_packed_size(bpp, tiles_across * tile_width) bytes.
+ */
+void vera_pack_tile_row(const VeraPacker *packer,
+		const uint8_t *src,
+		size_t         stride,
+		int            tiles_across,
+		int            tile_width,
+		int            tile_height,
+		uint8_t       *dst,
+		uint8_t       *row_buf);
+
+#endif
@@ -0,0 +1,224 @@
+#include "vera_patch.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vera_hash.h"
+#include "vera_sprite.h"
+
+// bump when the chunks are hashed differently
+#define VERA_PATCH_VERSION  1
+#define RECORD_HEADER       5
+#define MAX_RECORD          0xffff
+
+/*
+ * Reads the chunk hashes recorded for data loaded at address, or none if
+ * there are none or they were made for another address or chunk size.
+ */
+static size_t read_hashes(const char *name, uint32_t address, size_t chunk, uint64_t **hashes)
+{
+	FILE *fp = fopen(name, "r");
+	unsigned long long hash;
+	unsigned long recorded_address, recorded_chunk;
+	size_t count = 0;
+	size_t capacity = 0;
+	int version;
+
+	*hashes = NULL;
+
+	if (! fp)
+		return 0;
+
+	if (fscanf(fp, "vera-patch %d %lu %lu", &version, &recorded_address, &recorded_chunk) == 3
+			&& version == VERA_PATCH_VERSION
+			&& recorded_address == address
+			&& recorded_chunk == chunk)
+	{
+		while (fscanf(fp, "%llx", &hash) == 1)
+		{
+			if (count == capacity)
+			{
+				uint64_t *grown;
+
+				capacity = capacity ? capacity * 2 : 1024;
+				grown = realloc(*hashes, capacity * sizeof(uint64_t));
+
+				// without them every chunk counts as changed, which is still right
+				if (! grown)
+				{
+					count = 0;
+					break;
+				}
+
+				*hashes = grown;
+			}
+
+			(*hashes)[count++] = hash;
+		}
+	}
+
+	fclose(fp);
+
+	return count;
+}
+
+/* writes the record of the run of changed data at offset */
+static int write_record(VeraSink *sink,
+		uint32_t       address,
+		size_t         offset,
+		const uint8_t *data,
+		size_t         length,
+		VeraError     *error)
+{
+	uint8_t record[RECORD_HEADER];
+	size_t start = address + offset;
+
+	if (start + length > VERA_VRAM_SIZE)
+	{
+		vera_set_error(error, EFBIG, "'%s' does not fit below VRAM address 0x%05x",
+				sink->filename, VERA_VRAM_SIZE);
+		return -1;
+	}
+
+	record[0] = start & 0xff;
+	record[1] = (start >> 8) & 0xff;
+	record[2] = (start >> 16) & 0xff;
+	record[3] = length & 0xff;
+	record[4] = length >> 8;
+
+	if (vera_sink_write(sink, record, RECORD_HEADER, error) != 0)
+		return -1;
+
+	return vera_sink_write(sink, data, length, error);
+}
+
+int vera_patch_build(VeraPatch *patch,
+		VeraSink           *bin,
+		size_t              header,
+		size_t              chunk,
+		const VeraSaveVals *vals,
+		VeraStats          *stats,
+		VeraError          *error)
+{
+	uint32_t address = vals->vram_address;
+	char *patch_name = vera_concat(bin->filename, ".PATCH");
+	char *hash_name = vera_concat(bin->filename, ".vpatch");
+	size_t max_run = chunk <= MAX_RECORD ? MAX_RECORD - MAX_RECORD % chunk : 0;
+	uint64_t *old = NULL;
+	size_t old_count = 0;
+	uint8_t *run = malloc(max_run + 1);
+	size_t run_length = 0;
+	size_t run_offset = 0;
+	size_t offset = 0;
+	int has_patch = 0;
+	int has_hashes = 0;
+	int ret = 0;
+
+	if (! patch_name || ! hash_name || ! run)
+	{
+		vera_set_error(error, ENOMEM, "Out of memory writing the patch of '%s'", bin->filename);
+		ret = -1;
+	}
+	else if (max_run == 0)
+	{
+		vera_set_error(error, EINVAL, "'%s' has chunks too large to patch", bin->filename);
+		ret = -1;
+	}
+
+	if (ret == 0)
+	{
+		old_count = read_hashes(hash_name, address, chunk, &old);
+
+		has_patch = vera_sink_open(&patch->patch, patch_name, stats, error) == 0;
+		has_hashes = has_patch && vera_sink_open(&patch->hashes, hash_name, stats, error) == 0;
+		ret = has_hashes ? 0 : -1;
+	}
+
+	if (ret == 0 && vals->file_header)
+	{
+		const uint8_t file_header[2] = { 0, 0 };
+		ret = vera_sink_write(&patch->patch, file_header, 2, error);
+	}
+
+	if (ret == 0)
+	{
+		fprintf(patch->hashes.fp, "vera-patch %d %lu %lu\n", VERA_PATCH_VERSION,
+				(unsigned long) address, (unsigned long) chunk);
+
+		if (fseek(bin->fp, (long) header, SEEK_SET) != 0)
+		{
+			vera_set_error(error, EIO, "Could not read back '%s'", bin->filename);
+			ret = -1;
+		}
+	}
+
+	// runs of changed chunks become one record each
+	for(size_t i = 0; ret == 0; i++)
+	{
+		uint64_t hash;
+		size_t n;
+
+		if (run_length + chunk > max_run)
+		{
+			ret = write_record(&patch->patch, address, run_offset, run, run_length, error);
+			run_offset += run_length;
+			run_length = 0;
+			if (ret != 0)
+				break;
+		}
+
+		n = fread(run + run_length, 1, chunk, bin->fp);
+		if (n == 0)
+			break;
+
+		hash = vera_hash_bytes(VERA_HASH_SEED, run + run_length, n);
+		fprintf(patch->hashes.fp, "%016llx\n", (unsigned long long) hash);
+
+		if (i < old_count && old[i] == hash)
+		{
+			if (run_length)
+				ret = write_record(&patch->patch, address, run_offset, run, run_length, error);
+
+			run_length = 0;
+			run_offset = offset + n;
+		}
+		else
+		{
+			run_length += n;
+		}
+
+		offset += n;
+	}
+
+	if (ret == 0 && ferror(bin->fp))
+	{
+		vera_set_error(error, EIO, "Could not read back '%s'", bin->filename);
+		ret = -1;
+	}
+
+	if (ret == 0 && run_length)
+		ret = write_record(&patch->patch, address, run_offset, run, run_length, error);
+
+	if (ret == 0)
+	{
+		const uint8_t end[RECORD_HEADER] = { 0, 0, 0, 0, 0 };
+		ret = vera_sink_write(&patch->patch, end, RECORD_HEADER, error);
+	}
+
+	if (ret != 0)
+	{
+		if (has_hashes)
+			vera_sink_discard(&patch->hashes);
+		if (has_patch)
+			vera_sink_discard(&patch->patch);
+	}
+
+	free(old);
+	free(run);
+	free(hash_name);
+	free(patch_name);
+
+	return ret;
+}
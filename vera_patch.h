@@ -0,0 +1,47 @@
+#ifndef VERA_PATCH_H
+#define VERA_PATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "vera_export.h"
+#include "vera_sink.h"
+
+/*
+ * VRAM patches.  Next to a binary, filename.vpatch keeps a hash of every
+ * chunk of its data as last exported, a tile or a bitmap row.  The next
+ * export compares its chunks against them and writes the ones that changed
+ * to filename.PATCH, so a loader or an emulator can update VRAM in place
+ * instead of loading the whole file again:
+ *
+ *   [2 byte header] { u24 VRAM address, u16 length, length bytes }...,
+ *                   u24 0, u16 0
+ *
+ * Values are little endian.  The address is the 17-bit VRAM address that
+ * VERA's ADDRx_L/M/H registers take; the bits above it in ADDRx_H hold the
+ * increment, which is left to the player.  The data is what VRAM holds, never compressed.
+ * Without hashes to compare with, every chunk is in the patch, so applying
+ * a patch always leaves VRAM as the binary would.
+ */
+
+typedef struct
+{
+	VeraSink  patch;
+	VeraSink  hashes;
+} VeraPatch;
+
+/*
+ * Reads the data of bin after header bytes, chunk bytes at a time, and
+ * writes the patch and the new hashes of its file into two sinks that are
+ * left for the caller to commit or discard.  address is where the data is
+ * loaded in VRAM.  Returns 0, or -1 with error set.
+ */
+int vera_patch_build(VeraPatch *patch,
+		VeraSink           *bin,
+		size_t              header,
+		size_t              chunk,
+		const VeraSaveVals *vals,
+		VeraStats          *stats,
+		VeraError          *error);
+
+#endif
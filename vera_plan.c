@@ -0,0 +1,542 @@
+#include "vera_plan.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "vera_sprite.h"
+
+#define TILE_BASE_ALIGN   2048
+#define MAP_BASE_ALIGN    512
+#define PALETTE_ALIGN     32
+
+typedef struct
+{
+	uint32_t  start;
+	uint32_t  end;
+} Span;
+
+void vera_plan_init(VeraPlan *plan)
+{
+	memset(plan, 0, sizeof(VeraPlan));
+	plan->vram_start = 0;
+	plan->vram_end = VERA_PLAN_VRAM_END;
+}
+
+void vera_plan_clear(VeraPlan *plan)
+{
+	for(int i = 0; i < plan->count; i++)
+	{
+		free(plan->items[i].name);
+		free(plan->items[i].filename);
+	}
+
+	free(plan->items);
+	free(plan->c_header);
+	free(plan->ca65);
+	vera_plan_init(plan);
+}
+
+// VRAM_ and the file name up to its extension, as an identifier
+static char *item_name(const char *filename, const char *suffix)
+{
+	const char *base = strrchr(filename, '/');
+	const char *dot;
+	size_t length;
+	char *name;
+	char *p;
+
+	base = base ? base + 1 : filename;
+	dot = strchr(base, '.');
+	length = dot && dot != base ? (size_t) (dot - base) : strlen(base);
+
+	name = malloc(5 + length + strlen(suffix) + 1);
+	if (! name)
+		return NULL;
+
+	p = name + sprintf(name, "VRAM_");
+
+	for(size_t i = 0; i < length; i++)
+		*p++ = isalnum((unsigned char) base[i]) ? toupper((unsigned char) base[i]) : '_';
+
+	for(; *suffix; suffix++)
+		*p++ = isalnum((unsigned char) *suffix) ? toupper((unsigned char) *suffix) : '_';
+
+	*p = '\0';
+
+	return name;
+}
+
+/*
+ * The bytes a file takes once loaded: LOAD skips the header, it never
+ * reaches VRAM, and compressed files give their size after it.
+ */
+static int loaded_size(const char *path, const VeraSaveVals *vals, uint32_t *size, VeraError *error)
+{
+	long header = vals->file_header ? 2 : 0;
+	uint8_t field[4];
+	struct stat st;
+	FILE *fp;
+
+	if (! vals->compress)
+	{
+		if (stat(path, &st) != 0)
+		{
+			vera_set_error(error, errno, "Could not plan '%s': %s", path, strerror(errno));
+			return -1;
+		}
+
+		*size = st.st_size >= header ? st.st_size - header : st.st_size;
+		return 0;
+	}
+
+	fp = fopen(path, "rb");
+	if (! fp)
+	{
+		vera_set_error(error, errno, "Could not plan '%s': %s", path, strerror(errno));
+		return -1;
+	}
+
+	if (fseek(fp, header, SEEK_SET) != 0 || fread(field, 1, sizeof(field), fp) != sizeof(field))
+	{
+		fclose(fp);
+		vera_set_error(error, EINVAL, "Could not plan '%s': it is not a compressed export", path);
+		return -1;
+	}
+
+	fclose(fp);
+	*size = field[0] | field[1] << 8 | field[2] << 16 | (uint32_t) field[3] << 24;
+
+	return 0;
+}
+
+static int add_file(VeraPlan *plan,
+		const char         *filename,
+		const char         *suffix,
+		VeraPlanArea        area,
+		uint32_t            align,
+		const VeraSaveVals *vals,
+		int                 pinned,
+		uint32_t            address,
+		VeraError          *error)
+{
+	VeraPlanItem *item;
+	uint32_t size;
+	size_t length = strlen(filename) + strlen(suffix);
+	char *path = malloc(length + 1);
+	char *name = item_name(filename, suffix);
+
+	if (! path || ! name)
+	{
+		free(path);
+		free(name);
+		vera_set_error(error, ENOMEM, "Out of memory planning VRAM");
+		return -1;
+	}
+
+	strcpy(path, filename);
+	strcat(path, suffix);
+
+	for(int i = 0; i < plan->count; i++)
+	{
+		if (strcmp(plan->items[i].name, name) == 0)
+		{
+			vera_set_error(error, EINVAL, "'%s' and '%s' would both be called %s",
+					plan->items[i].filename, path, name);
+			free(path);
+			free(name);
+			return -1;
+		}
+	}
+
+	if (loaded_size(path, vals, &size, error) != 0)
+	{
+		free(path);
+		free(name);
+		return -1;
+	}
+
+	if (plan->count == plan->capacity)
+	{
+		int capacity = plan->capacity ? plan->capacity * 2 : 16;
+		VeraPlanItem *items = realloc(plan->items, capacity * sizeof(VeraPlanItem));
+
+		if (! items)
+		{
+			free(path);
+			free(name);
+			vera_set_error(error, ENOMEM, "Out of memory planning VRAM");
+			return -1;
+		}
+
+		plan->items = items;
+		plan->capacity = capacity;
+	}
+
+	item = &plan->items[plan->count++];
+	item->name = name;
+	item->filename = path;
+	item->area = area;
+	item->align = align;
+	item->size = size;
+	item->pinned = pinned;
+	item->address = address;
+
+	return 0;
+}
+
+int vera_plan_add_export(VeraPlan *plan,
+		const char         *filename,
+		const VeraSaveVals *vals,
+		VeraError          *error)
+{
+	int ret = 0;
+
+	if (vals->frames)
+	{
+		vera_set_error(error, EINVAL,
+				"'%s' holds frames behind a frame table, it cannot be loaded into VRAM as it is",
+				filename);
+		return -1;
+	}
+
+	switch (vals->export_type)
+	{
+		case TILESET:
+			ret = add_file(plan, filename, "", VERA_PLAN_VRAM, TILE_BASE_ALIGN,
+					vals, 0, 0, error);
+
+			if (ret == 0 && (vals->dedup_tiles || vera_use_palette_banks(vals)))
+				ret = add_file(plan, filename, ".MAP", VERA_PLAN_VRAM, MAP_BASE_ALIGN,
+						vals, 0, 0, error);
+			break;
+		case BITMAP:
+			// a bitmap layer takes its address from the tile base
+			ret = add_file(plan, filename, "", VERA_PLAN_VRAM, TILE_BASE_ALIGN,
+					vals, 0, 0, error);
+			break;
+		case SPRITE:
+			ret = add_file(plan, filename, "", VERA_PLAN_VRAM, VERA_SPRITE_ALIGN,
+					vals, vals->vram_address != 0, vals->vram_address, error);
+			break;
+	}
+
+	if (ret == 0 && vals->pal_file)
+		ret = add_file(plan, filename, ".PAL", VERA_PLAN_PALETTE, PALETTE_ALIGN,
+				vals, 0, 0, error);
+
+	return ret;
+}
+
+int vera_plan_add_palette(VeraPlan *plan,
+		const char         *filename,
+		const VeraSaveVals *vals,
+		VeraError          *error)
+{
+	return add_file(plan, filename, ".PAL", VERA_PLAN_PALETTE, PALETTE_ALIGN, vals, 0, 0, error);
+}
+
+static uint32_t align_up(uint32_t address, uint32_t align)
+{
+	return (address + align - 1) / align * align;
+}
+
+// keeps used sorted by start
+static void insert_span(Span *used, int *count, uint32_t start, uint32_t end)
+{
+	int i = *count;
+
+	while (i > 0 && used[i - 1].start > start)
+	{
+		used[i] = used[i - 1];
+		i--;
+	}
+
+	used[i].start = start;
+	used[i].end = end;
+	(*count)++;
+}
+
+// the lowest aligned address in [start, end) with size bytes free, or end
+static uint32_t first_fit(const Span *used, int count,
+		uint32_t start, uint32_t end, uint32_t size, uint32_t align)
+{
+	uint32_t address = align_up(start, align);
+
+	for(int i = 0; i < count; i++)
+	{
+		if ((uint64_t) address + size <= used[i].start)
+			break;
+
+		if (used[i].end > address)
+			address = align_up(used[i].end, align);
+	}
+
+	return (uint64_t) address + size <= end ? address : end;
+}
+
+static int item_order(const void *a, const void *b)
+{
+	const VeraPlanItem *x = *(const VeraPlanItem * const *) a;
+	const VeraPlanItem *y = *(const VeraPlanItem * const *) b;
+
+	if (x->align != y->align)
+		return x->align > y->align ? -1 : 1;
+	if (x->size != y->size)
+		return x->size > y->size ? -1 : 1;
+
+	// keep the manifest order otherwise, so plans are stable
+	return x < y ? -1 : x > y;
+}
+
+int vera_plan_layout(VeraPlan *plan, VeraError *error)
+{
+	VeraPlanItem **order = malloc((plan->count + 1) * sizeof(VeraPlanItem *));
+	Span *used[2];
+	int used_count[2] = { 0, 0 };
+	uint32_t area_start[2] = { plan->vram_start, VERA_PLAN_PALETTE_START };
+	uint32_t area_end[2] = { plan->vram_end, VERA_PLAN_PALETTE_END };
+	int ret = 0;
+
+	used[0] = malloc((plan->count + 1) * sizeof(Span));
+	used[1] = malloc((plan->count + 1) * sizeof(Span));
+
+	if (! order || ! used[0] || ! used[1])
+	{
+		free(order);
+		free(used[0]);
+		free(used[1]);
+		vera_set_error(error, ENOMEM, "Out of memory planning VRAM");
+		return -1;
+	}
+
+	for(int i = 0; i < plan->count; i++)
+		order[i] = &plan->items[i];
+
+	qsort(order, plan->count, sizeof(VeraPlanItem *), item_order);
+
+	// pinned files first, everything else goes around them
+	for(int pass = 0; ret == 0 && pass < 2; pass++)
+	{
+		for(int i = 0; ret == 0 && i < plan->count; i++)
+		{
+			VeraPlanItem *item = order[i];
+			int a = item->area;
+			uint32_t address;
+
+			if (item->pinned != (pass == 0))
+				continue;
+
+			if (item->pinned)
+			{
+				address = item->address;
+
+				if (address % item->align || address < area_start[a]
+						|| (uint64_t) address + item->size > area_end[a]
+						|| first_fit(used[a], used_count[a], address, address + item->size,
+							item->size, item->align) != address)
+				{
+					vera_set_error(error, EINVAL,
+							"'%s' is pinned at 0x%05x, which is taken, out of range or not %u byte aligned",
+							item->filename, address, item->align);
+					ret = -1;
+					break;
+				}
+			}
+			else
+			{
+				address = first_fit(used[a], used_count[a],
+						area_start[a], area_end[a], item->size, item->align);
+
+				if (address == area_end[a])
+				{
+					uint32_t free_bytes = area_end[a] - area_start[a];
+
+					for(int j = 0; j < used_count[a]; j++)
+						free_bytes -= used[a][j].end - used[a][j].start;
+
+					vera_set_error(error, ENOSPC,
+							"'%s' needs %u bytes %u byte aligned, but only %u bytes of %s are left",
+							item->filename, item->size, item->align, free_bytes,
+							a == VERA_PLAN_VRAM ? "VRAM" : "palette RAM");
+					ret = -1;
+					break;
+				}
+			}
+
+			item->address = address;
+			insert_span(used[a], &used_count[a], address, address + item->size);
+		}
+	}
+
+	free(order);
+	free(used[0]);
+	free(used[1]);
+
+	return ret;
+}
+
+static char *guard_name(const char *filename)
+{
+	const char *base = strrchr(filename, '/');
+	char *guard;
+	char *p;
+
+	base = base ? base + 1 : filename;
+	guard = malloc(strlen(base) + 2);
+
+	if (! guard)
+		return NULL;
+
+	p = guard;
+
+	// a leading digit would not make an identifier
+	if (isdigit((unsigned char) *base))
+		*p++ = '_';
+
+	for(; *base; base++)
+		*p++ = isalnum((unsigned char) *base) ? toupper((unsigned char) *base) : '_';
+
+	*p = '\0';
+
+	return guard;
+}
+
+static int write_text(const VeraPlan *plan,
+		const char    *filename,
+		int            ca65,
+		VeraArtifacts *artifacts,
+		VeraError     *error)
+{
+	char *guard = guard_name(filename);
+	size_t capacity = 128 + (guard ? 2 * strlen(guard) : 0);
+	size_t length = 0;
+	char *text;
+	int ret;
+
+	for(int i = 0; i < plan->count; i++)
+		capacity += 2 * strlen(plan->items[i].name) + 64;
+
+	text = malloc(capacity);
+
+	if (! text || ! guard)
+	{
+		free(text);
+		free(guard);
+		vera_set_error(error, ENOMEM, "Out of memory writing '%s'", filename);
+		return -1;
+	}
+
+	if (ca65)
+		length += snprintf(text + length, capacity - length,
+				"; VRAM addresses, written by vera-export\n\n");
+	else
+		length += snprintf(text + length, capacity - length,
+				"/* VRAM addresses, written by vera-export */\n\n#ifndef %s\n#define %s\n\n",
+				guard, guard);
+
+	for(int i = 0; i < plan->count; i++)
+	{
+		const VeraPlanItem *item = &plan->items[i];
+
+		if (ca65)
+			length += snprintf(text + length, capacity - length,
+					"%s = $%05X\n%s_SIZE = $%05X\n",
+					item->name, item->address, item->name, item->size);
+		else
+			length += snprintf(text + length, capacity - length,
+					"#define %s 0x%05X\n#define %s_SIZE 0x%05X\n",
+					item->name, item->address, item->name, item->size);
+	}
+
+	if (! ca65)
+		length += snprintf(text + length, capacity - length, "\n#endif\n");
+
+	ret = vera_save_data(filename, text, length, artifacts, error);
+
+	free(guard);
+	free(text);
+
+	return ret;
+}
+
+static int parse_address(const char *text, uint32_t *address)
+{
+	char *end;
+	unsigned long n = strtoul(text, &end, 0);
+
+	if (end == text || *end || n > VERA_VRAM_SIZE)
+		return -1;
+
+	*address = n;
+
+	return 0;
+}
+
+int vera_plan_directive(VeraPlan *plan, int argc, char **argv, VeraError *error)
+{
+	char **field = NULL;
+
+	if (strcmp(argv[0], "@c-header") == 0)
+		field = &plan->c_header;
+	else if (strcmp(argv[0], "@ca65") == 0)
+		field = &plan->ca65;
+
+	if (field && argc == 2)
+	{
+		free(*field);
+		*field = strdup(argv[1]);
+
+		if (! *field)
+		{
+			vera_set_error(error, ENOMEM, "Out of memory planning VRAM");
+			return -1;
+		}
+
+		return 0;
+	}
+
+	if (strcmp(argv[0], "@vram") == 0 && argc == 3)
+	{
+		uint32_t start, end;
+
+		if (parse_address(argv[1], &start) != 0 || parse_address(argv[2], &end) != 0
+				|| start >= end || end > VERA_PLAN_VRAM_END)
+		{
+			vera_set_error(error, EINVAL, "@vram needs a start and an end below 0x%05x",
+					VERA_PLAN_VRAM_END);
+			return -1;
+		}
+
+		plan->vram_start = start;
+		plan->vram_end = end;
+
+		return 0;
+	}
+
+	vera_set_error(error, EINVAL, "Unknown directive '%s', expected @c-header FILE, @ca65 FILE, @vram START END or @shared-palette NAME",
+			argv[0]);
+
+	return -1;
+}
+
+int vera_plan_wanted(const VeraPlan *plan)
+{
+	return plan->c_header || plan->ca65;
+}
+
+int vera_plan_write(VeraPlan *plan, VeraArtifacts *artifacts, VeraError *error)
+{
+	int ret = vera_plan_layout(plan, error);
+
+	if (ret == 0 && plan->c_header)
+		ret = write_text(plan, plan->c_header, 0, artifacts, error);
+
+	if (ret == 0 && plan->ca65)
+		ret = write_text(plan, plan->ca65, 1, artifacts, error);
+
+	return ret;
+}
@@ -0,0 +1,101 @@
+#ifndef VERA_PLAN_H
+#define VERA_PLAN_H
+
+#include <stdint.h>
+
+#include "vera_export.h"
+
+/*
+ * The VRAM planner.  Given the files of several exports, it finds a VRAM
+ * address for each one that meets the VERA's alignment rules and writes
+ * the result as a C header and a ca65 include:
+ *
+ *   tile sets and bitmaps   2 KB, the granularity of the tile base
+ *   tile maps               512 bytes, the granularity of the map base
+ *   sprites                 32 bytes
+ *   palettes                32 bytes (16 colors) within the palette RAM
+ *
+ * Larger alignments are placed first, then larger files, each at the lowest
+ * address that fits, so the padding left behind by one file is filled by
+ * smaller ones.  Files loaded with the 2 byte header only count their data,
+ * and compressed files the size they decompress to.
+ */
+
+#define VERA_PLAN_VRAM_END       0x1f9c0    /* PSG registers, palette and sprite attributes follow */
+#define VERA_PLAN_PALETTE_START  0x1fa00
+#define VERA_PLAN_PALETTE_END    0x1fc00
+
+typedef enum
+{
+	VERA_PLAN_VRAM = 0,
+	VERA_PLAN_PALETTE
+} VeraPlanArea;
+
+typedef struct
+{
+	char          *name;       /* identifier in the address map */
+	char          *filename;
+	VeraPlanArea   area;
+	uint32_t       align;
+	uint32_t       size;
+	int            pinned;     /* address was given rather than planned */
+	uint32_t       address;
+} VeraPlanItem;
+
+typedef struct
+{
+	VeraPlanItem  *items;
+	int            count;
+	int            capacity;
+	uint32_t       vram_start;
+	uint32_t       vram_end;
+	char          *c_header;   /* address maps to write, or NULL */
+	char          *ca65;
+} VeraPlan;
+
+void vera_plan_init(VeraPlan *plan);
+
+void vera_plan_clear(VeraPlan *plan);
+
+/*
+ * Adds the files written by an export of filename with vals: the tile set,
+ * bitmap or sprites, the tile map and the palette.  Sprites exported with a
+ * nonzero vram-address are pinned there, since their attributes already
+ * point at it.  Returns 0, or -1 with error set if a file is missing.
+ */
+int vera_plan_add_export(VeraPlan *plan,
+		const char         *filename,
+		const VeraSaveVals *vals,
+		VeraError          *error);
+
+/*
+ * Adds the palette filename.PAL written on its own with vals, such as a
+ * shared palette.  Returns 0, or -1 with error set if it is missing.
+ */
+int vera_plan_add_palette(VeraPlan *plan,
+		const char         *filename,
+		const VeraSaveVals *vals,
+		VeraError          *error);
+
+/*
+ * Applies a manifest line starting with @, split into argv:
+ *
+ *   @c-header FILE     write the addresses as C defines to FILE
+ *   @ca65 FILE         write them as ca65 symbols to FILE
+ *   @vram START END    only plan VRAM in [START, END)
+ */
+int vera_plan_directive(VeraPlan *plan, int argc, char **argv, VeraError *error);
+
+/* whether a directive asked for an address map */
+int vera_plan_wanted(const VeraPlan *plan);
+
+/*
+ * Assigns every file an address.  Fails on the first file that does not
+ * fit, naming it along with the space left.
+ */
+int vera_plan_layout(VeraPlan *plan, VeraError *error);
+
+/* lays out the plan and writes the address maps its directives asked for */
+int vera_plan_write(VeraPlan *plan, VeraArtifacts *artifacts, VeraError *error);
+
+#endif
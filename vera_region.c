@@ -0,0 +1,188 @@
+#include "vera_region.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define REGION_FIELDS  5
+
+static int read_field(const char *text, int *value)
+{
+	int hex = text[0] == '0' && (text[1] == 'x' || text[1] == 'X');
+	const char *digits = hex ? text + 2 : text;
+	char *end;
+	long n = strtol(digits, &end, hex ? 16 : 10);
+
+	if (end == digits || *end || n < 0 || n > 0xffff)
+		return -1;
+
+	*value = n;
+
+	return 0;
+}
+
+/* splits line in place at spaces and tabs, returning the number of words */
+static int split_line(char *line, char **words, int max_words)
+{
+	int count = 0;
+
+	for(;;)
+	{
+		line += strspn(line, " \t");
+
+		if (! *line)
+			return count;
+
+		if (count == max_words)
+			return max_words + 1;
+
+		words[count++] = line;
+		line += strcspn(line, " \t");
+
+		if (*line)
+			*line++ = '\0';
+	}
+}
+
+int vera_regions_parse(const char *text,
+		size_t        length,
+		const char   *source,
+		VeraRegion  **regions,
+		int          *count,
+		VeraError    *error)
+{
+	char *copy = malloc(length + 1);
+	char *line;
+	char *next;
+	int capacity = 0;
+	int line_number = 0;
+	int ret = 0;
+
+	*regions = NULL;
+	*count = 0;
+
+	if (! copy)
+	{
+		vera_set_error(error, ENOMEM, "Out of memory reading '%s'", source);
+		return -1;
+	}
+
+	memcpy(copy, text, length);
+	copy[length] = '\0';
+
+	for(line = copy; ret == 0 && line; line = next)
+	{
+		char *words[REGION_FIELDS];
+		int *fields[REGION_FIELDS - 1];
+		VeraRegion *region;
+		int n_words;
+
+		next = strchr(line, '\n');
+		if (next)
+			*next++ = '\0';
+
+		line_number++;
+		line[strcspn(line, "\r#")] = '\0';
+
+		n_words = split_line(line, words, REGION_FIELDS);
+		if (n_words == 0)
+			continue;
+
+		if (n_words != REGION_FIELDS)
+		{
+			vera_set_error(error, EINVAL, "%s:%d: expected a name, x, y, width and height",
+					source, line_number);
+			ret = -1;
+			break;
+		}
+
+		if (*count == capacity)
+		{
+			VeraRegion *grown;
+
+			capacity = capacity ? capacity * 2 : 16;
+			grown = realloc(*regions, capacity * sizeof(VeraRegion));
+
+			if (! grown)
+			{
+				vera_set_error(error, ENOMEM, "Out of memory reading '%s'", source);
+				ret = -1;
+				break;
+			}
+
+			*regions = grown;
+		}
+
+		region = &(*regions)[*count];
+		memset(region, 0, sizeof(VeraRegion));
+		strncpy(region->name, words[0], VERA_REGION_NAME_LENGTH - 1);
+
+		fields[0] = &region->x;
+		fields[1] = &region->y;
+		fields[2] = &region->width;
+		fields[3] = &region->height;
+
+		for(int i = 0; ret == 0 && i < REGION_FIELDS - 1; i++)
+		{
+			if (read_field(words[i + 1], fields[i]) != 0)
+			{
+				vera_set_error(error, EINVAL, "%s:%d: '%s' is not a number from 0 to 65535",
+						source, line_number, words[i + 1]);
+				ret = -1;
+			}
+		}
+
+		if (ret == 0)
+			(*count)++;
+	}
+
+	free(copy);
+
+	if (ret == 0 && *count == 0)
+	{
+		vera_set_error(error, EINVAL, "'%s' lists no regions", source);
+		ret = -1;
+	}
+
+	if (ret != 0)
+	{
+		free(*regions);
+		*regions = NULL;
+		*count = 0;
+	}
+
+	return ret;
+}
+
+int vera_regions_check(const VeraRegion *regions,
+		int                 count,
+		int                 width,
+		int                 height,
+		const VeraSaveVals *vals,
+		VeraError          *error)
+{
+	for(int i = 0; i < count; i++)
+	{
+		const VeraRegion *r = &regions[i];
+
+		if (r->width < 1 || r->height < 1
+				|| r->x + r->width > width || r->y + r->height > height)
+		{
+			vera_set_error(error, EINVAL,
+					"Region '%s' (%d,%d %dx%d) does not lie inside the %dx%d image",
+					r->name, r->x, r->y, r->width, r->height, width, height);
+			return -1;
+		}
+
+		// a tile cut off at the edge of a region would be dropped
+		if (vals->export_type != BITMAP
+				&& (r->width % vals->tile_width || r->height % vals->tile_height))
+		{
+			vera_set_error(error, EINVAL, "Region '%s' (%dx%d) is not made of whole %dx%d tiles",
+					r->name, r->width, r->height, vals->tile_width, vals->tile_height);
+			return -1;
+		}
+	}
+
+	return 0;
+}
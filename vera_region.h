@@ -0,0 +1,55 @@
+#ifndef VERA_REGION_H
+#define VERA_REGION_H
+
+#include <stddef.h>
+
+#include "vera_export.h"
+
+/*
+ * Rectangles of an image exported as the entries of an atlas.  A region
+ * list names one rectangle per line, in pixels:
+ *
+ *   # name   x    y    width height
+ *   ship     0    0    32    32
+ *   font     0    32   128   64
+ *
+ * Numbers starting with 0x are read as hexadecimal and lines starting with
+ * # are ignored.  The atlas table follows the order of the list.
+ */
+
+#define VERA_REGION_NAME_LENGTH  64
+
+typedef struct
+{
+	char  name[VERA_REGION_NAME_LENGTH];
+	int   x;
+	int   y;
+	int   width;
+	int   height;
+} VeraRegion;
+
+/*
+ * Parses length bytes of a region list read from source, which only names
+ * it in errors.  *regions is malloc'ed and holds *count regions.  Returns 0,
+ * or -1 with error set.
+ */
+int vera_regions_parse(const char *text,
+		size_t        length,
+		const char   *source,
+		VeraRegion  **regions,
+		int          *count,
+		VeraError    *error);
+
+/*
+ * Checks that every region lies inside a width by height image and, unless
+ * vals exports a bitmap, is made of whole tiles.  Returns 0, or -1 with
+ * error set.
+ */
+int vera_regions_check(const VeraRegion *regions,
+		int                 count,
+		int                 width,
+		int                 height,
+		const VeraSaveVals *vals,
+		VeraError          *error);
+
+#endif
@@ -0,0 +1,105 @@
+#include "vera_shared.h"
+
+#include <errno.h>
+#include <string.h>
+
+void vera_shared_init(VeraSharedPalette *shared)
+{
+	memset(shared->cmap, 0, sizeof(shared->cmap));
+	shared->palsize = 0;
+
+	for(int key = 0; key < VERA_LUT_SIZE; key++)
+		shared->entry[key] = -1;
+}
+
+static void set_entry(VeraSharedPalette *shared, int i, int key)
+{
+	// 4 bits widened back to 8, so the .PAL writer gets the same color back
+	shared->cmap[i * 3] = (key >> 8) * 17;
+	shared->cmap[i * 3 + 1] = ((key >> 4) & 0x0f) * 17;
+	shared->cmap[i * 3 + 2] = (key & 0x0f) * 17;
+}
+
+int vera_shared_add(VeraSharedPalette *shared,
+		const uint8_t *cmap,
+		int            palsize,
+		const char    *source,
+		uint8_t       *remap,
+		VeraError     *error)
+{
+	int16_t added[VERA_LUT_SIZE];
+	int keys[256];
+	int palsize_after = shared->palsize ? shared->palsize : 1;
+	int n_added = 0;
+
+	if (palsize > 256)
+		palsize = 256;
+
+	// count the new colors first, so an asset that does not fit changes nothing
+	for(int i = 1; i < palsize; i++)
+	{
+		int key = vera_color_key(cmap[i * 3], cmap[i * 3 + 1], cmap[i * 3 + 2]);
+
+		keys[i] = key;
+
+		if (shared->entry[key] >= 0)
+			continue;
+
+		for(int j = 0; j < n_added; j++)
+		{
+			if (added[j] == key)
+			{
+				key = -1;
+				break;
+			}
+		}
+
+		if (key >= 0)
+			added[n_added++] = key;
+	}
+
+	if (palsize_after + n_added > 256)
+	{
+		vera_set_error(error, ENOSPC,
+				"The colors of '%s' do not fit the shared palette: %d of 256 entries are taken and it needs %d more",
+				source, palsize_after, n_added);
+		return -1;
+	}
+
+	if (shared->palsize == 0)
+	{
+		if (palsize > 0)
+			set_entry(shared, 0, vera_color_key(cmap[0], cmap[1], cmap[2]));
+
+		shared->palsize = 1;
+	}
+
+	memset(remap, 0, 256);
+
+	for(int i = 1; i < palsize; i++)
+	{
+		int key = keys[i];
+
+		if (shared->entry[key] < 0)
+		{
+			shared->entry[key] = shared->palsize;
+			set_entry(shared, shared->palsize++, key);
+		}
+
+		remap[i] = shared->entry[key];
+	}
+
+	return 0;
+}
+
+int vera_shared_check(const VeraSaveVals *vals, const char *source, VeraError *error)
+{
+	if (vals->tile_bpp != TILE_8BPP)
+	{
+		vera_set_error(error, EINVAL,
+				"'%s' is %d bpp, a shared palette needs 8 bpp assets", source, vals->tile_bpp);
+		return -1;
+	}
+
+	return 0;
+}
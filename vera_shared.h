@@ -0,0 +1,48 @@
+#ifndef VERA_SHARED_H
+#define VERA_SHARED_H
+
+#include <stdint.h>
+
+#include "vera_export.h"
+#include "vera_lut.h"
+
+/*
+ * Shared palettes.  Assets that are shown together have to live with the
+ * one 256 color palette of the VERA, so their colormaps are merged into a
+ * shared one.  Every color is reduced to the 12 bits the VERA shows, and
+ * colors that come out the same share an entry.  Entries are only ever
+ * appended, so the remap table of an asset stays valid as more are added.
+ *
+ * Index 0 is transparent, so it stays 0 in every asset and the shared
+ * entry 0 takes the color 0 of the first asset.  No other color maps to it.
+ */
+
+typedef struct
+{
+	uint8_t   cmap[256 * 3];         /* merged colors, as the VERA shows them */
+	int       palsize;
+	int16_t   entry[VERA_LUT_SIZE];  /* 12-bit color -> entry, or -1 */
+} VeraSharedPalette;
+
+void vera_shared_init(VeraSharedPalette *shared);
+
+/*
+ * Merges the palsize colors of cmap, read from source, which only names it
+ * in errors, and fills remap with the shared entry of each index.  Returns
+ * 0, or -1 with error set and shared unchanged if the colors do not fit.
+ */
+int vera_shared_add(VeraSharedPalette *shared,
+		const uint8_t *cmap,
+		int            palsize,
+		const char    *source,
+		uint8_t       *remap,
+		VeraError     *error);
+
+/*
+ * Checks that an export with vals can use a shared palette: only 8 bpp
+ * data holds the full index, lower depths pick their colors through the
+ * palette offset.  Returns 0, or -1 with error set.
+ */
+int vera_shared_check(const VeraSaveVals *vals, const char *source, VeraError *error);
+
+#endif
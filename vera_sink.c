@@ -0,0 +1,234 @@
+#include "vera_sink.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <io.h>
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+#ifndef O_BINARY
+#define O_BINARY  0
+#endif
+
+#define TEMP_ATTEMPTS  100
+
+// numbers the temporary files of this process
+static unsigned long temp_counter;
+
+static int set_write_error(VeraError *error, const char *filename)
+{
+	vera_set_error(error, errno ? errno : EIO, "Could not write to '%s': %s",
+			filename, strerror(errno ? errno : EIO));
+	return -1;
+}
+
+static int sync_file(FILE *fp)
+{
+#ifdef _WIN32
+	return _commit(_fileno(fp));
+#else
+	return fsync(fileno(fp));
+#endif
+}
+
+static int same_contents(FILE *fa, const char *b)
+{
+	FILE *fb = fopen(b, "rb");
+	uint8_t *buf = malloc(2 * 65536);
+	int same = fb && buf && fseek(fa, 0, SEEK_SET) == 0;
+
+	while (same)
+	{
+		size_t na = fread(buf, 1, 65536, fa);
+		size_t nb = fread(buf + 65536, 1, 65536, fb);
+
+		same = na == nb && memcmp(buf, buf + 65536, na) == 0;
+
+		if (na == 0)
+			break;
+	}
+
+	if (fb)
+		fclose(fb);
+	free(buf);
+
+	return same;
+}
+
+static void sink_free(VeraSink *sink)
+{
+	if (sink->fp)
+		fclose(sink->fp);
+
+	free(sink->buffer);
+	free(sink->temp_filename);
+	free(sink->filename);
+	memset(sink, 0, sizeof(VeraSink));
+}
+
+int vera_sink_open(VeraSink *sink, const char *filename, VeraStats *stats, VeraError *error)
+{
+	size_t length = strlen(filename) + 48;
+	int64_t start = vera_stats_now();
+	int fd = -1;
+
+	memset(sink, 0, sizeof(VeraSink));
+
+	sink->filename = malloc(strlen(filename) + 1);
+	sink->temp_filename = malloc(length);
+	sink->buffer = malloc(VERA_SINK_BUFFER);
+
+	if (! sink->filename || ! sink->temp_filename || ! sink->buffer)
+	{
+		sink_free(sink);
+		vera_set_error(error, ENOMEM, "Out of memory writing '%s'", filename);
+		return -1;
+	}
+
+	strcpy(sink->filename, filename);
+
+	// unique per process and per file, so parallel exports of one file never share it
+	for(int i = 0; fd < 0 && i < TEMP_ATTEMPTS; i++)
+	{
+		snprintf(sink->temp_filename, length, "%s.%ld-%lu.tmp", filename, (long) getpid(),
+				__atomic_add_fetch(&temp_counter, 1, __ATOMIC_RELAXED));
+
+		fd = open(sink->temp_filename, O_RDWR | O_CREAT | O_EXCL | O_BINARY, 0666);
+
+		if (fd < 0 && errno != EEXIST)
+			break;
+	}
+
+	sink->fp = fd >= 0 ? fdopen(fd, "w+b") : NULL;
+
+	if (! sink->fp)
+	{
+		vera_set_error(error, errno, "Could not open '%s' for writing: %s",
+				filename, strerror(errno));
+
+		if (fd >= 0)
+		{
+			close(fd);
+			remove(sink->temp_filename);
+		}
+
+		sink_free(sink);
+		return -1;
+	}
+
+	setvbuf(sink->fp, sink->buffer, _IOFBF, VERA_SINK_BUFFER);
+
+	sink->stats = stats;
+	vera_stats_time(stats, VERA_PHASE_WRITE, start);
+
+	return 0;
+}
+
+int vera_sink_write(VeraSink *sink, const void *data, size_t length, VeraError *error)
+{
+	int64_t start = vera_stats_now();
+	int ret = 0;
+
+	if (length && fwrite(data, length, 1, sink->fp) != 1)
+		ret = set_write_error(error, sink->filename);
+
+	vera_stats_time(sink->stats, VERA_PHASE_WRITE, start);
+
+	return ret;
+}
+
+int vera_sink_flush(VeraSink *sink, int ret, VeraError *error)
+{
+	int64_t start = vera_stats_now();
+
+	// a full disk can show up only once the buffer is written
+	if ((fflush(sink->fp) != 0 || ferror(sink->fp)) && ret == 0)
+		ret = set_write_error(error, sink->filename);
+
+	vera_stats_time(sink->stats, VERA_PHASE_WRITE, start);
+
+	return ret;
+}
+
+int vera_sink_commit(VeraSink *sink, int ret, int *skipped, VeraError *error)
+{
+	VeraStats *stats = sink->stats;
+	int64_t start;
+	long size;
+
+	*skipped = 0;
+
+	ret = vera_sink_flush(sink, ret, error);
+
+	start = vera_stats_now();
+
+	if (ret == 0 && same_contents(sink->fp, sink->filename))
+	{
+		*skipped = 1;
+		vera_sink_discard(sink);
+		vera_stats_count(stats, VERA_FILES_UNCHANGED, 1);
+		vera_stats_time(stats, VERA_PHASE_WRITE, start);
+		return 0;
+	}
+
+	// same_contents left the position anywhere
+	size = fseek(sink->fp, 0, SEEK_END) == 0 ? ftell(sink->fp) : 0;
+
+	// the data has to be on disk before the name points at it
+	if (ret == 0 && sync_file(sink->fp) != 0)
+		ret = set_write_error(error, sink->filename);
+
+	if (fclose(sink->fp) != 0 && ret == 0)
+		ret = set_write_error(error, sink->filename);
+
+	sink->fp = NULL;
+
+	if (ret != 0)
+	{
+		vera_sink_discard(sink);
+		vera_stats_time(stats, VERA_PHASE_WRITE, start);
+		return ret;
+	}
+
+#ifdef _WIN32
+	// rename does not replace files on Windows
+	remove(sink->filename);
+#endif
+
+	if (rename(sink->temp_filename, sink->filename) != 0)
+	{
+		vera_set_error(error, errno, "Could not replace '%s': %s",
+				sink->filename, strerror(errno));
+		vera_sink_discard(sink);
+		vera_stats_time(stats, VERA_PHASE_WRITE, start);
+		return -1;
+	}
+
+	sink_free(sink);
+
+	vera_stats_count(stats, VERA_FILES_WRITTEN, 1);
+	vera_stats_count(stats, VERA_BYTES_OUT, size);
+	vera_stats_time(stats, VERA_PHASE_WRITE, start);
+
+	return 0;
+}
+
+void vera_sink_discard(VeraSink *sink)
+{
+	if (sink->fp)
+		fclose(sink->fp);
+
+	sink->fp = NULL;
+
+	if (sink->temp_filename)
+		remove(sink->temp_filename);
+
+	sink_free(sink);
+}
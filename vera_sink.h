@@ -0,0 +1,57 @@
+#ifndef VERA_SINK_H
+#define VERA_SINK_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "vera_export.h"
+#include "vera_stats.h"
+
+/*
+ * Output files.  A sink writes through a large buffer to a new file with a
+ * unique name next to the one it replaces, so a file is written out while
+ * it is packed and never has to sit in memory whole.  Committing it syncs
+ * the data to disk and renames it over the old file in one step, so a
+ * crash, a failed export or another process writing the same file never
+ * leaves a partial file under the real name.  A file that comes out the
+ * same as the old one is dropped instead, and the old file keeps its
+ * modification time.
+ */
+
+#define VERA_SINK_BUFFER  (256 * 1024)
+
+typedef struct
+{
+	FILE       *fp;          /* the temporary file, for writers that need stdio */
+	char       *filename;
+	char       *temp_filename;
+	char       *buffer;
+	VeraStats  *stats;       /* where writing is timed and counted, or NULL */
+} VeraSink;
+
+/*
+ * Creates the temporary file for filename, adding to stats unless it is
+ * NULL.  Returns 0, or -1 with error set.
+ */
+int vera_sink_open(VeraSink *sink, const char *filename, VeraStats *stats, VeraError *error);
+
+int vera_sink_write(VeraSink *sink, const void *data, size_t length, VeraError *error);
+
+/*
+ * Writes out what is buffered, so the file can be read back through fp.
+ * Returns ret, or -1 if ret was 0 and anything written so far failed.
+ */
+int vera_sink_flush(VeraSink *sink, int ret, VeraError *error);
+
+/*
+ * When ret is 0, replaces filename with what was written, or leaves it
+ * alone and sets *skipped if it holds the same; otherwise only removes the
+ * temporary file.  Either way the sink is freed.  Returns ret, or -1 if
+ * ret was 0 and the file could not be replaced.
+ */
+int vera_sink_commit(VeraSink *sink, int ret, int *skipped, VeraError *error);
+
+/* removes the temporary file and frees the sink */
+void vera_sink_discard(VeraSink *sink);
+
+#endif
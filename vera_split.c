@@ -0,0 +1,124 @@
+#include "vera_split.h"
+
+#include <errno.h>
+#include <stdlib.h>
+
+#include "vera_sprite.h"
+
+// the chunk count is a single byte
+#define MAX_CHUNKS  255
+
+static uint8_t *put_le(uint8_t *p, size_t v, int bytes)
+{
+	for(int i = 0; i < bytes; i++)
+		p[i] = (v >> (i * 8)) & 0xff;
+
+	return p + bytes;
+}
+
+int vera_split_plan(const char *filename,
+		size_t               length,
+		size_t               unit,
+		const VeraSaveVals  *vals,
+		VeraSplitChunk     **chunks,
+		int                 *count,
+		VeraError           *error)
+{
+	size_t step = VERA_SPLIT_BANK_SIZE;
+	size_t n;
+
+	*chunks = NULL;
+	*count = 0;
+
+	if (vals->first_bank < 0 || vals->first_bank > VERA_SPLIT_MAX_BANK)
+	{
+		vera_set_error(error, EINVAL, "Bank %d is not a banked RAM bank, they go from 0 to %d",
+				vals->first_bank, VERA_SPLIT_MAX_BANK);
+		return -1;
+	}
+
+	// a chunk ends on a whole tile or row unless tiles may be split
+	if (! vals->split_tiles)
+	{
+		if (unit > VERA_SPLIT_BANK_SIZE)
+		{
+			vera_set_error(error, EINVAL,
+					"The %zu byte tiles or rows of '%s' do not fit a %d byte bank without split-tiles",
+					unit, filename, VERA_SPLIT_BANK_SIZE);
+			return -1;
+		}
+
+		step -= step % unit;
+	}
+
+	n = (length + step - 1) / step;
+
+	if (n > MAX_CHUNKS || n > (size_t) (VERA_SPLIT_MAX_BANK - vals->first_bank + 1))
+	{
+		vera_set_error(error, EFBIG, "'%s' needs %zu banks from bank %d on, more than there are",
+				filename, n, vals->first_bank);
+		return -1;
+	}
+
+	if (vals->vram_address < 0 || (size_t) vals->vram_address + length > VERA_VRAM_SIZE)
+	{
+		vera_set_error(error, EFBIG, "'%s' does not fit below VRAM address 0x%05x",
+				filename, VERA_VRAM_SIZE);
+		return -1;
+	}
+
+	*chunks = malloc(n * sizeof(VeraSplitChunk) + 1);
+	if (! *chunks)
+	{
+		vera_set_error(error, ENOMEM, "Out of memory splitting '%s' into banks", filename);
+		return -1;
+	}
+
+	for(size_t i = 0; i < n; i++)
+	{
+		VeraSplitChunk *chunk = &(*chunks)[i];
+
+		chunk->bank = vals->first_bank + i;
+		chunk->start = i * step;
+		chunk->length = length - chunk->start < step ? length - chunk->start : step;
+	}
+
+	*count = n;
+
+	return 0;
+}
+
+size_t vera_split_descriptor(const VeraSplitChunk *chunks,
+		int                 count,
+		const VeraSaveVals *vals,
+		uint8_t            *dst)
+{
+	uint8_t *p = dst;
+
+	for(int i = 0; i < count; i++)
+	{
+		// each bank file holds its chunk from the start
+		size_t offset = vals->bank_split == VERA_SPLIT_TABLE ? chunks[i].start : 0;
+
+		p = put_le(p, chunks[i].bank, 1);
+		p = put_le(p, offset, 4);
+		p = put_le(p, chunks[i].length, 2);
+		p = put_le(p, vals->vram_address + chunks[i].start, 3);
+	}
+
+	return p - dst;
+}
+
+size_t vera_split_table(const VeraSplitChunk *chunks, int count, uint8_t *dst)
+{
+	uint8_t *p = dst;
+
+	for(int i = 0; i < count; i++)
+	{
+		p = put_le(p, chunks[i].bank, 1);
+		p = put_le(p, chunks[i].start, 4);
+		p = put_le(p, chunks[i].length, 2);
+	}
+
+	return p - dst;
+}
@@ -0,0 +1,75 @@
+#ifndef VERA_SPLIT_H
+#define VERA_SPLIT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "vera_export.h"
+
+/*
+ * Banked RAM splits.  The X16 maps one 8 KB bank of high RAM at $A000, so
+ * data larger than that is staged over several banks before it is copied to
+ * VRAM.  The data of a binary is cut into chunks of at most a bank, each
+ * ending on a whole tile or bitmap row unless split-tiles allows otherwise,
+ * and written as one file per bank (filename.B01, ...) or as filename.BANKS:
+ *
+ *   [2 byte header] u8 count, count * { u8 bank, u32 offset, u16 length },
+ *                   chunks
+ *
+ * with offsets counted from the end of the table.  filename.BNK describes
+ * the chunks either way:
+ *
+ *   [2 byte header] u8 count,
+ *                   count * { u8 bank, u32 offset, u16 length, u24 VRAM address }
+ *
+ * where offset is where the chunk starts in its file, after the header and
+ * any table, and the VRAM address is where it is copied to.  Values are
+ * little endian.  The data has to fit the 128 KB of VRAM, so there are at
+ * most 16 chunks.
+ */
+
+#define VERA_SPLIT_BANK_SIZE    8192
+#define VERA_SPLIT_MAX_BANK     255
+#define VERA_SPLIT_ENTRY        10
+#define VERA_SPLIT_TABLE_ENTRY  7
+
+typedef enum
+{
+	VERA_SPLIT_NONE = 0,
+	VERA_SPLIT_FILES = 1,      /* one file per bank */
+	VERA_SPLIT_TABLE = 2       /* one file with a bank index table */
+} VeraSplitMode;
+
+typedef struct
+{
+	int     bank;
+	size_t  start;             /* where the chunk starts in the data */
+	size_t  length;
+} VeraSplitChunk;
+
+/*
+ * Cuts length bytes of data made of unit byte tiles or rows into chunks,
+ * from vals->first_bank on.  *chunks is malloc'ed and holds *count chunks.
+ * filename only names the output in errors.  Returns 0, or -1 with error set.
+ */
+int vera_split_plan(const char *filename,
+		size_t               length,
+		size_t               unit,
+		const VeraSaveVals  *vals,
+		VeraSplitChunk     **chunks,
+		int                 *count,
+		VeraError           *error);
+
+/*
+ * Writes the count entries of the .BNK descriptor, VERA_SPLIT_ENTRY bytes
+ * each, or of the .BANKS table, VERA_SPLIT_TABLE_ENTRY bytes each, into dst.
+ * Returns the bytes written.
+ */
+size_t vera_split_descriptor(const VeraSplitChunk *chunks,
+		int                 count,
+		const VeraSaveVals *vals,
+		uint8_t            *dst);
+
+size_t vera_split_table(const VeraSplitChunk *chunks, int count, uint8_t *dst);
+
+#endif
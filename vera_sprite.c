@@ -0,0 +1,40 @@
+#include "vera_sprite.h"
+
+#include "vera_dedup.h"
+
+// 8, 16, 32 and 64 pixels become 0 to 3
+static int size_code(int size)
+{
+	int code = 0;
+
+	while (size > 8)
+	{
+		size >>= 1;
+		code++;
+	}
+
+	return code;
+}
+
+void vera_sprite_attributes(uint8_t *attr,
+		uint32_t  address,
+		int       bpp,
+		int       width,
+		int       height,
+		uint8_t   flip,
+		int       palette_offset)
+{
+	attr[0] = (address >> 5) & 0xff;
+	attr[1] = (bpp == 8 ? 0x80 : 0x00) | ((address >> 13) & 0x0f);
+
+	// x and y
+	attr[2] = 0;
+	attr[3] = 0;
+	attr[4] = 0;
+	attr[5] = 0;
+
+	attr[6] = VERA_SPRITE_Z_FRONT << 2
+		| (flip & VERA_TILE_VFLIP ? 0x02 : 0x00)
+		| (flip & VERA_TILE_HFLIP ? 0x01 : 0x00);
+	attr[7] = size_code(height) << 6 | size_code(width) << 4 | (palette_offset & 0x0f);
+}
@@ -0,0 +1,35 @@
+#ifndef VERA_SPRITE_H
+#define VERA_SPRITE_H
+
+#include <stdint.h>
+
+/*
+ * VERA sprite attributes.
+ *
+ * Each of the 128 sprites is described by 8 bytes in VRAM: the address of its
+ * pixels in 32 byte units, the color mode, its position, the collision mask,
+ * Z-depth and flips, and finally its size and palette offset.  Sprite pixels
+ * are 4bpp or 8bpp, laid out row after row like a tile.
+ */
+
+#define VERA_SPRITE_ATTR_SIZE   8
+#define VERA_SPRITE_ALIGN       32
+#define VERA_VRAM_SIZE          0x20000
+
+/* in front of both layers */
+#define VERA_SPRITE_Z_FRONT     3
+
+/*
+ * Writes the attributes of a sprite at VRAM address, which must be
+ * VERA_SPRITE_ALIGN aligned.  flip holds the VERA_TILE_HFLIP and
+ * VERA_TILE_VFLIP bits of a tile map entry.  The position is left at 0.
+ */
+void vera_sprite_attributes(uint8_t *attr,
+		uint32_t  address,
+		int       bpp,
+		int       width,
+		int       height,
+		uint8_t   flip,
+		int       palette_offset);
+
+#endif
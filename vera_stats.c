@@ -0,0 +1,115 @@
+#include "vera_stats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static const char * const phase_names[VERA_PHASES] =
+{
+	"load_ms", "export_ms", "read_ms", "compress_ms", "write_ms"
+};
+
+static const char * const counter_names[VERA_COUNTERS] =
+{
+	"bytes_in", "bytes_out", "files_written", "files_unchanged", "pdb_calls"
+};
+
+int64_t vera_stats_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void vera_stats_time(VeraStats *stats, VeraPhase phase, int64_t start)
+{
+	if (stats)
+		__atomic_add_fetch(&stats->ns[phase], vera_stats_now() - start, __ATOMIC_RELAXED);
+}
+
+void vera_stats_count(VeraStats *stats, VeraCounter counter, int64_t n)
+{
+	if (stats)
+		__atomic_add_fetch(&stats->counters[counter], n, __ATOMIC_RELAXED);
+}
+
+/* appends text as a JSON string to p, which has room for 6 bytes per byte of text */
+static char *put_string(char *p, const char *text)
+{
+	*p++ = '"';
+
+	for(; *text; text++)
+	{
+		unsigned char c = *text;
+
+		if (c == '"' || c == '\\')
+		{
+			*p++ = '\\';
+			*p++ = c;
+		}
+		else if (c < 0x20)
+		{
+			p += sprintf(p, "\\u%04x", c);
+		}
+		else
+		{
+			*p++ = c;
+		}
+	}
+
+	*p++ = '"';
+
+	return p;
+}
+
+int vera_stats_emit(const VeraStats *stats,
+		const char *tool,
+		const char *output,
+		const char *error)
+{
+	const char *path = getenv(VERA_STATS_ENV);
+	size_t length = 6 * (strlen(tool) + strlen(output) + (error ? strlen(error) : 0)) + 512;
+	char *line = malloc(length);
+	char *p = line;
+	FILE *fp;
+	int ret = 0;
+
+	if (! line)
+		return -1;
+
+	p += sprintf(p, "{\"tool\":");
+	p = put_string(p, tool);
+	p += sprintf(p, ",\"output\":");
+	p = put_string(p, output);
+	p += sprintf(p, ",\"ok\":%s", error ? "false" : "true");
+
+	if (error)
+	{
+		p += sprintf(p, ",\"error\":");
+		p = put_string(p, error);
+	}
+
+	for(int i = 0; i < VERA_PHASES; i++)
+		p += sprintf(p, ",\"%s\":%.3f", phase_names[i], stats->ns[i] / 1e6);
+
+	for(int i = 0; i < VERA_COUNTERS; i++)
+		p += sprintf(p, ",\"%s\":%lld", counter_names[i], (long long) stats->counters[i]);
+
+	p += sprintf(p, "}\n");
+
+	// one write per line, so exports appending to the same file do not interleave
+	fp = path && *path ? fopen(path, "a") : stderr;
+
+	if (! fp || fwrite(line, p - line, 1, fp) != 1 || fflush(fp) != 0)
+		ret = -1;
+
+	if (fp && fp != stderr)
+		fclose(fp);
+
+	free(line);
+
+	return ret;
+}
@@ -0,0 +1,62 @@
+#ifndef VERA_STATS_H
+#define VERA_STATS_H
+
+#include <stdint.h>
+
+/*
+ * Export instrumentation.  An export can carry a VeraStats through its
+ * VeraArtifacts, and the exporters add to it from whatever thread they run
+ * on.  load and export are wall times measured by the caller; read,
+ * compress and write are summed over every thread, so with parallel
+ * packing they can add up to more than the export took.
+ */
+
+typedef enum
+{
+	VERA_PHASE_LOAD = 0,     /* loading the image and fetching what the export reads */
+	VERA_PHASE_EXPORT,       /* the whole vera_export call */
+	VERA_PHASE_READ,         /* pixels read from the source while packing */
+	VERA_PHASE_COMPRESS,     /* LZSA2 compression of the binaries */
+	VERA_PHASE_WRITE,        /* writing, syncing and replacing output files */
+	VERA_PHASES
+} VeraPhase;
+
+typedef enum
+{
+	VERA_BYTES_IN = 0,       /* bytes of pixels read from the source */
+	VERA_BYTES_OUT,          /* bytes of the output files that were replaced */
+	VERA_FILES_WRITTEN,
+	VERA_FILES_UNCHANGED,    /* files left alone as their contents did not change */
+	VERA_PDB_CALLS,          /* GIMP procedure calls, from the plugin only */
+	VERA_COUNTERS
+} VeraCounter;
+
+typedef struct
+{
+	int64_t  ns[VERA_PHASES];
+	int64_t  counters[VERA_COUNTERS];
+} VeraStats;
+
+#define VERA_STATS_ENV  "VERA_STATS_FILE"
+
+/* a monotonic clock in nanoseconds */
+int64_t vera_stats_now(void);
+
+/* adds the time since start to phase; stats may be NULL */
+void vera_stats_time(VeraStats *stats, VeraPhase phase, int64_t start);
+
+/* adds n to counter; stats may be NULL */
+void vera_stats_count(VeraStats *stats, VeraCounter counter, int64_t n);
+
+/*
+ * Writes stats as one line of JSON, appended to the file named by the
+ * VERA_STATS_FILE environment variable, or to stderr.  tool names the
+ * program and output the file exported; error is the reason it failed, or
+ * NULL.  Returns 0, or -1 if the line could not be written.
+ */
+int vera_stats_emit(const VeraStats *stats,
+		const char *tool,
+		const char *output,
+		const char *error);
+
+#endif
@@ -0,0 +1,59 @@
+#include "vera_threads.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+
+typedef struct
+{
+	pthread_mutex_t  lock;
+	VeraTaskFunc     func;
+	void            *data;
+	int              count;
+	int              next;
+} Tasks;
+
+static void *run_thread(void *user_data)
+{
+	Tasks *tasks = user_data;
+
+	for(;;)
+	{
+		int index;
+
+		pthread_mutex_lock(&tasks->lock);
+		index = tasks->next++;
+		pthread_mutex_unlock(&tasks->lock);
+
+		if (index >= tasks->count)
+			return NULL;
+
+		tasks->func(tasks->data, index);
+	}
+}
+
+void vera_run_threads(void *user_data, VeraTaskFunc func, void *data, int count)
+{
+	int n_threads = *(const int *) user_data;
+	Tasks tasks = { PTHREAD_MUTEX_INITIALIZER, func, data, count, 0 };
+	pthread_t *threads;
+	int started = 0;
+
+	if (n_threads > count)
+		n_threads = count;
+
+	threads = malloc(sizeof(pthread_t) * n_threads);
+
+	for(int i = 0; threads && i < n_threads - 1; i++)
+	{
+		if (pthread_create(&threads[started], NULL, run_thread, &tasks) != 0)
+			break;
+		started++;
+	}
+
+	run_thread(&tasks);
+
+	for(int i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+
+	free(threads);
+}
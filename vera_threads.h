@@ -0,0 +1,14 @@
+#ifndef VERA_THREADS_H
+#define VERA_THREADS_H
+
+#include "vera_export.h"
+
+/*
+ * A VeraRunner run function on POSIX threads, for the tools built without
+ * GLib.  user_data points at the int number of threads to use, the calling
+ * thread included, and tasks left over after a failed thread start run on
+ * the calling thread.
+ */
+void vera_run_threads(void *user_data, VeraTaskFunc func, void *data, int count);
+
+#endif
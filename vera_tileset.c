@@ -2,18 +2,32 @@
 #include <libgimp/gimpui.h>
 
 #include <errno.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
-#include <libxml/encoding.h>
-#include <libxml/xmlwriter.h>
+#include <libxml/parser.h>
+
+#include "vera_export.h"
+#include "vera_dither.h"
+#include "vera_plan.h"
+#include "vera_region.h"
+#include "vera_shared.h"
+#include "vera_stats.h"
 
 #define SAVE_PROC	"file-vera-save"
+#define SAVE2_PROC	"file-vera-save2"
+#define BATCH_PROC	"file-vera-save-batch"
 #define PLUG_IN_BINARY   "file-vera"
 #define VERA_DEFAULTS_PARASITE  "vera-save-defaults"
 
 #define VERA_COLORMAP_CONVERT	"plug-in-vera-colormap-convert"
 
+#define DITHER_STRIP_HEIGHT  64   /* rows of a dithered drawable read at once */
+
+// counts a PDB call in pdb_calls, for the export statistics
+#define PDB_CALL(call)  (pdb_calls++, (call))
+
 static void query(void);
 static void run(const gchar      *name,
 		gint              nparams,
@@ -21,74 +35,39 @@ static void run(const gchar      *name,
 		gint             *nreturn_vals,
 		GimpParam       **return_vals);
 
-static gboolean save_tile_set(const gchar  *filename,
-		gint32        image_id,
-		gint32        drawable_id,
-		GError      **error);
-
-static gboolean save_bitmap(const gchar  *filename,
-		gint32        image_id,
-		gint32        drawable_id,
-		GError      **error);
-
-static gboolean save_tsx(const gchar *filename,
-		const gchar *bmp_filename,
-		GimpRunMode   run_mode,
-		gint32        image_id,
-		gint32        drawable_id,
-		GError      **error);
-
-static gboolean save_palette(const gchar *filename,
-		const guchar      *cmap,
-		const gint        palsize,
-		GError      **error);
-
-static void shift_color_map(guchar* orig,
-		guchar** shifted,
-		gint palsize,
-		gint offset);
-
-typedef enum
-{
-	TILESET = 0,
-	BITMAP = 1
-} VeraExport;
-
-typedef enum
-{
-	TILE_1BPP = 1,
-	TILE_2BPP = 2,
-	TILE_4BPP = 4,
-	TILE_8BPP = 8
-} TileBpp;
-
-typedef enum
-{
-	TILE_WIDTH_8 = 8,
-	TILE_WIDTH_16 = 16,
-	TILE_WIDTH_32 = 32,
-	TILE_WIDTH_64 = 64
-} TileWidth;
-
-typedef enum
+/*
+ * A drawable as the exporters see it.  Everything is fetched up front so
+ * that the export itself makes no PDB calls and can run on any thread.
+ */
+typedef struct
 {
-	TILE_HEIGHT_8 = 8,
-	TILE_HEIGHT_16 = 16,
-	TILE_HEIGHT_32 = 32,
-	TILE_HEIGHT_64 = 64
-} TileHeight;
-
+	VeraImage      image;
+	GeglBuffer    *buffer;
+	const Babl    *format;
+	gint           bpp;       /* bytes per pixel of format */
+	guchar        *cmap;
+	VeraDitherer  *dither;    /* maps the pixels of an RGB drawable to cmap */
+	GMutex         lock;
+	guchar        *indices;   /* the whole drawable once dithered, or NULL */
+	VeraStats     *stats;     /* where reads are timed and counted, or NULL */
+	gint           x;         /* where image starts in the buffer, for regions */
+	gint           y;
+	gboolean       alpha;     /* collision masks: solid where opaque rather than lit */
+} VeraDrawable;
+
+/*
+ * What an export reads: the drawable being saved, every visible layer of
+ * the image, bottom first, when exporting frames, or the regions of the
+ * drawable that make up an atlas.
+ */
 typedef struct
 {
-	gboolean       file_header;
-	VeraExport     export_type;	 /* tileset or bitmap */
-	TileBpp        tile_bpp;     /* Bits per pixel format for tiles */
-	TileWidth      tile_width;
-	TileHeight     tile_height;
-	gboolean       tiled_file;
-	gboolean       bmp_file;
-	gboolean       pal_file;
-} VeraSaveVals;
+	VeraDrawable  *drawables;
+	VeraImage     *images;
+	gint           count;
+	gboolean       atlas;
+	VeraDrawable  *collision; /* the collision layer of a tile set, or NULL */
+} VeraSource;
 
 typedef struct
 {
@@ -107,15 +86,28 @@ typedef struct
 	GtkWidget *tile_height_16;
 	GtkWidget *tile_height_32;
 	GtkWidget *tile_height_64;
-	GtkWidget *no_tiled_file;
 	GtkWidget *tiled_file;
 	GtkWidget *bmp_file;
 	GtkWidget *pal_file;
+	GtkWidget *dedup_tiles;
+	GtkWidget *palette_banks;
 
 	// selector dialog
 	GtkWidget *file_header;
+	GtkWidget *export_cache;
+	GtkWidget *frames;
+	GtkWidget *delta_frames;
+	GtkWidget *compress;
+	GtkWidget *dither_none;
+	GtkWidget *dither_floyd_steinberg;
+	GtkWidget *dither_atkinson;
+	GtkWidget *dither_bayer_4;
+	GtkWidget *dither_bayer_8;
+	GtkWidget *dither_tiles;
+	GtkWidget *patch_file;
 	GtkWidget *tileset_export;
 	GtkWidget *bitmap_export;
+	GtkWidget *sprite_export;
 } VeraSaveGui;
 
 GimpPlugInInfo PLUG_IN_INFO =
@@ -126,18 +118,13 @@ GimpPlugInInfo PLUG_IN_INFO =
 	run
 };
 
-static const VeraSaveVals defaults =
-{
-	TILESET,
-	TILE_4BPP,
-	TILE_WIDTH_8,
-	TILE_HEIGHT_8,
-	TRUE,
-	TRUE,
-	TRUE
-};
-
 static VeraSaveVals veravals;
+static const gchar *palette_file;   /* target palette of RGB drawables, or NULL */
+static const gchar *regions_spec;   /* "selection", "guides" or a region list, or NULL */
+static const gchar *collision_layer; /* layer holding the collision mask, or NULL */
+static gint pool_threads = 1;   /* GIMP's "Number of threads to use" preference */
+static gint pdb_calls;          /* PDB calls made so far, all from the main thread */
+static gint gimp_threads(void);
 static gboolean save_tiles_dialog(gint32 image_id);
 static gboolean save_bitmap_dialog(gint32 image_id);
 static gboolean save_selector_dialog(gint32 image_id);
@@ -148,6 +135,54 @@ static void load_defaults(void);
 static void save_defaults(void);
 static void load_gui_defaults(VeraSaveGui *vg);
 
+static gboolean vera_drawable_init(VeraDrawable *drawable,
+		gint32              image_id,
+		gint32              drawable_id,
+		const VeraRegion   *region,
+		const VeraSaveVals *vals,
+		VeraStats          *stats,
+		GError            **error);
+
+static void vera_drawable_clear(VeraDrawable *drawable);
+
+static gboolean vera_source_init(VeraSource *source,
+		gint32              image_id,
+		gint32              drawable_id,
+		const VeraRegion   *regions,
+		gint                n_regions,
+		const VeraSaveVals *vals,
+		VeraStats          *stats,
+		GError            **error);
+
+static void vera_source_clear(VeraSource *source);
+
+static gboolean collision_init(VeraSource *source,
+		gint32              image_id,
+		gint32              drawable_id,
+		const gchar        *layer_name,
+		const VeraSaveVals *vals,
+		VeraStats          *stats,
+		GError            **error);
+
+static gboolean get_regions(gint32            image_id,
+		const VeraSaveVals  *vals,
+		VeraRegion         **regions,
+		gint                *count,
+		gboolean            *atlas,
+		GError             **error);
+
+static gboolean export_vera(const gchar        *filename,
+		const VeraSource   *source,
+		const VeraSaveVals *vals,
+		VeraStats          *stats,
+		gint               *unchanged,
+		GError            **error);
+
+static gboolean save_batch(const gchar  *manifest,
+		gint         *failed,
+		gchar       **report,
+		GError      **error);
+
 MAIN()
 
 static void query (void)
@@ -159,7 +194,7 @@ static void query (void)
 		{ GIMP_PDB_DRAWABLE, "drawable",	"Drawable to export" },
 		{ GIMP_PDB_STRING,   "filename",	"The name of the file to export the image to" },
 		{ GIMP_PDB_STRING,   "raw-filename",	"The name of the file to export the image to" },
-		{ GIMP_PDB_INT32,   "export-type",	"0 - Tileset, 1 - Bitmap" },
+		{ GIMP_PDB_INT32,   "export-type",	"0 - Tileset, 1 - Bitmap, 2 - Sprites" },
 		{ GIMP_PDB_INT32,   "file-header",	"0 - no 2-byte header, 1 - 2-byte header" },
 		{ GIMP_PDB_INT32,   "tile-bpp",		"Bits per pixel" },
 		{ GIMP_PDB_INT32,   "tile-width",	"Tile width" },
@@ -169,6 +204,43 @@ static void query (void)
 		{ GIMP_PDB_INT32,   "PAL-file",		"Create a PAL palette file" }
 	};
 
+	/* file-vera-save keeps its signature for existing scripts, newer options go here */
+	static const GimpParamDef save2_args[] =
+	{
+		{ GIMP_PDB_INT32,    "run-mode",	"The run mode { RUN-INTERACTIVE (0), RUN-NONINTERACTIVE (1) }" },
+		{ GIMP_PDB_IMAGE,    "image",		"Input image" },
+		{ GIMP_PDB_DRAWABLE, "drawable",	"Drawable to export" },
+		{ GIMP_PDB_STRING,   "filename",	"The name of the file to export the image to" },
+		{ GIMP_PDB_STRING,   "raw-filename",	"The name of the file to export the image to" },
+		{ GIMP_PDB_INT32,   "export-type",	"0 - Tileset, 1 - Bitmap, 2 - Sprites" },
+		{ GIMP_PDB_INT32,   "file-header",	"0 - no 2-byte header, 1 - 2-byte header" },
+		{ GIMP_PDB_INT32,   "tile-bpp",		"Bits per pixel" },
+		{ GIMP_PDB_INT32,   "tile-width",	"Tile width" },
+		{ GIMP_PDB_INT32,   "tile-height",	"Tile height" },
+		{ GIMP_PDB_INT32,   "Tiled-file",	"Create a Tiled tile set file" },
+		{ GIMP_PDB_INT32,   "BMP-file",		"Create a BMP output file" },
+		{ GIMP_PDB_INT32,   "PAL-file",		"Create a PAL palette file" },
+		{ GIMP_PDB_INT32,   "dedup-tiles",	"Write unique tiles only (matching flipped tiles too) and a .MAP tile map" },
+		{ GIMP_PDB_INT32,   "palette-banks",	"2/4bpp: pack tile colors into 16 color palette banks, implies dedup-tiles" },
+		{ GIMP_PDB_INT32,   "export-cache",	"Keep a .vcache file and skip the export when the image and settings are unchanged" },
+		{ GIMP_PDB_INT32,   "frames",		"Export every visible layer, bottom first, as one frame of a single file" },
+		{ GIMP_PDB_INT32,   "vram-address",	"The VRAM address the file is loaded to, for the .SPR sprite attributes and .PATCH records" },
+		{ GIMP_PDB_INT32,   "compress",		"LZSA2 compress the binaries, after the header and a 4 byte uncompressed size" },
+		{ GIMP_PDB_STRING,  "palette-file",	"RGB images: the .PAL file whose colors they are mapped to, or \"\" for the active palette" },
+		{ GIMP_PDB_INT32,   "dither",		"RGB images: 0 - none, 1 - Floyd-Steinberg, 2 - Atkinson, 3 - Bayer 4x4, 4 - Bayer 8x8" },
+		{ GIMP_PDB_INT32,   "dither-tiles",	"Keep the error diffusion inside each tile, so tiles that repeat still match" },
+		{ GIMP_PDB_INT32,   "patch-file",	"Write a .PATCH of the tiles or bitmap rows that changed since the last export" },
+		{ GIMP_PDB_STRING,  "regions",	"\"selection\" to export the selection, \"guides\" or a region list file for an atlas, or \"\" for the whole drawable" },
+		{ GIMP_PDB_STRING,  "collision-layer",	"Tile sets: the layer whose opaque pixels are written as a .MASK and .COL collision mask, or \"\" for none" },
+		{ GIMP_PDB_INT32,   "delta-frames",	"Frames: write the first frame whole and only the tiles that changed in the others, plus a .UPL upload list" },
+		{ GIMP_PDB_INT32,   "vblank-bytes",	"Delta frames: the tile bytes the upload list copies to VRAM per vblank" },
+		{ GIMP_PDB_INT32,   "frame-palettes",	"Video: frames load their palette when their colors change" },
+		{ GIMP_PDB_INT32,   "frame-bytes",	"Video: the bytes a frame can take to stream in time, reported in the .csv, or 0 for no limit" },
+		{ GIMP_PDB_INT32,   "bank-split",	"Cut the data into 8 KB banked RAM chunks: 0 - no, 1 - one file per bank, 2 - one .BANKS file; a .BNK lists them" },
+		{ GIMP_PDB_INT32,   "split-tiles",	"Bank split: fill every bank, even if a tile or bitmap row is cut in two" },
+		{ GIMP_PDB_INT32,   "first-bank",	"Bank split: the banked RAM bank of the first chunk" }
+	};
+
 	gimp_install_procedure (SAVE_PROC,
 			"Exports files in VERA compatible binaries",
 			"This plug-in exports binary files for VERA chips.",
@@ -176,13 +248,66 @@ static void query (void)
 			"Copyright 2021-2022 by Jestin Stoffel",
 			"0.0.1 - 2021",
 			"VERA tile set",
-			"INDEXED*",
+			"INDEXED*, RGB*",
 			GIMP_PLUGIN,
 			G_N_ELEMENTS (save_args),
 			0,
 			save_args,
 			NULL);
 
+	gimp_install_procedure (SAVE2_PROC,
+			"Exports files in VERA compatible binaries",
+			"This plug-in exports binary files for VERA chips.  "
+			"It is file-vera-save with additional export options.",
+			"Jestin Stoffel <jestin.stoffel@gmail.com>",
+			"Copyright 2021-2022 by Jestin Stoffel",
+			"0.0.1 - 2021",
+			NULL,
+			"INDEXED*, RGB*",
+			GIMP_PLUGIN,
+			G_N_ELEMENTS (save2_args),
+			0,
+			save2_args,
+			NULL);
+
+	static const GimpParamDef batch_args[] =
+	{
+		{ GIMP_PDB_INT32,    "run-mode",	"The run mode { RUN-NONINTERACTIVE (1) }" },
+		{ GIMP_PDB_STRING,   "manifest",	"File listing one asset per line: source output export-type file-header "
+							"tile-bpp tile-width tile-height Tiled-file BMP-file PAL-file [dedup-tiles [palette-banks [export-cache [frames [vram-address [compress [dither [dither-tiles [patch-file [delta-frames [vblank-bytes [frame-palettes [frame-bytes [bank-split [split-tiles [first-bank]]]]]]]]]]]]]]]]" }
+	};
+
+	static const GimpParamDef batch_return[] =
+	{
+		{ GIMP_PDB_INT32,    "failed",	"Number of assets that failed to export" },
+		{ GIMP_PDB_STRING,   "report",	"One line per asset with its status and timing" }
+	};
+
+	gimp_install_procedure (BATCH_PROC,
+			"Exports a list of images to VERA compatible binaries",
+			"Loads and exports every asset listed in a manifest file in one "
+			"GIMP session.  Each line holds the source image, the output file "
+			"and the file-vera-save2 export settings, separated by spaces; "
+			"names with spaces can be quoted and lines starting with # are "
+			"ignored.  Assets are packed and written concurrently.  Lines "
+			"starting with @ plan the exported files into VRAM: "
+			"@c-header FILE and @ca65 FILE write the addresses, "
+			"@vram START END limits the VRAM used.  "
+			"@shared-palette NAME merges the palettes of the assets "
+			"after it into NAME.PAL, and @collision-layer NAME has "
+			"the tile sets after it write the collision mask in "
+			"that layer.",
+			"Jestin Stoffel <jestin.stoffel@gmail.com>",
+			"Copyright 2021-2022 by Jestin Stoffel",
+			"0.0.1 - 2021",
+			NULL,
+			NULL,
+			GIMP_PLUGIN,
+			G_N_ELEMENTS (batch_args),
+			G_N_ELEMENTS (batch_return),
+			batch_args,
+			batch_return);
+
 	gimp_register_file_handler_mime (SAVE_PROC, "application/octet-stream");
 	gimp_register_save_handler (SAVE_PROC, "BIN", "");
 
@@ -224,6 +349,7 @@ static void run (const gchar      *name,
 	GimpPDBStatusType  status = GIMP_PDB_SUCCESS;
 	GError            *error  = NULL;
 	gint32             image_id;
+	gint32             orig_image_id;
 	gint32             drawable_id;
 	gchar*             filename;
 	GimpExportReturn   export = GIMP_EXPORT_CANCEL;
@@ -238,18 +364,54 @@ static void run (const gchar      *name,
 	values[0].data.d_status = GIMP_PDB_EXECUTION_ERROR;
 
 	run_mode    = param[0].data.d_int32;
-	image_id    = param[1].data.d_int32;
-	drawable_id = param[2].data.d_int32;
 
-	if (strcmp (name, SAVE_PROC) == 0)
+	// the preference is read through the PDB, so only here on the main thread
+	pool_threads = gimp_threads ();
+
+	// the batch procedure takes no image
+	image_id    = nparams > 2 ? param[1].data.d_int32 : -1;
+	drawable_id = nparams > 2 ? param[2].data.d_int32 : -1;
+
+	if (strcmp (name, BATCH_PROC) == 0)
 	{
+		gint failed = 0;
+		gchar *report = NULL;
+
+		if (nparams != 2)
+		{
+			status = GIMP_PDB_CALLING_ERROR;
+		}
+		else if (! save_batch (param[1].data.d_string, &failed, &report, &error))
+		{
+			status = GIMP_PDB_EXECUTION_ERROR;
+		}
+		else
+		{
+			*nreturn_vals = 3;
+			values[1].type          = GIMP_PDB_INT32;
+			values[1].data.d_int32  = failed;
+			values[2].type          = GIMP_PDB_STRING;
+			values[2].data.d_string = report;
+		}
+	}
+	else if (strcmp (name, SAVE_PROC) == 0 || strcmp (name, SAVE2_PROC) == 0)
+	{
+		VeraStats stats = { { 0 }, { 0 } };
+		gint first_call = pdb_calls;
+		int64_t start;
+
 		filename = param[3].data.d_string;
 
 		load_defaults ();
 
+		// frames are the layers that exporting would merge
+		orig_image_id = image_id;
+
 		/* export the image */
-		export = gimp_export_image (&image_id, &drawable_id, "VERA",
-				GIMP_EXPORT_CAN_HANDLE_INDEXED);
+		start = vera_stats_now ();
+		export = PDB_CALL (gimp_export_image (&image_id, &drawable_id, "VERA",
+				GIMP_EXPORT_CAN_HANDLE_INDEXED | GIMP_EXPORT_CAN_HANDLE_RGB));
+		vera_stats_time (&stats, VERA_PHASE_LOAD, start);
 
 		if (export == GIMP_EXPORT_CANCEL)
 		{
@@ -265,7 +427,7 @@ static void run (const gchar      *name,
 				/*
 				 * Possibly retrieve data...
 				 */
-				gimp_get_data (SAVE_PROC, &veravals);
+				PDB_CALL (gimp_get_data (SAVE_PROC, &veravals));
 
 				/*
 				 * Then acquire information with a dialog...
@@ -279,6 +441,7 @@ static void run (const gchar      *name,
 				switch(veravals.export_type)
 				{
 					case TILESET:
+					case SPRITE:
 						if (!save_tiles_dialog (image_id))
 							status = GIMP_PDB_CANCEL;
 						break;
@@ -294,7 +457,7 @@ static void run (const gchar      *name,
 				/*
 				 * Make sure all the arguments are there!
 				 */
-				if (nparams != 13)
+				if (nparams < 13)
 				{
 					status = GIMP_PDB_CALLING_ERROR;
 				}
@@ -308,6 +471,46 @@ static void run (const gchar      *name,
 					veravals.tiled_file  = param[10].data.d_int32;
 					veravals.bmp_file    = param[11].data.d_int32;
 					veravals.pal_file    = param[12].data.d_int32;
+
+					// file-vera-save2 options, defaults otherwise
+					if (nparams > 13)
+						veravals.dedup_tiles = param[13].data.d_int32;
+					if (nparams > 14)
+						veravals.palette_banks = param[14].data.d_int32;
+					if (nparams > 15)
+						veravals.export_cache = param[15].data.d_int32;
+					if (nparams > 16)
+						veravals.frames = param[16].data.d_int32;
+					if (nparams > 17)
+						veravals.vram_address = param[17].data.d_int32;
+					if (nparams > 18)
+						veravals.compress = param[18].data.d_int32;
+					if (nparams > 19 && param[19].data.d_string && *param[19].data.d_string)
+						palette_file = param[19].data.d_string;
+					if (nparams > 20)
+						veravals.dither = param[20].data.d_int32;
+					if (nparams > 21)
+						veravals.dither_tiles = param[21].data.d_int32;
+					if (nparams > 22)
+						veravals.patch_file = param[22].data.d_int32;
+					if (nparams > 23 && param[23].data.d_string && *param[23].data.d_string)
+						regions_spec = param[23].data.d_string;
+					if (nparams > 24 && param[24].data.d_string && *param[24].data.d_string)
+						collision_layer = param[24].data.d_string;
+					if (nparams > 25)
+						veravals.delta_frames = param[25].data.d_int32;
+					if (nparams > 26)
+						veravals.vblank_bytes = param[26].data.d_int32;
+					if (nparams > 27)
+						veravals.frame_palettes = param[27].data.d_int32;
+					if (nparams > 28)
+						veravals.frame_bytes = param[28].data.d_int32;
+					if (nparams > 29)
+						veravals.bank_split = param[29].data.d_int32;
+					if (nparams > 30)
+						veravals.split_tiles = param[30].data.d_int32;
+					if (nparams > 31)
+						veravals.first_bank = param[31].data.d_int32;
 				}
 				break;
 
@@ -315,7 +518,7 @@ static void run (const gchar      *name,
 				/*
 				 * Possibly retrieve data...
 				 */
-				gimp_get_data (SAVE_PROC, &veravals);
+				PDB_CALL (gimp_get_data (SAVE_PROC, &veravals));
 				break;
 
 			default:
@@ -324,113 +527,49 @@ static void run (const gchar      *name,
 
 		if (status == GIMP_PDB_SUCCESS)
 		{
-			gint palsize;
-			guchar *cmap = gimp_image_get_colormap (image_id, &palsize);
-
-			if (cmap && veravals.pal_file)
+			VeraSource  source = { NULL, NULL, 0, FALSE };
+			VeraRegion *regions = NULL;
+			gint        n_regions = 0;
+			gboolean    atlas = FALSE;
+			gboolean    loaded;
+
+			start = vera_stats_now ();
+			loaded = (! regions_spec
+					|| get_regions (orig_image_id, &veravals, &regions, &n_regions, &atlas, &error))
+				&& vera_source_init (&source, veravals.frames ? orig_image_id : image_id,
+					drawable_id, regions, n_regions, &veravals, &stats, &error);
+			source.atlas = atlas;
+
+			if (loaded && collision_layer)
+				loaded = collision_init (&source, orig_image_id, drawable_id, collision_layer,
+						&veravals, &stats, &error);
+
+			vera_stats_time (&stats, VERA_PHASE_LOAD, start);
+
+			if (loaded && export_vera (filename, &source, &veravals, &stats, NULL, &error))
 			{
-				if(!save_palette(filename, cmap, palsize, &error))
-				{
-					status = GIMP_PDB_EXECUTION_ERROR;
-				}
+				PDB_CALL (gimp_set_data (SAVE_PROC, &veravals, sizeof (veravals)));
 			}
-
-			gchar *bmp_filename = g_strconcat (filename, ".bmp", NULL);
-
-
-			switch(veravals.export_type)
+			else
 			{
-				case TILESET:
-
-					// generate images for all palettes when using 2bpp or 4bpp
-					if(veravals.tile_bpp == TILE_4BPP || veravals.tile_bpp == TILE_2BPP)
-					{
-						guchar* shifted_map = (guchar*)malloc(sizeof(guchar) * palsize * 3);
-						guchar num_palettes = palsize / 16;
-
-						for (int i = 0; i < num_palettes; i++)
-						{
-
-							shift_color_map(cmap, &shifted_map, palsize, i*16);
-							gimp_image_set_colormap(image_id, shifted_map, palsize);
-							gchar* number_string = malloc(sizeof(gchar) * 3);
-							sprintf(number_string, "%d", i);
-							gchar *numbered_filename = g_strconcat(filename, ".", number_string, NULL);
-							gchar *numbered_bmp_filename = g_strconcat (numbered_filename, ".bmp", NULL);
-
-							if (veravals.bmp_file)
-							{
-								// write out a bitmap to be used with the .tsx file
-								gimp_file_save(GIMP_RUN_NONINTERACTIVE,
-										image_id,
-										drawable_id,
-										numbered_bmp_filename,
-										numbered_bmp_filename);
-							}
-
-							if(veravals.tiled_file)
-							{
-								if(!save_tsx(numbered_filename,
-											numbered_bmp_filename,
-											GIMP_RUN_NONINTERACTIVE,
-											image_id,
-											drawable_id,
-											&error))
-								{
-									status = GIMP_PDB_EXECUTION_ERROR;
-								}
-							}
-
-							g_free(number_string);
-							g_free(numbered_filename);
-							g_free(numbered_bmp_filename);
-						}
-
-						gimp_image_set_colormap(image_id, cmap, palsize);
-						g_free(shifted_map);
-					}
-					else // NOT 4bpp or 2BPP
-					{
-						if (veravals.bmp_file)
-						{
-							// write out a bitmap to be used with the .tsx file
-							gimp_file_save(run_mode, image_id, drawable_id, bmp_filename, bmp_filename);
-						}
-						if(veravals.tiled_file)
-						{
-							if(!save_tsx(filename, bmp_filename,  GIMP_RUN_NONINTERACTIVE, image_id, drawable_id, &error))
-							{
-								status = GIMP_PDB_EXECUTION_ERROR;
-							}
-						}
-					}
-
-					if (save_tile_set (filename, image_id, drawable_id, &error))
-					{
-						gimp_set_data (SAVE_PROC, &veravals, sizeof (veravals));
-					}
-					else
-					{
-						status = GIMP_PDB_EXECUTION_ERROR;
-					}
-					break;
-				case BITMAP:
-					if (save_bitmap (filename, image_id, drawable_id, &error))
-					{
-						gimp_set_data (SAVE_PROC, &veravals, sizeof (veravals));
-					}
-					else
-					{
-						status = GIMP_PDB_EXECUTION_ERROR;
-					}
-					break;
+				status = GIMP_PDB_EXECUTION_ERROR;
 			}
 
-			g_free(bmp_filename);
+			vera_source_clear (&source);
+			g_free (regions);
 		}
 
 		if (export == GIMP_EXPORT_EXPORT)
-			gimp_image_delete (image_id);
+			PDB_CALL (gimp_image_delete (image_id));
+
+		// one line per export for build dashboards, see VERA_STATS_FILE
+		if (run_mode == GIMP_RUN_NONINTERACTIVE)
+		{
+			vera_stats_count (&stats, VERA_PDB_CALLS, pdb_calls - first_call);
+			vera_stats_emit (&stats, PLUG_IN_BINARY, filename,
+					status == GIMP_PDB_SUCCESS ? NULL
+					: error ? error->message : "wrong number of arguments");
+		}
 	}
 	else if (strcmp (name, VERA_COLORMAP_CONVERT) == 0)
 	{
@@ -498,525 +637,1178 @@ static void run (const gchar      *name,
 	values[0].data.d_status = status;
 }
 
-static void shift_color_map(guchar* orig,
-		guchar** shifted,
-		gint palsize,
-		gint offset)
+static const Babl * get_index_format (gint32    drawable_id,
+		GError  **error)
+{
+	switch (PDB_CALL (gimp_drawable_type (drawable_id)))
+	{
+		case GIMP_INDEXED_IMAGE:
+		case GIMP_INDEXEDA_IMAGE:
+			return PDB_CALL (gimp_drawable_get_format (drawable_id));
+		case GIMP_RGB_IMAGE:
+		case GIMP_RGBA_IMAGE:
+			// mapped to the target palette as they are read
+			return babl_format ("R'G'B'A u8");
+		case GIMP_GRAY_IMAGE:
+		case GIMP_GRAYA_IMAGE:
+		default:
+			g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+					"VERA export requires an indexed or RGB image");
+			return NULL;
+	}
+}
+
+/*
+ * The palette RGB drawables are mapped to: the .PAL file given to
+ * file-vera-save2, or else the active palette in GIMP.
+ */
+static guchar * get_target_palette (gint      file_header,
+		gint     *palsize,
+		GError  **error)
 {
-	gint offset_base = offset * 3;
-	for(int i = 0; i < palsize*3; i+=3)
+	guchar *cmap = g_new (guchar, 256 * 3);
+	GimpRGB *colors;
+	gchar *name;
+
+	if (palette_file)
 	{
-		if(i + offset_base >= palsize * 3)
+		gchar *data;
+		gsize length;
+
+		if (! g_file_get_contents (palette_file, &data, &length, error))
 		{
-			// this is the last <offset> values in the color map
-			(*shifted)[i] = orig[(i - offset_base) % palsize];
-			(*shifted)[i+1] = orig[(i+1 - offset_base) % palsize];
-			(*shifted)[i+2] = orig[(i+2 - offset_base) % palsize];
-			continue;
+			g_free (cmap);
+			return NULL;
 		}
 
-		(*shifted)[i] = orig[i+offset_base];
-		(*shifted)[i+1] = orig[i+1+offset_base];
-		(*shifted)[i+2] = orig[i+2+offset_base];
+		*palsize = vera_palette_parse ((const uint8_t *) data, length, file_header, cmap);
+		g_free (data);
+
+		if (*palsize < 0)
+		{
+			g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+					"'%s' is not a .PAL file of up to 256 colors",
+					gimp_filename_to_utf8 (palette_file));
+			g_free (cmap);
+			return NULL;
+		}
+
+		return cmap;
 	}
+
+	name = PDB_CALL (gimp_context_get_palette ());
+	colors = name ? PDB_CALL (gimp_palette_get_colors (name, palsize)) : NULL;
+
+	if (! colors || *palsize < 1)
+	{
+		g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+				"RGB images need a palette to be mapped to, but the active palette has no colors");
+		g_free (colors);
+		g_free (name);
+		g_free (cmap);
+		return NULL;
+	}
+
+	*palsize = MIN (*palsize, 256);
+
+	for(gint i = 0; i < *palsize; i++)
+		gimp_rgb_get_uchar (&colors[i], &cmap[i * 3], &cmap[i * 3 + 1], &cmap[i * 3 + 2]);
+
+	g_free (colors);
+	g_free (name);
+
+	return cmap;
 }
 
-static gboolean save_tsx (const gchar  *filename,
-		const gchar  *bmp_filename,
-		GimpRunMode   run_mode,
-		gint32        image_id,
-		gint32        drawable_id,
-		GError      **error)
+static gint compare_cuts (gconstpointer a,
+		gconstpointer b)
 {
-	// write out the tsx file
-	gchar *tsx_filename = g_strconcat (filename, ".tsx", NULL);
+	return *(const gint *) a - *(const gint *) b;
+}
+
+/*
+ * Sorts the guide positions in cuts, adds the image edges and drops
+ * duplicates, returning how many are left.
+ */
+static gint sort_cuts (GArray *cuts,
+		gint    size)
+{
+	gint count = 0;
+	gint zero = 0;
 
-	int rc;
-	xmlTextWriterPtr writer;
+	g_array_append_val (cuts, zero);
+	g_array_append_val (cuts, size);
+	g_array_sort (cuts, compare_cuts);
 
-	writer = xmlNewTextWriterFilename(tsx_filename, 0);
-	if(writer == NULL)
+	for(guint i = 0; i < cuts->len; i++)
 	{
-		printf("could not create writer\n");
-		g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
-				"Could not open '%s' for writing: %s",
-				gimp_filename_to_utf8 (filename), g_strerror (errno));
-		return FALSE;
+		gint cut = g_array_index (cuts, gint, i);
+
+		if (cut >= 0 && cut <= size && (count == 0 || cut != g_array_index (cuts, gint, count - 1)))
+			g_array_index (cuts, gint, count++) = cut;
 	}
 
-	rc = xmlTextWriterStartDocument(writer, NULL, "UTF-8", NULL);
-	if (rc < 0)
+	return count;
+}
+
+/*
+ * Reads the regions named by the regions argument of file-vera-save2: the
+ * bounds of the selection, exported like the whole drawable would be, or
+ * the cells between the image's guides or the rectangles of a region list,
+ * exported as an atlas.
+ */
+static gboolean get_regions (gint32            image_id,
+		const VeraSaveVals  *vals,
+		VeraRegion         **regions,
+		gint                *count,
+		gboolean            *atlas,
+		GError             **error)
+{
+	gint width  = PDB_CALL (gimp_image_width (image_id));
+	gint height = PDB_CALL (gimp_image_height (image_id));
+	VeraError vera_error;
+
+	*regions = NULL;
+	*count = 0;
+	*atlas = TRUE;
+
+	if (strcmp (regions_spec, "selection") == 0)
 	{
-		printf("could not create document\n");
-		g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
-				"Error starting document '%s': %s",
-				gimp_filename_to_utf8 (filename), g_strerror (errno));
-		return FALSE;
+		gboolean non_empty;
+		gint x1, y1, x2, y2;
+
+		if (! PDB_CALL (gimp_selection_bounds (image_id, &non_empty, &x1, &y1, &x2, &y2))
+				|| ! non_empty)
+		{
+			g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+					"There is no selection to export");
+			return FALSE;
+		}
+
+		*regions = g_new0 (VeraRegion, 1);
+		g_strlcpy ((*regions)[0].name, "selection", VERA_REGION_NAME_LENGTH);
+		(*regions)[0].x = x1;
+		(*regions)[0].y = y1;
+		(*regions)[0].width = x2 - x1;
+		(*regions)[0].height = y2 - y1;
+		*count = 1;
+		*atlas = FALSE;
 	}
+	else if (strcmp (regions_spec, "guides") == 0)
+	{
+		GArray *columns = g_array_new (FALSE, FALSE, sizeof (gint));
+		GArray *rows = g_array_new (FALSE, FALSE, sizeof (gint));
+		gint n_columns, n_rows;
+		gint32 guide = 0;
 
-	GeglBuffer       *buffer;
-	gint32            width, height, tile_count, columns;
-
-	/* get info about the current image */
-	buffer = gimp_drawable_get_buffer (drawable_id);
-	width  = gegl_buffer_get_width  (buffer);
-	height = gegl_buffer_get_height (buffer);
-
-	tile_count = (width * height) / (veravals.tile_width * veravals.tile_height);
-	columns = width / veravals.tile_width;
-
-	printf("writing tsx document\n");
-	gchar* val_string;
-
-	xmlTextWriterStartElement(writer, BAD_CAST "tileset");
-	xmlTextWriterWriteAttribute(writer, BAD_CAST "version", BAD_CAST "1.5");
-	xmlTextWriterWriteAttribute(writer, BAD_CAST "tiledversion", BAD_CAST "1.8.0");
-	xmlTextWriterWriteAttribute(writer, BAD_CAST "name", BAD_CAST filename);
-	val_string = g_strdup_printf("%d", veravals.tile_width);
-	xmlTextWriterWriteAttribute(writer,BAD_CAST "tilewidth", BAD_CAST val_string);
-	g_free(val_string);
-	val_string = g_strdup_printf("%d", veravals.tile_height);
-	xmlTextWriterWriteAttribute(writer, BAD_CAST "tileheight", BAD_CAST val_string);
-	g_free(val_string);
-	val_string = g_strdup_printf("%d", tile_count);
-	xmlTextWriterWriteAttribute(writer, BAD_CAST "tilecount", BAD_CAST val_string);
-	g_free(val_string);
-	val_string = g_strdup_printf("%d", columns);
-	xmlTextWriterWriteAttribute(writer, BAD_CAST "columns", BAD_CAST val_string);
-	g_free(val_string);
-
-	xmlTextWriterStartElement(writer, BAD_CAST "image");
-	xmlTextWriterWriteAttribute(writer, BAD_CAST "source", BAD_CAST bmp_filename);
-	xmlTextWriterWriteAttribute(writer, BAD_CAST "trans", BAD_CAST "000000");
-	val_string = g_strdup_printf("%d", width);
-	xmlTextWriterWriteAttribute(writer, BAD_CAST "width", BAD_CAST val_string);
-	g_free(val_string);
-	val_string = g_strdup_printf("%d", height);
-	xmlTextWriterWriteAttribute(writer, BAD_CAST "height", BAD_CAST val_string);
-	g_free(val_string);
-	xmlTextWriterEndElement(writer); // image
-
-	xmlTextWriterEndElement(writer); // tileset
-
-	xmlTextWriterEndDocument(writer);
-
-	xmlFreeTextWriter(writer);
-
-	printf("finished writing tsx document\n");
+		while ((guide = PDB_CALL (gimp_image_find_next_guide (image_id, guide))) > 0)
+		{
+			gint position = PDB_CALL (gimp_image_get_guide_position (image_id, guide));
 
-	return TRUE;
-}
+			if (PDB_CALL (gimp_image_get_guide_orientation (image_id, guide)) == GIMP_ORIENTATION_VERTICAL)
+				g_array_append_val (columns, position);
+			else
+				g_array_append_val (rows, position);
+		}
 
-static gboolean save_tile_set (const gchar  *filename,
-		gint32        image_id,
-		gint32        drawable_id,
-		GError      **error)
-{
-	GeglBuffer       *buffer;
-	const Babl       *format = NULL;
-	guchar           *buf;
-	guchar           *tile_buf;
-	gint32            width, height, bpp;
-	FILE             *fp = NULL;
-	gboolean          ret = FALSE;
-
-	/* get info about the current image */
-	buffer = gimp_drawable_get_buffer (drawable_id);
-
-	switch (gimp_drawable_type (drawable_id))
+		n_columns = sort_cuts (columns, width);
+		n_rows = sort_cuts (rows, height);
+
+		if (n_columns == 2 && n_rows == 2)
+		{
+			g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+					"The image has no guides to cut it into regions");
+		}
+		else
+		{
+			// cells left to right, top to bottom, named by row and column
+			*regions = g_new0 (VeraRegion, (n_columns - 1) * (n_rows - 1));
+
+			for(gint r = 0; r < n_rows - 1; r++)
+			{
+				for(gint c = 0; c < n_columns - 1; c++)
+				{
+					VeraRegion *region = &(*regions)[(*count)++];
+
+					g_snprintf (region->name, VERA_REGION_NAME_LENGTH, "r%dc%d", r, c);
+					region->x = g_array_index (columns, gint, c);
+					region->y = g_array_index (rows, gint, r);
+					region->width = g_array_index (columns, gint, c + 1) - region->x;
+					region->height = g_array_index (rows, gint, r + 1) - region->y;
+				}
+			}
+		}
+
+		g_array_free (columns, TRUE);
+		g_array_free (rows, TRUE);
+
+		if (*count == 0)
+			return FALSE;
+	}
+	else
 	{
-		case GIMP_INDEXED_IMAGE:
-		case GIMP_INDEXEDA_IMAGE:
-			format = gimp_drawable_get_format (drawable_id);
-			break;
-		case GIMP_RGB_IMAGE:
-		case GIMP_RGBA_IMAGE:
-		case GIMP_GRAY_IMAGE:
-		case GIMP_GRAYA_IMAGE:
-		default:
-			// TODO set error message
+		gchar *data;
+		gsize length;
+		VeraRegion *parsed;
+		int n;
+
+		if (! g_file_get_contents (regions_spec, &data, &length, error))
 			return FALSE;
+
+		if (vera_regions_parse (data, length, gimp_filename_to_utf8 (regions_spec),
+					&parsed, &n, &vera_error) != 0)
+		{
+			g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (vera_error.code),
+					"%s", vera_error.message);
+			g_free (data);
+			return FALSE;
+		}
+
+		// the list is malloc'ed by the core, the caller frees with g_free
+		*regions = g_memdup (parsed, n * sizeof (VeraRegion));
+		*count = n;
+		free (parsed);
+		g_free (data);
 	}
 
-	bpp          = babl_format_get_bytes_per_pixel (format);
+	if (vera_regions_check (*regions, *count, width, height, vals, &vera_error) != 0)
+	{
+		g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (vera_error.code),
+				"%s", vera_error.message);
+		g_free (*regions);
+		*regions = NULL;
+		*count = 0;
+		return FALSE;
+	}
 
-	width  = gegl_buffer_get_width  (buffer);
-	height = gegl_buffer_get_height (buffer);
+	return TRUE;
+}
 
-	buf = g_new (guchar, width * height * bpp);
+// fetches rows of the drawable's pixels in its format, timing the read
+static void get_drawable_rows (VeraDrawable *drawable,
+		gint          y,
+		gint          rows,
+		guchar       *buf)
+{
+	gint width = drawable->image.width;
+	int64_t start = vera_stats_now ();
 
-	gegl_buffer_get (buffer, GEGL_RECTANGLE (0, 0, width, height), 1.0,
-			format, buf,
+	gegl_buffer_get (drawable->buffer,
+			GEGL_RECTANGLE (drawable->x, drawable->y + y, width, rows), 1.0,
+			drawable->format, buf,
 			GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_NONE);
 
-	g_object_unref (buffer);
+	vera_stats_time (drawable->stats, VERA_PHASE_READ, start);
+	vera_stats_count (drawable->stats, VERA_BYTES_IN, (int64_t) width * rows * drawable->bpp);
+}
 
-	int tile_width = veravals.tile_width;
-	int tile_height = veravals.tile_height;
-	int t_width = width / tile_width;
-	int t_height = height / tile_height;
-	int tile_buf_length = ((width * height * bpp) / (8 / veravals.tile_bpp));
-	int tile_buf_index = 0;
+/*
+ * Error diffusion runs from the top row down, so a dithered drawable is
+ * mapped whole, a strip at a time, by the first read of any of its rows.
+ */
+static void dither_drawable (VeraDrawable *drawable)
+{
+	const VeraImage *image = &drawable->image;
+	gint strip = MIN (image->height, DITHER_STRIP_HEIGHT);
+	guchar *buf = g_new (guchar, (gsize) image->width * strip * drawable->bpp);
+
+	drawable->indices = g_new (guchar, (gsize) image->width * image->height);
 
-	if(veravals.file_header)
+	for(gint y = 0; y < image->height; y += strip)
 	{
-		tile_buf_length += 2;
-		tile_buf_index += 2;
+		gint rows = MIN (strip, image->height - y);
+
+		get_drawable_rows (drawable, y, rows, buf);
+
+		vera_dither_rows (drawable->dither, buf, drawable->bpp, rows,
+				drawable->indices + (gsize) y * image->width);
 	}
 
-	tile_buf = g_new (guchar, tile_buf_length);
+	g_free (buf);
+}
+
+/*
+ * Reads rows of the drawable as one color index per pixel into dst.  An
+ * indexed drawable without alpha is read straight into dst.  Otherwise its
+ * pixels go to a separate buffer first: RGB pixels are mapped to indices
+ * through the palette lookup, and indexed ones with alpha keep their index
+ * byte.  A dithered drawable is dithered whole on the first read and its
+ * rows copied from drawable->indices.
+ */
+static int read_drawable_rows (const VeraImage  *image,
+		int               y,
+		int               rows,
+		uint8_t          *dst)
+{
+	VeraDrawable *drawable = image->user_data;
+	gsize pixels = (gsize) image->width * rows;
+	guchar *buf = dst;
 
-	if(veravals.file_header)
+	if (drawable->dither && drawable->dither->mode != DITHER_NONE)
 	{
-		// 2 byte header
-		tile_buf[0] = 0;
-		tile_buf[1] = 0;
+		// the exporters may read from several threads
+		g_mutex_lock (&drawable->lock);
+		if (! drawable->indices)
+			dither_drawable (drawable);
+		g_mutex_unlock (&drawable->lock);
+
+		memcpy (dst, drawable->indices + (gsize) y * image->width, pixels);
+
+		return 0;
 	}
 
-	for(int y = 0; y < t_height; y++)
+	if (drawable->bpp > 1)
+		buf = g_new (guchar, pixels * drawable->bpp);
+
+	get_drawable_rows (drawable, y, rows, buf);
+
+	if (drawable->dither)
 	{
-		int yoff = y * tile_height;
+		vera_lut_map (&drawable->dither->lut, buf, drawable->bpp, pixels, dst);
+		g_free (buf);
+	}
+	else if (drawable->bpp > 1)
+	{
+		for(gsize i = 0; i < pixels; i++)
+			dst[i] = buf[i * drawable->bpp];
 
-		for(int x = 0; x < t_width; x++)
-		{
-			int xoff = x * tile_width;
+		g_free (buf);
+	}
 
-			// write out a single tile
-			for(int ty = 0; ty < tile_height; ty++)
-			{
-				for(int tx = 0; tx < tile_width; tx++)
-				{
-					// get the color from the buffer
-					int buf_index = ((yoff + ty) * width) + xoff + tx;
-					guchar color = buf[buf_index];
+	return 0;
+}
 
-					switch(veravals.tile_bpp)
-					{
-						case TILE_1BPP:
-							switch(buf_index % 8)
-							{
-								case 0:
-									tile_buf[tile_buf_index] = color << 7;
-									break;
-								case 1:
-									tile_buf[tile_buf_index] |= color << 6;
-									break;
-								case 2:
-									tile_buf[tile_buf_index] |= color << 5;
-									break;
-								case 3:
-									tile_buf[tile_buf_index] |= color << 4;
-									break;
-								case 4:
-									tile_buf[tile_buf_index] |= color << 3;
-									break;
-								case 5:
-									tile_buf[tile_buf_index] |= color << 2;
-									break;
-								case 6:
-									tile_buf[tile_buf_index] |= color << 1;
-									break;
-								case 7:
-									tile_buf[tile_buf_index] |= color;
-									tile_buf_index++;
-									break;
-							}
-							break;
-
-						case TILE_2BPP:
-							switch(buf_index % 4)
-							{
-								case 0:
-									tile_buf[tile_buf_index] = color << 6;
-									break;
-								case 1:
-									tile_buf[tile_buf_index] |= color << 4;
-									break;
-								case 2:
-									tile_buf[tile_buf_index] |= color << 2;
-									break;
-								case 3:
-									tile_buf[tile_buf_index] |= color;
-									tile_buf_index++;
-									break;
-							}
-							break;
-						case TILE_4BPP:
-							switch(buf_index % 2)
-							{
-								case 0:
-									tile_buf[tile_buf_index] = color << 4;
-									break;
-								case 1:
-									tile_buf[tile_buf_index] |= color;
-									tile_buf_index++;
-									break;
-							}
-							break;
-						case TILE_8BPP:
-							tile_buf[tile_buf_index] = color;
-							tile_buf_index++;
-							break;
-					}
+/*
+ * Reads rows of a collision layer as 1 where it is solid: opaque on a layer
+ * with an alpha channel, anything but black on one without.
+ */
+static int read_mask_rows (const VeraImage  *image,
+		int               y,
+		int               rows,
+		uint8_t          *dst)
+{
+	VeraDrawable *drawable = image->user_data;
+	gsize pixels = (gsize) image->width * rows;
+	guchar *buf = g_new (guchar, pixels * 2);
 
-				}
-			}
-		}
-	}
+	get_drawable_rows (drawable, y, rows, buf);
+
+	for(gsize i = 0; i < pixels; i++)
+		dst[i] = drawable->alpha ? buf[i * 2 + 1] >= 128 : buf[i * 2] != 0;
 
-	fp = fopen (filename, "wb");
+	g_free (buf);
 
-	if (! fp)
+	return 0;
+}
+
+/*
+ * Reads the layer called layer_name of image_id as the collision mask of
+ * the tile set in source, which was read from drawable_id.  The mask covers
+ * the same part of the image, whatever the size of the layer.
+ */
+static gboolean collision_init (VeraSource         *source,
+		gint32              image_id,
+		gint32              drawable_id,
+		const gchar        *layer_name,
+		const VeraSaveVals *vals,
+		VeraStats          *stats,
+		GError            **error)
+{
+	const VeraDrawable *drawable = &source->drawables[0];
+	VeraDrawable *mask;
+	gint32 layer_id;
+	gint x, y, layer_x, layer_y;
+
+	if (vals->export_type != TILESET || vals->frames || source->atlas)
 	{
-		g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
-				"Could not open '%s' for writing: %s",
-				gimp_filename_to_utf8 (filename), g_strerror (errno));
+		g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+				"Collision masks can only be exported with a single tile set");
 		return FALSE;
 	}
 
-	ret = TRUE;
+	layer_id = PDB_CALL (gimp_image_get_layer_by_name (image_id, layer_name));
 
-	if (! fwrite (tile_buf, tile_buf_length, 1, fp))
+	if (layer_id == -1)
 	{
+		g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+				"The image has no layer called '%s' to read collisions from", layer_name);
 		return FALSE;
 	}
 
-	fclose (fp);
-	g_free(tile_buf);
+	PDB_CALL (gimp_drawable_offsets (drawable_id, &x, &y));
+	PDB_CALL (gimp_drawable_offsets (layer_id, &layer_x, &layer_y));
+
+	source->collision = mask = g_new0 (VeraDrawable, 1);
+	g_mutex_init (&mask->lock);
+	mask->stats  = stats;
+	mask->format = babl_format ("Y'A u8");
+	mask->bpp    = 2;
+	mask->alpha  = PDB_CALL (gimp_drawable_has_alpha (layer_id));
+	mask->buffer = PDB_CALL (gimp_drawable_get_buffer (layer_id));
+
+	// pixels the layer does not cover read as empty
+	mask->x = x + drawable->x - layer_x;
+	mask->y = y + drawable->y - layer_y;
+	mask->image.width     = drawable->image.width;
+	mask->image.height    = drawable->image.height;
+	mask->image.read_rows = read_mask_rows;
+	mask->image.user_data = mask;
+
+	source->images[0].collision = &mask->image;
 
-	return ret;
+	return TRUE;
 }
 
-static gboolean save_bitmap (const gchar  *filename,
-		gint32        image_id,
-		gint32        drawable_id,
-		GError      **error)
+/* region, in image coordinates, restricts the drawable to that rectangle unless NULL */
+static gboolean vera_drawable_init (VeraDrawable       *drawable,
+		gint32              image_id,
+		gint32              drawable_id,
+		const VeraRegion   *region,
+		const VeraSaveVals *vals,
+		VeraStats          *stats,
+		GError            **error)
 {
-	GeglBuffer       *buffer;
-	const Babl       *format = NULL;
-	guchar           *buf;
-	guchar           *bitmap_buf;
-	gint32            width, height, bpp;
-	FILE             *fp = NULL;
-	gboolean          ret = FALSE;
-
-	/* get info about the current image */
-	buffer = gimp_drawable_get_buffer (drawable_id);
-
-	switch (gimp_drawable_type (drawable_id))
+	VeraImage *image = &drawable->image;
+
+	memset (drawable, 0, sizeof (VeraDrawable));
+	g_mutex_init (&drawable->lock);
+	drawable->stats = stats;
+
+	drawable->format = get_index_format (drawable_id, error);
+	if (! drawable->format)
+		return FALSE;
+
+	drawable->buffer = PDB_CALL (gimp_drawable_get_buffer (drawable_id));
+	drawable->bpp    = babl_format_get_bytes_per_pixel (drawable->format);
+
+	image->width     = gegl_buffer_get_width  (drawable->buffer);
+	image->height    = gegl_buffer_get_height (drawable->buffer);
+
+	if (region)
 	{
-		case GIMP_INDEXED_IMAGE:
-		case GIMP_INDEXEDA_IMAGE:
-			format = gimp_drawable_get_format (drawable_id);
-			break;
-		case GIMP_RGB_IMAGE:
-		case GIMP_RGBA_IMAGE:
-		case GIMP_GRAY_IMAGE:
-		case GIMP_GRAYA_IMAGE:
-		default:
-			// TODO set error message
+		gint offset_x, offset_y;
+
+		PDB_CALL (gimp_drawable_offsets (drawable_id, &offset_x, &offset_y));
+
+		drawable->x = region->x - offset_x;
+		drawable->y = region->y - offset_y;
+
+		if (drawable->x < 0 || drawable->y < 0
+				|| drawable->x + region->width > image->width
+				|| drawable->y + region->height > image->height)
+		{
+			g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+					"Region '%s' does not lie inside the layer", region->name);
 			return FALSE;
+		}
+
+		image->width  = region->width;
+		image->height = region->height;
+	}
+
+	if (PDB_CALL (gimp_drawable_is_rgb (drawable_id)))
+	{
+		drawable->cmap = get_target_palette (vals->file_header, &image->palsize, error);
+		if (! drawable->cmap)
+			return FALSE;
+
+		// color 0 is kept for the pixels that are transparent
+		drawable->dither = g_new (VeraDitherer, 1);
+		if (vera_dither_init (drawable->dither, drawable->cmap, image->palsize,
+					PDB_CALL (gimp_drawable_has_alpha (drawable_id)), vals, image->width) != 0)
+		{
+			g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_NOMEM,
+					"Out of memory dithering the image");
+			return FALSE;
+		}
+	}
+	else
+	{
+		drawable->cmap = PDB_CALL (gimp_image_get_colormap (image_id, &image->palsize));
 	}
 
-	bpp          = babl_format_get_bytes_per_pixel (format);
+	image->cmap      = drawable->cmap;
+	image->read_rows = read_drawable_rows;
+	image->user_data = drawable;
 
-	width  = gegl_buffer_get_width  (buffer);
-	height = gegl_buffer_get_height (buffer);
+	return TRUE;
+}
 
-	buf = g_new (guchar, width * height * bpp);
+static void vera_drawable_clear (VeraDrawable *drawable)
+{
+	if (drawable->buffer)
+		g_object_unref (drawable->buffer);
 
-	gegl_buffer_get (buffer, GEGL_RECTANGLE (0, 0, width, height), 1.0,
-			format, buf,
-			GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_NONE);
+	if (drawable->dither)
+		vera_dither_free (drawable->dither);
 
-	g_object_unref (buffer);
+	g_free (drawable->cmap);
+	g_free (drawable->dither);
+	g_free (drawable->indices);
+	g_mutex_clear (&drawable->lock);
+	memset (drawable, 0, sizeof (VeraDrawable));
+}
 
-	int bitmap_buf_length = ((width * height * bpp) / (8 / veravals.tile_bpp));
-	int bitmap_buf_index = 0;
+/*
+ * With n_regions set, the source is those regions of drawable_id instead,
+ * each read on its own.
+ */
+static gboolean vera_source_init (VeraSource         *source,
+		gint32              image_id,
+		gint32              drawable_id,
+		const VeraRegion   *regions,
+		gint                n_regions,
+		const VeraSaveVals *vals,
+		VeraStats          *stats,
+		GError            **error)
+{
+	gint32 *layers = NULL;
+	gint n_layers = 0;
+
+	memset (source, 0, sizeof (VeraSource));
 
-	if(veravals.file_header)
+	if (n_regions && vals->frames)
 	{
-		bitmap_buf_length += 2;
-		bitmap_buf_index += 2;
+		g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+				"Regions can not be exported as frames");
+		return FALSE;
 	}
 
-	bitmap_buf = g_new (guchar, bitmap_buf_length);
+	if (n_regions)
+	{
+		layers = g_new (gint32, n_regions);
+		for(gint i = 0; i < n_regions; i++)
+			layers[i] = drawable_id;
+		source->count = n_regions;
+	}
+	else if (vals->frames)
+	{
+		layers = PDB_CALL (gimp_image_get_layers (image_id, &n_layers));
+
+		// layers come top first, animations play from the bottom up
+		for(gint i = n_layers - 1; i >= 0; i--)
+		{
+			if (PDB_CALL (gimp_item_get_visible (layers[i])))
+				layers[source->count++] = layers[i];
+		}
 
-	if(veravals.file_header)
+		if (source->count == 0)
+		{
+			g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+					"Frame export needs at least one visible layer");
+			g_free (layers);
+			return FALSE;
+		}
+	}
+	else
 	{
-		// 2 byte header
-		bitmap_buf[0] = 0;
-		bitmap_buf[1] = 0;
+		layers = g_new (gint32, 1);
+		layers[0] = drawable_id;
+		source->count = 1;
 	}
 
-	// TODO: populate bitmap_buf
-	// write the whole file
-	for(int y = 0; y < height; y++)
+	source->drawables = g_new0 (VeraDrawable, source->count);
+	source->images = g_new0 (VeraImage, source->count);
+
+	for(gint i = 0; i < source->count; i++)
 	{
-		for(int x = 0; x < width; x++)
+		if (! vera_drawable_init (&source->drawables[i], image_id, layers[i],
+					n_regions ? &regions[i] : NULL, vals, stats, error))
 		{
-			// get the color from the buffer
-			int buf_index = (width * y) + x;
-			guchar color = buf[buf_index];
+			g_free (layers);
+			return FALSE;
+		}
 
-			switch(veravals.tile_bpp)
-			{
-				case TILE_1BPP:
-					switch(buf_index % 8)
-					{
-						case 0:
-							bitmap_buf[bitmap_buf_index] = color << 7;
-							break;
-						case 1:
-							bitmap_buf[bitmap_buf_index] |= color << 6;
-							break;
-						case 2:
-							bitmap_buf[bitmap_buf_index] |= color << 5;
-							break;
-						case 3:
-							bitmap_buf[bitmap_buf_index] |= color << 4;
-							break;
-						case 4:
-							bitmap_buf[bitmap_buf_index] |= color << 3;
-							break;
-						case 5:
-							bitmap_buf[bitmap_buf_index] |= color << 2;
-							break;
-						case 6:
-							bitmap_buf[bitmap_buf_index] |= color << 1;
-							break;
-						case 7:
-							bitmap_buf[bitmap_buf_index] |= color;
-							bitmap_buf_index++;
-							break;
-					}
-					break;
+		source->images[i] = source->drawables[i].image;
+	}
 
-				case TILE_2BPP:
-					switch(buf_index % 4)
-					{
-						case 0:
-							bitmap_buf[bitmap_buf_index] = color << 6;
-							break;
-						case 1:
-							bitmap_buf[bitmap_buf_index] |= color << 4;
-							break;
-						case 2:
-							bitmap_buf[bitmap_buf_index] |= color << 2;
-							break;
-						case 3:
-							bitmap_buf[bitmap_buf_index] |= color;
-							bitmap_buf_index++;
-							break;
-					}
-					break;
-				case TILE_4BPP:
-					if (buf_index % 2)
-					{
-						// odd byte
-						bitmap_buf[bitmap_buf_index] |= color;
-						bitmap_buf_index++;
-					}
-					else
-					{
-						// even byte
-						bitmap_buf[bitmap_buf_index] = color << 4;
-					}
-					break;
-				case TILE_8BPP:
-					bitmap_buf[bitmap_buf_index] = color;
-					bitmap_buf_index++;
-					break;
-			}
+	g_free (layers);
+
+	return TRUE;
+}
+
+static void vera_source_clear (VeraSource *source)
+{
+	for(gint i = 0; i < source->count; i++)
+		vera_drawable_clear (&source->drawables[i]);
 
+	if (source->collision)
+		vera_drawable_clear (source->collision);
+
+	g_free (source->drawables);
+	g_free (source->images);
+	g_free (source->collision);
+	memset (source, 0, sizeof (VeraSource));
+}
+
+typedef struct
+{
+	VeraTaskFunc  func;
+	void         *data;
+} PoolTasks;
+
+static void run_pool_task (gpointer task,
+		gpointer user_data)
+{
+	PoolTasks *tasks = user_data;
+
+	tasks->func (tasks->data, GPOINTER_TO_INT (task) - 1);
+}
+
+static gint gimp_threads (void)
+{
+	gchar *value = gimp_gimprc_query ("num-processors");
+	gint threads = value ? (gint) g_ascii_strtoll (value, NULL, 10) : 0;
+
+	g_free (value);
+
+	return threads > 0 ? threads : (gint) g_get_num_processors ();
+}
+
+// runs the exporters' parallel work on a thread pool of pool_threads
+static void run_pool_tasks (void         *user_data,
+		VeraTaskFunc  func,
+		void         *data,
+		int           count)
+{
+	PoolTasks tasks = { func, data };
+	GThreadPool *pool;
+
+	pool = g_thread_pool_new (run_pool_task, &tasks,
+			MIN (pool_threads, count), FALSE, NULL);
+
+	for(gint i = 0; i < count; i++)
+		g_thread_pool_push (pool, GINT_TO_POINTER (i + 1), NULL);
+
+	// wait for every task to finish
+	g_thread_pool_free (pool, FALSE, TRUE);
+}
+
+static const VeraRunner pool_runner = { run_pool_tasks, NULL };
+
+/*
+ * Exports source and reports the files that were left alone because their
+ * contents did not change, counting them in *unchanged if it is not NULL.
+ * The export is timed and counted in stats unless it is NULL.
+ */
+static gboolean export_vera (const gchar        *filename,
+		const VeraSource   *source,
+		const VeraSaveVals *vals,
+		VeraStats          *stats,
+		gint               *unchanged,
+		GError            **error)
+{
+	VeraArtifacts artifacts = { NULL, 0, 0, stats };
+	VeraError vera_error;
+	int64_t start = vera_stats_now ();
+	gint skipped = 0;
+	gint ret;
+
+	if (source->atlas)
+		ret = vera_export_atlas (filename, source->images, source->count, vals,
+				&pool_runner, &artifacts, &vera_error);
+	else if (vals->frames)
+		ret = vera_export_frames (filename, source->images, source->count, vals,
+				&pool_runner, &artifacts, &vera_error);
+	else
+		ret = vera_export (filename, &source->images[0], vals,
+				&pool_runner, &artifacts, &vera_error);
+
+	vera_stats_time (stats, VERA_PHASE_EXPORT, start);
+
+	if (ret != 0)
+	{
+		g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (vera_error.code),
+				"%s", vera_error.message);
+		vera_artifacts_clear (&artifacts);
+		return FALSE;
+	}
+
+	for(gint i = 0; i < artifacts.count; i++)
+	{
+		if (artifacts.items[i].skipped)
+		{
+			// runs on batch worker threads, where gimp_filename_to_utf8 is not safe
+			gchar *name = g_filename_display_name (artifacts.items[i].filename);
+
+			g_print ("%s: unchanged\n", name);
+			g_free (name);
+			skipped++;
 		}
 	}
 
-	fp = fopen (filename, "wb");
+	if (unchanged)
+		*unchanged = skipped;
+
+	vera_artifacts_clear (&artifacts);
 
-	if (! fp)
+	return TRUE;
+}
+
+typedef struct
+{
+	gint           line;
+	gchar         *source;
+	gchar         *filename;
+	VeraSaveVals   vals;
+	gint32         image_id;
+	VeraSource     input;      /* the drawables read from source */
+	GError        *error;
+	gint           unchanged;  /* files left alone as their contents did not change */
+	VeraStats      stats;
+	guint8         cmap[256 * 3]; /* the shared palette as far as this asset needs it */
+	guint8         remap[256];    /* indices of this asset in the shared palette */
+} BatchAsset;
+
+static gboolean parse_batch_line (const gchar  *manifest,
+		gint          line,
+		const gchar  *text,
+		BatchAsset   *asset,
+		GError      **error)
+{
+	gchar **argv = NULL;
+	gint argc = 0;
+	gint settings[24];
+	gint n_settings;
+
+	if (! g_shell_parse_argv (text, &argc, &argv, error))
 	{
-		g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
-				"Could not open '%s' for writing: %s",
-				gimp_filename_to_utf8 (filename), g_strerror (errno));
+		g_prefix_error (error, "%s:%d: ", gimp_filename_to_utf8 (manifest), line);
 		return FALSE;
 	}
 
-	ret = TRUE;
+	n_settings = argc - 2;
 
-	if (! fwrite (bitmap_buf, bitmap_buf_length, 1, fp))
+	if (n_settings < 8 || n_settings > 24)
 	{
+		g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+				"%s:%d: expected a source, an output and 8 to 24 settings",
+				gimp_filename_to_utf8 (manifest), line);
+		g_strfreev (argv);
 		return FALSE;
 	}
 
-	fclose (fp);
-	g_free(bitmap_buf);
+	for(gint i = 0; i < n_settings; i++)
+	{
+		gchar *end;
+
+		// addresses can be given in hex
+		settings[i] = g_ascii_strtoll (argv[i + 2], &end,
+				g_str_has_prefix (argv[i + 2], "0x") ? 16 : 10);
+
+		if (end == argv[i + 2] || *end)
+		{
+			g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+					"%s:%d: '%s' is not a number",
+					gimp_filename_to_utf8 (manifest), line, argv[i + 2]);
+			g_strfreev (argv);
+			return FALSE;
+		}
+	}
+
+	// same order as the file-vera-save2 arguments
+	asset->vals = vera_default_vals;
+	asset->vals.export_type = settings[0];
+	asset->vals.file_header = settings[1];
+	asset->vals.tile_bpp    = settings[2];
+	asset->vals.tile_width  = settings[3];
+	asset->vals.tile_height = settings[4];
+	asset->vals.tiled_file  = settings[5];
+	asset->vals.bmp_file    = settings[6];
+	asset->vals.pal_file    = settings[7];
+
+	if (n_settings > 8)
+		asset->vals.dedup_tiles = settings[8];
+	if (n_settings > 9)
+		asset->vals.palette_banks = settings[9];
+	if (n_settings > 10)
+		asset->vals.export_cache = settings[10];
+	if (n_settings > 11)
+		asset->vals.frames = settings[11];
+	if (n_settings > 12)
+		asset->vals.vram_address = settings[12];
+	if (n_settings > 13)
+		asset->vals.compress = settings[13];
+	if (n_settings > 14)
+		asset->vals.dither = settings[14];
+	if (n_settings > 15)
+		asset->vals.dither_tiles = settings[15];
+	if (n_settings > 16)
+		asset->vals.patch_file = settings[16];
+	if (n_settings > 17)
+		asset->vals.delta_frames = settings[17];
+	if (n_settings > 18)
+		asset->vals.vblank_bytes = settings[18];
+	if (n_settings > 19)
+		asset->vals.frame_palettes = settings[19];
+	if (n_settings > 20)
+		asset->vals.frame_bytes = settings[20];
+	if (n_settings > 21)
+		asset->vals.bank_split = settings[21];
+	if (n_settings > 22)
+		asset->vals.split_tiles = settings[22];
+	if (n_settings > 23)
+		asset->vals.first_bank = settings[23];
+
+	asset->source = g_strdup (argv[0]);
+	asset->filename = g_strdup (argv[1]);
+
+	g_strfreev (argv);
 
-	return ret;
+	return TRUE;
 }
 
-static gboolean save_palette(const gchar *filename,
-		const guchar      *cmap,
-		const gint        palsize,
-		GError            **error)
+static void batch_export (gpointer data,
+		gpointer user_data)
 {
-	FILE       *fp = NULL;
-	guchar     *pal_buf;
-	int pal_buf_length = palsize * 2;
-	int pal_buf_index = 0; // start past the 2 byte header
+	BatchAsset *asset = data;
+	GAsyncQueue *done = user_data;
+
+	export_vera (asset->filename, &asset->input, &asset->vals, &asset->stats,
+			&asset->unchanged, &asset->error);
 
-	if(veravals.file_header)
+	g_async_queue_push (done, asset);
+}
+
+// PDB calls are only made from the main thread, so finished images are freed here
+static void batch_finish (BatchAsset *asset)
+{
+	vera_source_clear (&asset->input);
+
+	if (asset->image_id != -1)
 	{
-		pal_buf_length += 2;
-		pal_buf_index += 2;
+		PDB_CALL (gimp_image_delete (asset->image_id));
+		vera_stats_count (&asset->stats, VERA_PDB_CALLS, 1);
 	}
+}
 
-	pal_buf = g_new (guchar, pal_buf_length); // 2 bytes per color, 2 byte header
+/*
+ * Merges the colormap of a loaded asset into the shared palette and has
+ * its images read through the remap table, instead of writing a palette
+ * of their own.
+ */
+static gboolean share_palette (BatchAsset        *asset,
+		VeraSharedPalette *shared,
+		GError           **error)
+{
+	const VeraImage *image = &asset->input.images[0];
+	const gchar *name = gimp_filename_to_utf8 (asset->source);
+	VeraError vera_error;
 
-	if(veravals.file_header)
+	if (vera_shared_check (&asset->vals, name, &vera_error) != 0
+			|| vera_shared_add (shared, image->cmap, image->cmap ? image->palsize : 0,
+				name, asset->remap, &vera_error) != 0)
 	{
-		// 2 byte header
-		pal_buf[0] = 0;
-		pal_buf[1] = 0;
+		g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (vera_error.code),
+				"%s", vera_error.message);
+		return FALSE;
 	}
 
+	// entries are only appended, so a copy of the palette so far is all the images use
+	memcpy (asset->cmap, shared->cmap, shared->palsize * 3);
 
-	for(int i = 0; i < palsize*3; i+=3)
+	for(gint i = 0; i < asset->input.count; i++)
 	{
-		// read rgb values from colormap
-		gint r = ((cmap[i] * 15) + 135) >> 8;
-		gint g = ((cmap[i+1] * 15) + 135) >> 8;
-		gint b = ((cmap[i+2] * 15) + 135) >> 8;
+		asset->input.images[i].cmap = asset->cmap;
+		asset->input.images[i].palsize = shared->palsize;
+		asset->input.images[i].remap = asset->remap;
+	}
+
+	asset->vals.pal_file = FALSE;
 
-		// write out packed g and b values
-		pal_buf[pal_buf_index] = (g & 0x0f) << 4 | b;
+	return TRUE;
+}
 
-		// write out r value in lower nibble
-		pal_buf[pal_buf_index+1] = r & 0x0f;
+/*
+ * Applies a manifest line starting with @, setting *shared_name for
+ * @shared-palette and *collision_name for @collision-layer.
+ */
+static gboolean parse_directive_line (const gchar  *manifest,
+		gint          line,
+		const gchar  *text,
+		VeraPlan     *plan,
+		gchar       **shared_name,
+		gchar       **collision_name,
+		GError      **error)
+{
+	gchar **argv = NULL;
+	gint argc = 0;
+	VeraError vera_error;
 
-		pal_buf_index += 2;
+	if (! g_shell_parse_argv (text, &argc, &argv, error))
+	{
+		g_prefix_error (error, "%s:%d: ", gimp_filename_to_utf8 (manifest), line);
+		return FALSE;
 	}
 
-	/* we have colormap too, write it into filename+PAL.BIN */
-	gchar *newfile = g_strconcat (filename, ".PAL", NULL);
+	if (strcmp (argv[0], "@shared-palette") == 0)
+	{
+		if (argc != 2 || *shared_name)
+		{
+			g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+					"%s:%d: expected a single @shared-palette NAME",
+					gimp_filename_to_utf8 (manifest), line);
+			g_strfreev (argv);
+			return FALSE;
+		}
 
-	fp = fopen (newfile, "wb");
+		*shared_name = g_strdup (argv[1]);
+	}
+	else if (strcmp (argv[0], "@collision-layer") == 0)
+	{
+		if (argc != 2)
+		{
+			g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+					"%s:%d: expected @collision-layer NAME, or \"\" for none",
+					gimp_filename_to_utf8 (manifest), line);
+			g_strfreev (argv);
+			return FALSE;
+		}
 
-	if (! fp)
+		g_free (*collision_name);
+		*collision_name = *argv[1] ? g_strdup (argv[1]) : NULL;
+	}
+	else if (vera_plan_directive (plan, argc, argv, &vera_error) != 0)
 	{
-		g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
-				"Could not open '%s' for writing: %s",
-				gimp_filename_to_utf8 (newfile), g_strerror (errno));
-		g_free(pal_buf);
+		g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (vera_error.code),
+				"%s:%d: %s", gimp_filename_to_utf8 (manifest), line, vera_error.message);
+		g_strfreev (argv);
 		return FALSE;
 	}
 
-	if (!fwrite (pal_buf, pal_buf_length, 1, fp))
+	g_strfreev (argv);
+
+	return TRUE;
+}
+
+/*
+ * Exports every asset in a manifest.  Loading an image goes through the PDB
+ * and happens here on the main thread, one at a time, while the packing and
+ * writing of the images already loaded runs on a thread pool.  If the
+ * manifest asks for an address map, the files are then planned into VRAM.
+ */
+static gboolean save_batch (const gchar  *manifest,
+		gint         *failed,
+		gchar       **report,
+		GError      **error)
+{
+	gchar        *contents;
+	gchar       **lines;
+	GPtrArray    *assets;
+	GAsyncQueue  *done;
+	GThreadPool  *pool;
+	GString      *text;
+	VeraPlan      plan;
+	VeraError     plan_error;
+	VeraSharedPalette shared;
+	VeraSaveVals  shared_vals = vera_default_vals;
+	gchar        *shared_name = NULL;
+	gchar        *collision_name = NULL;
+	guint         count;
+	gint          max_threads = pool_threads;
+	gint          in_flight = 0;
+
+	if (! g_file_get_contents (manifest, &contents, NULL, error))
 		return FALSE;
 
-	fclose (fp);
-	g_free(pal_buf);
-	g_free(newfile);
+	lines = g_strsplit (contents, "\n", -1);
+	g_free (contents);
+
+	// the Tiled files are written from the worker threads
+	xmlInitParser ();
+
+	vera_plan_init (&plan);
+	vera_shared_init (&shared);
+	assets = g_ptr_array_new ();
+	done = g_async_queue_new ();
+	pool = g_thread_pool_new (batch_export, done, max_threads, FALSE, NULL);
+
+	for(gint i = 0; lines[i]; i++)
+	{
+		gchar *line = g_strstrip (lines[i]);
+		BatchAsset *asset;
+		gint32 drawable_id;
+		gint first_call;
+		int64_t start;
+
+		if (*line == '\0' || *line == '#')
+			continue;
+
+		asset = g_new0 (BatchAsset, 1);
+		asset->line = i + 1;
+		asset->image_id = -1;
+
+		// directives only show up in the report if they fail
+		if (*line == '@')
+		{
+			if (parse_directive_line (manifest, i + 1, line, &plan, &shared_name,
+						&collision_name, &asset->error))
+				g_free (asset);
+			else
+				g_ptr_array_add (assets, asset);
+			continue;
+		}
+
+		g_ptr_array_add (assets, asset);
+
+		if (! parse_batch_line (manifest, i + 1, line, asset, &asset->error))
+			continue;
+
+		first_call = pdb_calls;
+		start = vera_stats_now ();
+		asset->image_id = PDB_CALL (gimp_file_load (GIMP_RUN_NONINTERACTIVE, asset->source, asset->source));
+
+		if (asset->image_id == -1)
+		{
+			g_set_error (&asset->error, G_FILE_ERROR, G_FILE_ERROR_FAILED,
+					"Could not load '%s'", gimp_filename_to_utf8 (asset->source));
+		}
+		else
+		{
+			drawable_id = PDB_CALL (gimp_image_get_active_drawable (asset->image_id));
+			if (vera_source_init (&asset->input, asset->image_id, drawable_id, NULL, 0,
+						&asset->vals, &asset->stats, &asset->error)
+					&& collision_name)
+				collision_init (&asset->input, asset->image_id, drawable_id, collision_name,
+						&asset->vals, &asset->stats, &asset->error);
+		}
+
+		// the shared palette is written with the settings of the first asset in it
+		if (! asset->error && shared_name)
+		{
+			if (shared.palsize == 0)
+				shared_vals = asset->vals;
+
+			share_palette (asset, &shared, &asset->error);
+		}
+
+		vera_stats_time (&asset->stats, VERA_PHASE_LOAD, start);
+		vera_stats_count (&asset->stats, VERA_PDB_CALLS, pdb_calls - first_call);
+
+		if (asset->error)
+		{
+			batch_finish (asset);
+			continue;
+		}
+
+		// bound the number of images held in memory at once
+		while (in_flight >= max_threads * 2)
+		{
+			batch_finish (g_async_queue_pop (done));
+			in_flight--;
+		}
+
+		g_thread_pool_push (pool, asset, NULL);
+		in_flight++;
+	}
+
+	while (in_flight > 0)
+	{
+		batch_finish (g_async_queue_pop (done));
+		in_flight--;
+	}
+
+	g_thread_pool_free (pool, FALSE, TRUE);
+	g_async_queue_unref (done);
+	g_strfreev (lines);
+
+	*failed = 0;
+	text = g_string_new (NULL);
+
+	for(guint i = 0; i < assets->len; i++)
+	{
+		BatchAsset *asset = g_ptr_array_index (assets, i);
+		const gchar *name = asset->filename ? asset->filename : "-";
+
+		if (asset->error)
+		{
+			g_string_append_printf (text, "%s:%d: %s: failed: %s\n",
+					gimp_filename_to_utf8 (manifest), asset->line,
+					gimp_filename_to_utf8 (name), asset->error->message);
+			(*failed)++;
+		}
+		else
+		{
+			g_string_append_printf (text, "%s:%d: %s: ok (load %.1f ms, export %.1f ms, %d unchanged)\n",
+					gimp_filename_to_utf8 (manifest), asset->line,
+					gimp_filename_to_utf8 (name),
+					asset->stats.ns[VERA_PHASE_LOAD] / 1e6, asset->stats.ns[VERA_PHASE_EXPORT] / 1e6,
+					asset->unchanged);
+
+			if (vera_plan_wanted (&plan) && ! *failed
+					&& vera_plan_add_export (&plan, asset->filename, &asset->vals, &plan_error) != 0)
+			{
+				g_string_append_printf (text, "%s:%d: %s: failed: %s\n",
+						gimp_filename_to_utf8 (manifest), asset->line,
+						gimp_filename_to_utf8 (name), plan_error.message);
+				(*failed)++;
+			}
+		}
+
+		// directives that failed have no output to report on
+		if (asset->filename)
+			vera_stats_emit (&asset->stats, PLUG_IN_BINARY, asset->filename,
+					asset->error ? asset->error->message : NULL);
+
+		g_clear_error (&asset->error);
+		g_free (asset->source);
+		g_free (asset->filename);
+		g_free (asset);
+	}
+
+	count = assets->len;
+	g_ptr_array_free (assets, TRUE);
+
+	if (shared_name && shared.palsize && ! *failed)
+	{
+		if (vera_save_palette (shared_name, shared.cmap, shared.palsize, &shared_vals,
+					NULL, &plan_error) == 0
+				&& (! vera_plan_wanted (&plan)
+					|| vera_plan_add_palette (&plan, shared_name, &shared_vals, &plan_error) == 0))
+		{
+			g_string_append_printf (text, "%s: shared palette of %d colors written to %s.PAL\n",
+					gimp_filename_to_utf8 (manifest), shared.palsize,
+					gimp_filename_to_utf8 (shared_name));
+		}
+		else
+		{
+			g_string_append_printf (text, "%s: failed: %s\n",
+					gimp_filename_to_utf8 (manifest), plan_error.message);
+			(*failed)++;
+		}
+	}
+
+	g_free (shared_name);
+	g_free (collision_name);
+
+	if (vera_plan_wanted (&plan) && ! *failed)
+	{
+		if (vera_plan_write (&plan, NULL, &plan_error) == 0)
+		{
+			g_string_append_printf (text, "%s: VRAM planned for %d files\n",
+					gimp_filename_to_utf8 (manifest), plan.count);
+		}
+		else
+		{
+			g_string_append_printf (text, "%s: failed: %s\n",
+					gimp_filename_to_utf8 (manifest), plan_error.message);
+			(*failed)++;
+		}
+	}
+
+	vera_plan_clear (&plan);
+
+	g_print ("%s", text->str);
+
+	if (*failed)
+	{
+		g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_FAILED,
+				"%d of %u assets failed to export:\n%s", *failed, count, text->str);
+		g_string_free (text, TRUE);
+		return FALSE;
+	}
+
+	*report = g_string_free (text, FALSE);
 
 	return TRUE;
 }
@@ -1063,7 +1855,7 @@ static GtkWidget * check_button_init (GtkBuilder  *builder,
 
 static gboolean save_tiles_dialog (gint32 image_id)
 {
-	VeraSaveGui  vg;
+	VeraSaveGui  vg = { 0 };
 	GtkWidget  *dialog;
 	GtkBuilder *builder;
 	gchar      *ui_file;
@@ -1157,16 +1949,26 @@ static gboolean save_tiles_dialog (gint32 image_id)
 			veravals.tiled_file,
 			&veravals.tiled_file);
 
-	vg.no_tiled_file = check_button_init (builder, "bmp-file",
+	vg.bmp_file = check_button_init (builder, "bmp-file",
 			TRUE,
 			veravals.bmp_file,
 			&veravals.bmp_file);
 
-	vg.no_tiled_file = check_button_init (builder, "pal-file",
+	vg.pal_file = check_button_init (builder, "pal-file",
 			TRUE,
 			veravals.pal_file,
 			&veravals.pal_file);
 
+	vg.dedup_tiles = check_button_init (builder, "dedup-tiles",
+			TRUE,
+			veravals.dedup_tiles,
+			&veravals.dedup_tiles);
+
+	vg.palette_banks = check_button_init (builder, "palette-banks",
+			TRUE,
+			veravals.palette_banks,
+			&veravals.palette_banks);
+
 	/* Load/save defaults buttons */
 	g_signal_connect_swapped (gtk_builder_get_object (builder, "load-defaults"),
 			"clicked",
@@ -1190,7 +1992,7 @@ static gboolean save_tiles_dialog (gint32 image_id)
 
 static gboolean save_bitmap_dialog (gint32 image_id)
 {
-	VeraSaveGui  vg;
+	VeraSaveGui  vg = { 0 };
 	GtkWidget  *dialog;
 	GtkBuilder *builder;
 	gchar      *ui_file;
@@ -1245,12 +2047,12 @@ static gboolean save_bitmap_dialog (gint32 image_id)
 			veravals.tile_bpp,
 			&veravals.tile_bpp);
 
-	vg.no_tiled_file = check_button_init (builder, "bmp-file",
+	vg.bmp_file = check_button_init (builder, "bmp-file",
 			TRUE,
 			veravals.bmp_file,
 			&veravals.bmp_file);
 
-	vg.no_tiled_file = check_button_init (builder, "pal-file",
+	vg.pal_file = check_button_init (builder, "pal-file",
 			TRUE,
 			veravals.pal_file,
 			&veravals.pal_file);
@@ -1278,7 +2080,7 @@ static gboolean save_bitmap_dialog (gint32 image_id)
 
 static gboolean save_selector_dialog (gint32 image_id)
 {
-	VeraSaveGui  vg;
+	VeraSaveGui  vg = { 0 };
 	GtkWidget  *dialog;
 	GtkBuilder *builder;
 	gchar      *ui_file;
@@ -1320,6 +2122,36 @@ static gboolean save_selector_dialog (gint32 image_id)
 			veravals.file_header,
 			&veravals.file_header);
 
+	vg.export_cache = check_button_init (builder, "export-cache",
+			TRUE,
+			veravals.export_cache,
+			&veravals.export_cache);
+
+	vg.frames = check_button_init (builder, "frames",
+			TRUE,
+			veravals.frames,
+			&veravals.frames);
+
+	vg.delta_frames = check_button_init (builder, "delta-frames",
+			TRUE,
+			veravals.delta_frames,
+			&veravals.delta_frames);
+
+	vg.compress = check_button_init (builder, "compress",
+			TRUE,
+			veravals.compress,
+			&veravals.compress);
+
+	vg.patch_file = check_button_init (builder, "patch-file",
+			TRUE,
+			veravals.patch_file,
+			&veravals.patch_file);
+
+	vg.dither_tiles = check_button_init (builder, "dither-tiles",
+			TRUE,
+			veravals.dither_tiles,
+			&veravals.dither_tiles);
+
 	/* Radios */
 	vg.tileset_export = radio_button_init (builder, "vera-tileset",
 			TILESET,
@@ -1329,6 +2161,31 @@ static gboolean save_selector_dialog (gint32 image_id)
 			BITMAP,
 			veravals.export_type,
 			&veravals.export_type);
+	vg.sprite_export = radio_button_init (builder, "vera-sprite",
+			SPRITE,
+			veravals.export_type,
+			&veravals.export_type);
+
+	vg.dither_none = radio_button_init (builder, "dither-none",
+			DITHER_NONE,
+			veravals.dither,
+			&veravals.dither);
+	vg.dither_floyd_steinberg = radio_button_init (builder, "dither-floyd-steinberg",
+			DITHER_FLOYD_STEINBERG,
+			veravals.dither,
+			&veravals.dither);
+	vg.dither_atkinson = radio_button_init (builder, "dither-atkinson",
+			DITHER_ATKINSON,
+			veravals.dither,
+			&veravals.dither);
+	vg.dither_bayer_4 = radio_button_init (builder, "dither-bayer-4",
+			DITHER_BAYER_4,
+			veravals.dither,
+			&veravals.dither);
+	vg.dither_bayer_8 = radio_button_init (builder, "dither-bayer-8",
+			DITHER_BAYER_8,
+			veravals.dither,
+			&veravals.dither);
 
 	/* Show dialog and run */
 	gtk_widget_show (dialog);
@@ -1361,10 +2218,17 @@ static void load_gui_defaults (VeraSaveGui *vg)
 {
 	load_defaults ();
 
+	// each dialog only builds its own widgets, the others stay NULL
 #define SET_ACTIVE(field, datafield) \
-	if (GPOINTER_TO_INT (g_object_get_data (G_OBJECT (vg->field), "gimp-item-data")) == veravals.datafield) \
+	if (vg->field != NULL && \
+			GPOINTER_TO_INT (g_object_get_data (G_OBJECT (vg->field), "gimp-item-data")) == veravals.datafield) \
 	gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (vg->field), TRUE)
 
+	// a check button stores whether it is active, so it follows the value both ways
+#define SET_CHECKED(field, datafield) \
+	if (vg->field != NULL) \
+	gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (vg->field), veravals.datafield != 0)
+
 	// tile dialog
 	SET_ACTIVE (tile_1bpp, tile_bpp);
 	SET_ACTIVE (tile_2bpp, tile_bpp);
@@ -1381,30 +2245,45 @@ static void load_gui_defaults (VeraSaveGui *vg)
 	SET_ACTIVE (tile_height_32, tile_height);
 	SET_ACTIVE (tile_height_64, tile_height);
 
-	SET_ACTIVE (tiled_file, tiled_file);
-	SET_ACTIVE (bmp_file, bmp_file);
-	SET_ACTIVE (pal_file, pal_file);
+	SET_CHECKED (tiled_file, tiled_file);
+	SET_CHECKED (bmp_file, bmp_file);
+	SET_CHECKED (pal_file, pal_file);
+	SET_CHECKED (dedup_tiles, dedup_tiles);
+	SET_CHECKED (palette_banks, palette_banks);
 
 	// selector dialog
 	SET_ACTIVE (tileset_export, export_type);
 	SET_ACTIVE (bitmap_export, export_type);
-	SET_ACTIVE (file_header, export_type);
+	SET_ACTIVE (sprite_export, export_type);
+	SET_CHECKED (file_header, file_header);
+	SET_CHECKED (export_cache, export_cache);
+	SET_CHECKED (frames, frames);
+	SET_CHECKED (delta_frames, delta_frames);
+	SET_CHECKED (compress, compress);
+	SET_ACTIVE (dither_none, dither);
+	SET_ACTIVE (dither_floyd_steinberg, dither);
+	SET_ACTIVE (dither_atkinson, dither);
+	SET_ACTIVE (dither_bayer_4, dither);
+	SET_ACTIVE (dither_bayer_8, dither);
+	SET_CHECKED (dither_tiles, dither_tiles);
+	SET_CHECKED (patch_file, patch_file);
 
 #undef SET_ACTIVE
+#undef SET_CHECKED
 }
 
 static void load_defaults (void) {
 	GimpParasite *parasite;
 
 	/* initialize with hardcoded defaults */
-	veravals = defaults;
+	veravals = vera_default_vals;
 
-	parasite = gimp_get_parasite (VERA_DEFAULTS_PARASITE);
+	parasite = PDB_CALL (gimp_get_parasite (VERA_DEFAULTS_PARASITE));
 
 	if (parasite)
 	{
 		gchar        *def_str;
-		VeraSaveVals   tmpvals = defaults;
+		VeraSaveVals   tmpvals = vera_default_vals;
 		gint          num_fields;
 
 		def_str = g_strndup (gimp_parasite_data (parasite),
@@ -1412,7 +2291,7 @@ static void load_defaults (void) {
 
 		gimp_parasite_free (parasite);
 
-		num_fields = sscanf (def_str, "%d %d %d %d %d %d %d %d",
+		num_fields = sscanf (def_str, "%d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d",
 				(int *) &tmpvals.export_type,
 				(int *) &tmpvals.file_header,
 				(int *) &tmpvals.tile_bpp,
@@ -1420,11 +2299,28 @@ static void load_defaults (void) {
 				(int *) &tmpvals.tile_height,
 				(int *) &tmpvals.tiled_file,
 				(int *) &tmpvals.bmp_file,
-				(int *) &tmpvals.pal_file);
+				(int *) &tmpvals.pal_file,
+				(int *) &tmpvals.dedup_tiles,
+				(int *) &tmpvals.palette_banks,
+				(int *) &tmpvals.export_cache,
+				(int *) &tmpvals.frames,
+				(int *) &tmpvals.vram_address,
+				(int *) &tmpvals.compress,
+				(int *) &tmpvals.dither,
+				(int *) &tmpvals.dither_tiles,
+				(int *) &tmpvals.patch_file,
+				(int *) &tmpvals.delta_frames,
+				(int *) &tmpvals.vblank_bytes,
+				(int *) &tmpvals.frame_palettes,
+				(int *) &tmpvals.frame_bytes,
+				(int *) &tmpvals.bank_split,
+				(int *) &tmpvals.split_tiles,
+				(int *) &tmpvals.first_bank);
 
 		g_free (def_str);
 
-		if (num_fields == 7)
+		// defaults saved by older versions lack the newer fields
+		if (num_fields >= 8)
 			veravals = tmpvals;
 	}
 }
@@ -1434,7 +2330,7 @@ static void save_defaults (void)
 	GimpParasite *parasite;
 	gchar        *def_str;
 
-	def_str = g_strdup_printf ("%d %d %d %d %d %d %d %d",
+	def_str = g_strdup_printf ("%d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d",
 			veravals.export_type,
 			veravals.file_header,
 			veravals.tile_bpp,
@@ -1442,7 +2338,23 @@ static void save_defaults (void)
 			veravals.tile_height,
 			veravals.tiled_file,
 			veravals.bmp_file,
-			veravals.pal_file);
+			veravals.pal_file,
+			veravals.dedup_tiles,
+			veravals.palette_banks,
+			veravals.export_cache,
+			veravals.frames,
+			veravals.vram_address,
+			veravals.compress,
+			veravals.dither,
+			veravals.dither_tiles,
+			veravals.patch_file,
+			veravals.delta_frames,
+			veravals.vblank_bytes,
+			veravals.frame_palettes,
+			veravals.frame_bytes,
+			veravals.bank_split,
+			veravals.split_tiles,
+			veravals.first_bank);
 
 	parasite = gimp_parasite_new (VERA_DEFAULTS_PARASITE,
 			GIMP_PARASITE_PERSISTENT,
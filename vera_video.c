@@ -0,0 +1,87 @@
+#include "vera_video.h"
+
+#include <string.h>
+
+#define MAX_RUN  0xffff
+
+static void put_run(uint8_t *dst, size_t *n, size_t skip, const uint8_t *data, size_t copy)
+{
+	if (dst)
+	{
+		uint8_t *p = dst + *n;
+
+		p[0] = skip & 0xff;
+		p[1] = skip >> 8;
+		p[2] = copy & 0xff;
+		p[3] = copy >> 8;
+
+		if (copy)
+			memcpy(p + 4, data, copy);
+	}
+
+	*n += 4 + copy;
+}
+
+/* splits a skip and a copy into runs that fit 16 bits */
+static void write_runs(uint8_t *dst, size_t *n, size_t skip, const uint8_t *data, size_t copy)
+{
+	for(; skip > MAX_RUN; skip -= MAX_RUN)
+		put_run(dst, n, MAX_RUN, NULL, 0);
+
+	for(; copy > MAX_RUN; copy -= MAX_RUN, data += MAX_RUN, skip = 0)
+		put_run(dst, n, skip, data, MAX_RUN);
+
+	put_run(dst, n, skip, data, copy);
+}
+
+/* the bytes from i on that have not changed, up to limit */
+static size_t same_bytes(const uint8_t *before, const uint8_t *frame, size_t i, size_t limit)
+{
+	size_t n = 0;
+
+	if (! before)
+		return 0;
+
+	while (i + n < limit && before[i + n] == frame[i + n])
+		n++;
+
+	return n;
+}
+
+size_t vera_video_runs(const uint8_t *before,
+		const uint8_t *frame,
+		size_t         length,
+		uint8_t       *dst)
+{
+	size_t n = 0;
+	size_t i = 0;
+
+	for(;;)
+	{
+		size_t start = i + same_bytes(before, frame, i, length);
+		size_t end = start;
+
+		// bytes left as they are at the end need no run
+		if (start == length)
+			break;
+
+		while (end < length)
+		{
+			size_t same = same_bytes(before, frame, end, end + VERA_VIDEO_MIN_SKIP < length
+					? end + VERA_VIDEO_MIN_SKIP : length);
+
+			if (same == VERA_VIDEO_MIN_SKIP || end + same == length)
+				break;
+
+			end += same ? same : 1;
+		}
+
+		write_runs(dst, &n, start - i, frame + start, end - start);
+		i = end;
+	}
+
+	if (dst)
+		memset(dst + n, 0, 4);
+
+	return n + 4;
+}
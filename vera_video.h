@@ -0,0 +1,43 @@
+#ifndef VERA_VIDEO_H
+#define VERA_VIDEO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Bitmap video.  Every frame is a full screen bitmap, stored as the runs of
+ * bytes that changed since the frame before, so a player streams it through
+ * the auto-incrementing DATA0 port:
+ *
+ *   [2 byte header] u16 count, u16 width, u16 height, u8 bpp,
+ *                   count * frame
+ *
+ *   frame: u32 length, u16 colors, colors * 2 bytes of palette,
+ *          { u16 skip, u16 copy, copy bytes }..., u16 0, u16 0
+ *
+ * Values are little endian and length counts the bytes after itself.  A
+ * frame with colors set first loads that many palette entries, as the .PAL
+ * file holds them, from entry 0 on.  Each run then moves the VRAM address
+ * skip bytes on and copies copy bytes to it, starting from the start of the
+ * bitmap.  The first frame is all copies.
+ */
+
+#define VERA_VIDEO_HEADER  7
+
+/*
+ * Skips shorter than this are copied through, as a new run costs 4 bytes and
+ * setting the VRAM address again.
+ */
+#define VERA_VIDEO_MIN_SKIP  8
+
+/*
+ * Writes the runs that turn before into frame, both length bytes, and the
+ * two zeros that end them into dst, and returns the bytes written.  Without
+ * before, every byte is copied.  With dst NULL, only the length is counted.
+ */
+size_t vera_video_runs(const uint8_t *before,
+		const uint8_t *frame,
+		size_t         length,
+		uint8_t       *dst);
+
+#endif